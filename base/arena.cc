@@ -4,33 +4,93 @@
 
 #include "base/arena.h"
 #include <assert.h>
+#include <algorithm>
+
+#if defined(OS_LINUX) && !defined(OS_ANDROID) && !defined(OS_NACL)
+#include <sys/mman.h>
+#define GBASE_ARENA_HAVE_MMAP
+#endif  // OS_LINUX && !OS_ANDROID && !OS_NACL
 
 namespace gbase {
 
-static const int kBlockSize = 4096;
+namespace {
+
+size_t RoundUp(size_t bytes, size_t unit) {
+  return (bytes + unit - 1) / unit * unit;
+}
 
-Arena::Arena() : memory_usage_(0) {
-  alloc_ptr_ = NULL;  // First allocation will allocate a block
-  alloc_bytes_remaining_ = 0;
+// Returns the block size actually used for "options.block_size".
+size_t InitialBlockSize(const ArenaOptions& options) {
+  return options.use_huge_pages ?
+      RoundUp(options.block_size, ArenaOptions::kHugePageSize) :
+      options.block_size;
+}
+
+}  // namespace
+
+const size_t ArenaOptions::kHugePageSize;
+
+Arena::Arena()
+    : alloc_ptr_(NULL),  // First allocation will allocate a block
+      alloc_bytes_remaining_(0),
+      next_block_size_(InitialBlockSize(options_)),
+      num_block_allocations_(0),
+      memory_usage_(0) {
+}
+
+Arena::Arena(const ArenaOptions& options)
+    : options_(options),
+      alloc_ptr_(NULL),
+      alloc_bytes_remaining_(0),
+      next_block_size_(InitialBlockSize(options)),
+      num_block_allocations_(0),
+      memory_usage_(0) {
+  assert(options.block_size > 0);
 }
 
 Arena::~Arena() {
   for (size_t i = 0; i < blocks_.size(); i++) {
-    delete[] blocks_[i];
+    FreeBlock(blocks_[i]);
+  }
+  for (size_t i = 0; i < free_blocks_.size(); i++) {
+    FreeBlock(free_blocks_[i]);
+  }
+  for (std::multimap<size_t, Block>::const_iterator it =
+           free_dedicated_blocks_.begin();
+       it != free_dedicated_blocks_.end(); ++it) {
+    FreeBlock(it->second);
   }
 }
 
 char* Arena::AllocateFallback(size_t bytes) {
-  if (bytes > kBlockSize / 4) {
+  if (bytes > next_block_size_ / 4) {
     // Object is more than a quarter of our block size.  Allocate it separately
     // to avoid wasting too much space in leftover bytes.
-    char* result = AllocateNewBlock(bytes);
+    char* result = ReuseDedicatedBlock(bytes);
+    if (result == NULL) {
+      result = AllocateNewBlock(bytes, true);
+    }
     return result;
   }
 
   // We waste the remaining space in the current block.
-  alloc_ptr_ = AllocateNewBlock(kBlockSize);
-  alloc_bytes_remaining_ = kBlockSize;
+  size_t block_size;
+  alloc_ptr_ = ReuseBlock(bytes, &block_size);
+  if (alloc_ptr_ == NULL) {
+    block_size = next_block_size_;
+    alloc_ptr_ = AllocateNewBlock(block_size, false);
+  }
+  // The size grows even when a block is reused, so that the arena
+  // allocates the same sizes again after a rewind.
+  if (next_block_size_ < options_.max_block_size) {
+    next_block_size_ = std::min(next_block_size_ * 2,
+                                options_.max_block_size);
+    if (options_.use_huge_pages) {
+      next_block_size_ =
+          RoundUp(next_block_size_, ArenaOptions::kHugePageSize);
+    }
+  }
+  alloc_bytes_remaining_ = block_size;
 
   char* result = alloc_ptr_;
   alloc_ptr_ += bytes;
@@ -57,12 +117,142 @@ char* Arena::AllocateAligned(size_t bytes) {
   return result;
 }
 
-char* Arena::AllocateNewBlock(size_t block_bytes) {
-  char* result = new char[block_bytes];
-  blocks_.push_back(result);
+char* Arena::AllocateNewBlock(size_t block_bytes, bool dedicated) {
+  Block block;
+  if (!options_.use_huge_pages ||
+      block_bytes < ArenaOptions::kHugePageSize ||
+      !MapHugePageBlock(block_bytes, &block)) {
+    block.data = new char[block_bytes];
+    block.size = block_bytes;
+    block.mapped = false;
+  }
+  block.dedicated = dedicated;
+  blocks_.push_back(block);
+  ++num_block_allocations_;
+  AddMemoryUsage(block.size);
+  return block.data;
+}
+
+char* Arena::ReuseBlock(size_t min_bytes, size_t* block_bytes) {
+  while (!free_blocks_.empty()) {
+    const Block block = free_blocks_.back();
+    free_blocks_.pop_back();
+    if (block.size >= min_bytes) {
+      blocks_.push_back(block);
+      *block_bytes = block.size;
+      return block.data;
+    }
+    // Too small for this allocation, and for the following ones which are
+    // served from larger blocks.
+    FreeBlock(block);
+    SubtractMemoryUsage(block.size);
+  }
+  return NULL;
+}
+
+char* Arena::ReuseDedicatedBlock(size_t bytes) {
+  // The smallest block which fits, unless it is more than twice as large,
+  // so that small allocations do not take the blocks of larger ones.
+  std::multimap<size_t, Block>::iterator it =
+      free_dedicated_blocks_.lower_bound(bytes);
+  if (it == free_dedicated_blocks_.end() || it->first / 2 > bytes) {
+    return NULL;
+  }
+  blocks_.push_back(it->second);
+  free_dedicated_blocks_.erase(it);
+  return blocks_.back().data;
+}
+
+void Arena::AddMemoryUsage(size_t block_bytes) {
   memory_usage_.NoBarrier_Store(
-      reinterpret_cast<void*>(MemoryUsage() + block_bytes + sizeof(char*)));
-  return result;
+      reinterpret_cast<void*>(MemoryUsage() + block_bytes + sizeof(Block)));
+}
+
+void Arena::SubtractMemoryUsage(size_t block_bytes) {
+  memory_usage_.NoBarrier_Store(
+      reinterpret_cast<void*>(MemoryUsage() - block_bytes - sizeof(Block)));
+}
+
+ArenaCheckpoint Arena::Checkpoint() const {
+  ArenaCheckpoint checkpoint;
+  checkpoint.num_blocks = blocks_.size();
+  checkpoint.alloc_ptr = alloc_ptr_;
+  checkpoint.alloc_bytes_remaining = alloc_bytes_remaining_;
+  checkpoint.next_block_size = next_block_size_;
+  return checkpoint;
+}
+
+void Arena::Rewind(const ArenaCheckpoint& checkpoint) {
+  assert(checkpoint.num_blocks <= blocks_.size());
+  // Blocks are released from the newest one, so that free_blocks_.back()
+  // is the oldest block and is reused first.
+  while (blocks_.size() > checkpoint.num_blocks) {
+    const Block block = blocks_.back();
+    blocks_.pop_back();
+    if (block.dedicated) {
+      free_dedicated_blocks_.insert(std::make_pair(block.size, block));
+    } else {
+      free_blocks_.push_back(block);
+    }
+  }
+  alloc_ptr_ = checkpoint.alloc_ptr;
+  alloc_bytes_remaining_ = checkpoint.alloc_bytes_remaining;
+  next_block_size_ = checkpoint.next_block_size;
+}
+
+void Arena::Reset() {
+  ArenaCheckpoint checkpoint;
+  checkpoint.num_blocks = 0;
+  checkpoint.alloc_ptr = NULL;
+  checkpoint.alloc_bytes_remaining = 0;
+  checkpoint.next_block_size = InitialBlockSize(options_);
+  Rewind(checkpoint);
+}
+
+// static
+bool Arena::MapHugePageBlock(size_t block_bytes, Block* block) {
+#ifdef GBASE_ARENA_HAVE_MMAP
+  const size_t kHugePageSize = ArenaOptions::kHugePageSize;
+  const size_t size = RoundUp(block_bytes, kHugePageSize);
+  // mmap() aligns only to the normal page size.  Map an extra huge page
+  // and trim both ends so that the block starts at a huge page boundary,
+  // which the kernel requires to back it with huge pages.
+  void* mem = mmap(NULL, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+  char* begin = static_cast<char*>(mem);
+  char* aligned = reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<uintptr_t>(begin), kHugePageSize));
+  if (aligned > begin) {
+    munmap(begin, aligned - begin);
+  }
+  char* end = begin + size + kHugePageSize;
+  if (end > aligned + size) {
+    munmap(aligned + size, end - (aligned + size));
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+  block->data = aligned;
+  block->size = size;
+  block->mapped = true;
+  return true;
+#else  // GBASE_ARENA_HAVE_MMAP
+  return false;
+#endif  // GBASE_ARENA_HAVE_MMAP
+}
+
+// static
+void Arena::FreeBlock(const Block& block) {
+#ifdef GBASE_ARENA_HAVE_MMAP
+  if (block.mapped) {
+    munmap(block.data, block.size);
+    return;
+  }
+#endif  // GBASE_ARENA_HAVE_MMAP
+  delete[] block.data;
 }
 
 }  // namespace gbase
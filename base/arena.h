@@ -5,6 +5,7 @@
 #ifndef GBASE_BASE_ARENA_H_
 #define GBASE_BASE_ARENA_H_
 
+#include <map>
 #include <vector>
 #include <assert.h>
 #include <stddef.h>
@@ -13,9 +14,40 @@
 
 namespace gbase {
 
+struct ArenaOptions {
+  ArenaOptions()
+      : block_size(4096),
+        max_block_size(4096),
+        use_huge_pages(false) {}
+
+  // Size of the first block.
+  size_t block_size;
+
+  // Each new block is twice as large as the previous one, up to this
+  // size.  Blocks have a fixed size if this is not larger than block_size.
+  size_t max_block_size;
+
+  // If true, blocks are rounded up to a multiple of kHugePageSize, and
+  // mapped with mmap() at a huge page boundary with MADV_HUGEPAGE, so that
+  // a large arena needs far fewer TLB entries.  Falls back to the normal
+  // allocation on the platforms without transparent huge pages.
+  bool use_huge_pages;
+
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+};
+
+// A position in an Arena, returned by Arena::Checkpoint().
+struct ArenaCheckpoint {
+  size_t num_blocks;
+  char* alloc_ptr;
+  size_t alloc_bytes_remaining;
+  size_t next_block_size;
+};
+
 class Arena {
  public:
   Arena();
+  explicit Arena(const ArenaOptions& options);
   ~Arena();
 
   // Return a pointer to a newly allocated memory block of "bytes" bytes.
@@ -30,16 +62,65 @@ class Arena {
     return reinterpret_cast<uintptr_t>(memory_usage_.NoBarrier_Load());
   }
 
+  // Returns the number of blocks allocated from the system so far,
+  // including the ones freed since.
+  size_t NumBlockAllocations() const { return num_block_allocations_; }
+
+  // Returns the current position of the arena.
+  ArenaCheckpoint Checkpoint() const;
+
+  // Releases all the memory allocated since "checkpoint" was taken.  The
+  // blocks are kept and handed out again by the following allocations, so
+  // an arena that is rewound after each request stops calling malloc once
+  // it has grown to the size of a request.  Blocks dedicated to a single
+  // large allocation are kept as well, and reused by the large allocations
+  // which fit in them.
+  // REQUIRES: The arena has not been rewound to a position before
+  // "checkpoint" since it was taken.
+  void Rewind(const ArenaCheckpoint& checkpoint);
+
+  // Releases all the memory allocated by the arena, keeping the blocks for
+  // reuse.  Same as rewinding to a checkpoint taken at construction.
+  void Reset();
+
  private:
+  struct Block {
+    char* data;
+    size_t size;
+    // True if the block is mapped with mmap() instead of new[].
+    bool mapped;
+    // True if the block is dedicated to a single large allocation.
+    bool dedicated;
+  };
+
   char* AllocateFallback(size_t bytes);
-  char* AllocateNewBlock(size_t block_bytes);
+  char* AllocateNewBlock(size_t block_bytes, bool dedicated);
+  char* ReuseBlock(size_t min_bytes, size_t* block_bytes);
+  char* ReuseDedicatedBlock(size_t bytes);
+  void AddMemoryUsage(size_t block_bytes);
+  void SubtractMemoryUsage(size_t block_bytes);
+  static bool MapHugePageBlock(size_t block_bytes, Block* block);
+  static void FreeBlock(const Block& block);
+
+  const ArenaOptions options_;
 
   // Allocation state
   char* alloc_ptr_;
   size_t alloc_bytes_remaining_;
 
-  // Array of new[] allocated memory blocks
-  std::vector<char*> blocks_;
+  // Size of the next block, which grows up to options_.max_block_size.
+  size_t next_block_size_;
+
+  // Array of allocated memory blocks
+  std::vector<Block> blocks_;
+
+  // Blocks released by Rewind(), in the reverse order of their allocation.
+  std::vector<Block> free_blocks_;
+
+  // Dedicated blocks released by Rewind(), indexed by their size.
+  std::multimap<size_t, Block> free_dedicated_blocks_;
+
+  size_t num_block_allocations_;
 
   // Total memory usage of the arena.
   port::AtomicPointer memory_usage_;
@@ -63,6 +144,63 @@ inline char* Arena::Allocate(size_t bytes) {
   return AllocateFallback(bytes);
 }
 
+// STL allocator allocating from an Arena, e.g.
+//   Arena arena;
+//   std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(&arena)));
+// Deallocation is a no-op; the memory is released with Arena::Rewind(),
+// Arena::Reset() or the destruction of the arena, which has to outlive the
+// containers using it.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other)  // NOLINT
+      : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    static_assert(alignof(T) <= 8,
+                  "Arena::AllocateAligned() aligns only to 8 bytes");
+    if (n == 0) {
+      return NULL;
+    }
+    return reinterpret_cast<T*>(arena_->AllocateAligned(n * sizeof(T)));
+  }
+
+  void deallocate(T* /* p */, size_t /* n */) {}
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a,
+                       const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a,
+                       const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
 }  // namespace gbase
 
 #endif  // GBASE_BASE_ARENA_H_
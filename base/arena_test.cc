@@ -4,6 +4,12 @@
 
 #include "base/arena.h"
 
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
 #include "base/random.h"
 #include "gtest/gtest.h"
 
@@ -63,5 +69,128 @@ TEST(ArenaTest, Simple) {
   }
 }
 
+
+// Fills the allocations with a pattern and checks it afterwards.
+void TestAllocations(Arena* arena, int n) {
+  std::vector<std::pair<size_t, char*> > allocated;
+  Random rnd(301);
+  for (int i = 0; i < n; i++) {
+    const size_t s = 1 + (rnd.OneIn(100) ? rnd.Uniform(6000) : rnd.Uniform(50));
+    char* r = rnd.OneIn(10) ? arena->AllocateAligned(s) : arena->Allocate(s);
+    memset(r, i % 256, s);
+    allocated.push_back(std::make_pair(s, r));
+  }
+  for (size_t i = 0; i < allocated.size(); i++) {
+    for (size_t b = 0; b < allocated[i].first; b++) {
+      ASSERT_EQ(int(allocated[i].second[b]) & 0xff, i % 256);
+    }
+  }
+}
+
+TEST(ArenaTest, GrowingBlocks) {
+  ArenaOptions options;
+  options.block_size = 1024;
+  options.max_block_size = 64 * 1024;
+  Arena arena(options);
+  TestAllocations(&arena, 100000);
+
+  // The first block has the initial size.
+  Arena small_arena(options);
+  small_arena.Allocate(1);
+  EXPECT_LE(options.block_size, small_arena.MemoryUsage());
+  EXPECT_GT(2 * options.block_size, small_arena.MemoryUsage());
+}
+
+TEST(ArenaTest, HugePages) {
+  ArenaOptions options;
+  options.use_huge_pages = true;
+  Arena arena(options);
+  char* first = arena.Allocate(1);
+#ifdef OS_LINUX
+  // Blocks are mapped at a huge page boundary.
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(first) %
+            ArenaOptions::kHugePageSize);
+#endif  // OS_LINUX
+  EXPECT_EQ(first + 1, arena.Allocate(1));
+  // The block size is rounded up to the huge page size.
+  EXPECT_LE(ArenaOptions::kHugePageSize, arena.MemoryUsage());
+  TestAllocations(&arena, 100000);
+}
+
+TEST(ArenaTest, Rewind) {
+  ArenaOptions options;
+  options.block_size = 1024;
+  options.max_block_size = 64 * 1024;
+  Arena arena(options);
+  char* first = arena.Allocate(10);
+  memset(first, 'a', 10);
+  const ArenaCheckpoint checkpoint = arena.Checkpoint();
+  char* second = arena.Allocate(10);
+  TestAllocations(&arena, 10000);
+  const size_t usage = arena.MemoryUsage();
+  const size_t num_blocks = arena.NumBlockAllocations();
+
+  // Rewinding gives back the same memory, and keeps the earlier data.
+  arena.Rewind(checkpoint);
+  EXPECT_EQ(second, arena.Allocate(10));
+  EXPECT_EQ(std::string(10, 'a'), std::string(first, 10));
+
+  // The same allocations reuse the blocks, including the dedicated ones.
+  arena.Rewind(checkpoint);
+  TestAllocations(&arena, 10000);
+  EXPECT_EQ(usage, arena.MemoryUsage());
+  EXPECT_EQ(num_blocks, arena.NumBlockAllocations());
+
+  // A large allocation reuses a dedicated block which fits.
+  arena.Rewind(checkpoint);
+  char* large = arena.Allocate(1024 * 1024);
+  EXPECT_EQ(num_blocks + 1, arena.NumBlockAllocations());
+  arena.Rewind(checkpoint);
+  EXPECT_EQ(large, arena.Allocate(1000 * 1024));
+  EXPECT_EQ(num_blocks + 1, arena.NumBlockAllocations());
+  // But not a block more than twice as large.
+  arena.Allocate(100 * 1024);
+  EXPECT_EQ(num_blocks + 2, arena.NumBlockAllocations());
+
+  arena.Reset();
+  EXPECT_EQ(first, arena.Allocate(10));
+  TestAllocations(&arena, 10000);
+}
+
+TEST(ArenaTest, Allocator) {
+  typedef std::basic_string<char, std::char_traits<char>,
+                            ArenaAllocator<char> > ArenaString;
+  typedef std::map<int, ArenaString, std::less<int>,
+                   ArenaAllocator<std::pair<const int, ArenaString> > >
+      ArenaMap;
+  Arena arena;
+  size_t num_blocks = 0;
+  for (int round = 0; round < 3; ++round) {
+    {
+      std::vector<int, ArenaAllocator<int> > v((ArenaAllocator<int>(&arena)));
+      ArenaMap m((std::less<int>()), ArenaMap::allocator_type(&arena));
+      for (int i = 0; i < 1000; ++i) {
+        v.push_back(i);
+        m.insert(std::make_pair(
+            i, ArenaString(100, 'a' + i % 26,
+                           ArenaString::allocator_type(&arena))));
+      }
+      for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(i, v[i]);
+        EXPECT_EQ(ArenaString(100, 'a' + i % 26,
+                              ArenaString::allocator_type(&arena)),
+                  m.find(i)->second);
+      }
+    }
+    if (round > 0) {
+      // No new blocks are allocated after the first round, even for the
+      // growing vector.
+      EXPECT_EQ(num_blocks, arena.NumBlockAllocations());
+    }
+    num_blocks = arena.NumBlockAllocations();
+    arena.Reset();
+  }
+}
+
 }  // namespace
 }  // namespace gbase
@@ -0,0 +1,237 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/concurrent_arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(OS_LINUX) && !defined(OS_ANDROID) && !defined(OS_NACL)
+#include <sched.h>
+#endif  // OS_LINUX && !OS_ANDROID && !OS_NACL
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+namespace gbase {
+
+namespace {
+
+// Upper bound of the shard chunk, so that huge blocks are not split into
+// huge chunks which are mostly left unused.
+const size_t kMaxShardBlockSize = 128 * 1024;
+const size_t kAlign = (sizeof(void *) > 8) ? sizeof(void *) : 8;
+const size_t kCacheLineSize = 64;
+
+size_t RoundUp(size_t bytes) {
+  return (bytes + kAlign - 1) & ~(kAlign - 1);
+}
+
+size_t ShardBlockSize(const ArenaOptions &options) {
+  return RoundUp(std::max<size_t>(
+      std::min(options.block_size / 8, kMaxShardBlockSize), kAlign));
+}
+
+}  // namespace
+
+struct ConcurrentArena::Block {
+  std::atomic<size_t> used;
+  size_t size;
+  char *data;
+};
+
+// Aligned so that each shard has a cache line of its own.
+struct alignas(kCacheLineSize) ConcurrentArena::Shard {
+  Shard() : locked(false), alloc_ptr(NULL), alloc_bytes_remaining(0) {}
+
+  void Lock() {
+    while (locked.exchange(true, std::memory_order_acquire)) {
+      while (locked.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void Unlock() {
+    locked.store(false, std::memory_order_release);
+  }
+
+  std::atomic<bool> locked;
+  char *alloc_ptr;
+  size_t alloc_bytes_remaining;
+};
+
+ConcurrentArena::ConcurrentArena()
+    : shard_block_size_(ShardBlockSize(options_)),
+      current_block_(NULL),
+      next_block_size_(options_.block_size),
+      arena_(options_),
+      memory_usage_(0) {
+  InitShards();
+}
+
+ConcurrentArena::ConcurrentArena(const ArenaOptions &options)
+    : options_(options),
+      shard_block_size_(ShardBlockSize(options)),
+      current_block_(NULL),
+      next_block_size_(options.block_size),
+      arena_(options),
+      memory_usage_(0) {
+  InitShards();
+}
+
+ConcurrentArena::~ConcurrentArena() {}
+
+void ConcurrentArena::InitShards() {
+  size_t num_shards = 1;
+  while (num_shards < std::thread::hardware_concurrency()) {
+    num_shards *= 2;
+  }
+  // new[] does not honor the alignment of Shard before C++17.
+  static_assert(std::is_trivially_destructible<Shard>::value,
+                "Shards are not destroyed");
+  shard_memory_.reset(new char[num_shards * sizeof(Shard) + kCacheLineSize]);
+  const uintptr_t memory = reinterpret_cast<uintptr_t>(shard_memory_.get());
+  shards_ = reinterpret_cast<Shard *>(
+      (memory + kCacheLineSize - 1) & ~(kCacheLineSize - 1));
+  for (size_t i = 0; i < num_shards; ++i) {
+    new (&shards_[i]) Shard;
+  }
+  shard_mask_ = num_shards - 1;
+}
+
+char *ConcurrentArena::Allocate(size_t bytes) {
+  // As with Arena, 0-byte allocations are disallowed.
+  assert(bytes > 0);
+  if (bytes > shard_block_size_ / 4) {
+    return AllocateShared(RoundUp(bytes));
+  }
+  return AllocateFromShard(bytes, false);
+}
+
+char *ConcurrentArena::AllocateAligned(size_t bytes) {
+  assert(bytes > 0);
+  if (bytes > shard_block_size_ / 4) {
+    return AllocateShared(RoundUp(bytes));
+  }
+  char *result = AllocateFromShard(bytes, true);
+  assert((reinterpret_cast<uintptr_t>(result) & (kAlign - 1)) == 0);
+  return result;
+}
+
+char *ConcurrentArena::AllocateFromShard(size_t bytes, bool aligned) {
+  Shard *shard = CurrentShard();
+  shard->Lock();
+  size_t slop = 0;
+  if (aligned) {
+    const size_t current_mod =
+        reinterpret_cast<uintptr_t>(shard->alloc_ptr) & (kAlign - 1);
+    slop = (current_mod == 0) ? 0 : kAlign - current_mod;
+  }
+  if (bytes + slop > shard->alloc_bytes_remaining) {
+    // We waste the remaining space in the current chunk.  New chunks are
+    // always aligned.
+    shard->alloc_ptr = AllocateShared(shard_block_size_);
+    shard->alloc_bytes_remaining = shard_block_size_;
+    slop = 0;
+  }
+  char *result = shard->alloc_ptr + slop;
+  shard->alloc_ptr += bytes + slop;
+  shard->alloc_bytes_remaining -= bytes + slop;
+  shard->Unlock();
+  return result;
+}
+
+char *ConcurrentArena::AllocateShared(size_t bytes) {
+  while (true) {
+    Block *block = current_block_.load(std::memory_order_acquire);
+    if (bytes > (block != NULL ? block->size : options_.block_size) / 4) {
+      // Object is more than a quarter of the current block size.  Allocate
+      // it separately to avoid wasting too much space in leftover bytes.
+      scoped_lock l(&mutex_);
+      return AllocateNewBlock(bytes);
+    }
+    if (block != NULL) {
+      const size_t offset =
+          block->used.fetch_add(bytes, std::memory_order_relaxed);
+      if (offset + bytes <= block->size) {
+        return block->data + offset;
+      }
+    }
+
+    // The block ran out.  The first thread to get here replaces it, and
+    // the others retry with the new one.
+    scoped_lock l(&mutex_);
+    if (current_block_.load(std::memory_order_relaxed) == block) {
+      const size_t header_size = RoundUp(sizeof(Block));
+      size_t block_size = next_block_size_;
+      if (options_.use_huge_pages) {
+        // Fill the huge pages including the header.
+        const size_t kHugePageSize = ArenaOptions::kHugePageSize;
+        block_size = (header_size + block_size + kHugePageSize - 1) /
+            kHugePageSize * kHugePageSize - header_size;
+      }
+      if (next_block_size_ < options_.max_block_size) {
+        next_block_size_ = std::min(next_block_size_ * 2,
+                                    options_.max_block_size);
+      }
+      char *mem = AllocateNewBlock(header_size + block_size);
+      Block *new_block = new (mem) Block;
+      new_block->used.store(0, std::memory_order_relaxed);
+      new_block->size = block_size;
+      new_block->data = mem + header_size;
+      current_block_.store(new_block, std::memory_order_release);
+    }
+  }
+}
+
+char *ConcurrentArena::AllocateNewBlock(size_t block_bytes) {
+  // Shared blocks are larger than a quarter of the block size of arena_,
+  // so arena_ maps each of them as a separate block of its own.
+  char *result = arena_.AllocateAligned(block_bytes);
+  memory_usage_.store(arena_.MemoryUsage(), std::memory_order_relaxed);
+  return result;
+}
+
+ConcurrentArena::Shard *ConcurrentArena::CurrentShard() {
+#if defined(OS_LINUX) && !defined(OS_ANDROID) && !defined(OS_NACL)
+  const int cpu = sched_getcpu();
+  if (cpu >= 0) {
+    return &shards_[cpu & shard_mask_];
+  }
+#endif  // OS_LINUX && !OS_ANDROID && !OS_NACL
+  // Threads are spread over the shards instead.
+  const size_t hash = std::hash<std::thread::id>()(std::this_thread::get_id());
+  return &shards_[hash & shard_mask_];
+}
+
+}  // namespace gbase
@@ -0,0 +1,111 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_BASE_CONCURRENT_ARENA_H_
+#define GBASE_BASE_CONCURRENT_ARENA_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+
+#include "base/arena.h"
+#include "base/mutex.h"
+#include "base/port.h"
+
+namespace gbase {
+
+// Thread-safe variant of Arena.  Allocate() and AllocateAligned() can be
+// called from many threads at once.
+//
+// Small allocations are served from per-core shards, each of which owns a
+// small chunk and is locked only by the threads running on that core, so
+// the lock is almost never contended.  Shards refill their chunks, and
+// large allocations are served, from a shared block with an atomic bump
+// pointer.  The global lock is taken only to allocate a new block.  The
+// shared blocks follow ArenaOptions in the same way as the blocks of Arena.
+//
+// Like Arena, memory is released only when the arena is destroyed.
+class ConcurrentArena {
+ public:
+  ConcurrentArena();
+  explicit ConcurrentArena(const ArenaOptions &options);
+  ~ConcurrentArena();
+
+  // Return a pointer to a newly allocated memory block of "bytes" bytes.
+  char *Allocate(size_t bytes);
+
+  // Allocate memory with the normal alignment guarantees provided by malloc
+  char *AllocateAligned(size_t bytes);
+
+  // Returns an estimate of the total memory usage of data allocated by the
+  // arena, including the chunks reserved by the shards.
+  size_t MemoryUsage() const {
+    return memory_usage_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Block;
+  struct Shard;
+
+  char *AllocateFromShard(size_t bytes, bool aligned);
+  // Returns aligned memory from the shared block.  Lock-free unless the
+  // block runs out.
+  char *AllocateShared(size_t bytes);
+  // REQUIRES: mutex_ is held.
+  char *AllocateNewBlock(size_t block_bytes);
+  void InitShards();
+  Shard *CurrentShard();
+
+  const ArenaOptions options_;
+  // Size of the chunk a shard takes from the shared block at once.
+  const size_t shard_block_size_;
+
+  // Cache line aligned array in shard_memory_.
+  Shard *shards_;
+  std::unique_ptr<char[]> shard_memory_;
+  size_t shard_mask_;
+
+  // The block the shards refill from.
+  std::atomic<Block *> current_block_;
+
+  // Guards the members below and the replacement of current_block_.
+  Mutex mutex_;
+  // Usable size of the next shared block.
+  size_t next_block_size_;
+  // Allocates the shared blocks and the large allocations.
+  Arena arena_;
+
+  std::atomic<size_t> memory_usage_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentArena);
+};
+
+}  // namespace gbase
+
+#endif  // GBASE_BASE_CONCURRENT_ARENA_H_
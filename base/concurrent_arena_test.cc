@@ -0,0 +1,197 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/concurrent_arena.h"
+
+#include <string.h>
+
+#include <utility>
+#include <vector>
+
+#include "base/port.h"
+#include "base/random.h"
+#include "base/thread.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace {
+
+size_t RandomSize(Random *rnd) {
+  const size_t size = rnd->OneIn(4000) ? rnd->Uniform(6000) :
+      (rnd->OneIn(10) ? rnd->Uniform(100) : rnd->Uniform(20));
+  // The arena disallows size 0 allocations.
+  return (size == 0) ? 1 : size;
+}
+
+// Fills allocations with a pattern, and checks that no allocation overlaps
+// another.
+class AllocateThread : public Thread {
+ public:
+  AllocateThread(ConcurrentArena *arena, int id, int num_allocations)
+      : arena_(arena), id_(id), num_allocations_(num_allocations),
+        bytes_(0) {}
+
+  virtual void Run() {
+    Random rnd(id_ + 1);
+    for (int i = 0; i < num_allocations_; ++i) {
+      const size_t size = RandomSize(&rnd);
+      char *p = rnd.OneIn(10) ?
+          arena_->AllocateAligned(size) : arena_->Allocate(size);
+      memset(p, Pattern(i), size);
+      allocated_.push_back(std::make_pair(size, p));
+      bytes_ += size;
+    }
+  }
+
+  // Called after all the threads finished.
+  bool Verify() const {
+    for (size_t i = 0; i < allocated_.size(); ++i) {
+      for (size_t b = 0; b < allocated_[i].first; ++b) {
+        if (allocated_[i].second[b] != Pattern(i)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  size_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  char Pattern(size_t i) const {
+    return static_cast<char>(id_ * 31 + i);
+  }
+
+  ConcurrentArena *arena_;
+  const int id_;
+  const int num_allocations_;
+  std::vector<std::pair<size_t, char *> > allocated_;
+  size_t bytes_;
+};
+
+TEST(ConcurrentArenaTest, Empty) {
+  ConcurrentArena arena;
+  EXPECT_EQ(0, arena.MemoryUsage());
+}
+
+TEST(ConcurrentArenaTest, Simple) {
+  ConcurrentArena arena;
+  AllocateThread allocator(&arena, 0, 100000);
+  allocator.Run();
+  EXPECT_TRUE(allocator.Verify());
+  EXPECT_GE(arena.MemoryUsage(), allocator.bytes());
+  EXPECT_LE(arena.MemoryUsage(), allocator.bytes() * 1.20);
+}
+
+TEST(ConcurrentArenaTest, AlignedAllocation) {
+  ConcurrentArena arena;
+  Random rnd(301);
+  const uintptr_t align = (sizeof(void *) > 8) ? sizeof(void *) : 8;
+  for (int i = 0; i < 10000; ++i) {
+    arena.Allocate(1 + rnd.Uniform(7));
+    char *p = arena.AllocateAligned(RandomSize(&rnd));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(p) & (align - 1));
+  }
+}
+
+TEST(ConcurrentArenaTest, ConcurrentAllocation) {
+  const int kNumThreads = 8;
+  ConcurrentArena arena;
+  std::vector<AllocateThread *> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(new AllocateThread(&arena, i, 50000));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("AllocateThread");
+  }
+  size_t bytes = 0;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    EXPECT_TRUE(threads[i]->Verify());
+    bytes += threads[i]->bytes();
+    delete threads[i];
+  }
+  // Each shard wastes at most its current chunk.
+  EXPECT_GE(arena.MemoryUsage(), bytes);
+  EXPECT_LE(arena.MemoryUsage(), bytes * 1.20);
+}
+
+
+TEST(ConcurrentArenaTest, Options) {
+  ArenaOptions options;
+  options.block_size = 1024;
+  options.max_block_size = 256 * 1024;
+  {
+    ConcurrentArena arena(options);
+    AllocateThread allocator(&arena, 0, 100000);
+    allocator.Run();
+    EXPECT_TRUE(allocator.Verify());
+    EXPECT_GE(arena.MemoryUsage(), allocator.bytes());
+  }
+
+  options.use_huge_pages = true;
+  {
+    ConcurrentArena arena(options);
+    AllocateThread allocator(&arena, 0, 100000);
+    allocator.Run();
+    EXPECT_TRUE(allocator.Verify());
+    EXPECT_LE(ArenaOptions::kHugePageSize, arena.MemoryUsage());
+  }
+}
+
+TEST(ConcurrentArenaTest, GrownBlocksServeLargerAllocations) {
+  ArenaOptions options;
+  options.block_size = 4096;
+  options.max_block_size = 1024 * 1024;
+  ConcurrentArena arena(options);
+  // Grows the shared blocks.
+  for (int i = 0; i < 10000; ++i) {
+    arena.Allocate(100);
+  }
+
+  // Allocations larger than a quarter of the first block are served from
+  // the grown blocks now, instead of blocks of their own.
+  const size_t kSize = 2048;
+  int num_contiguous = 0;
+  char *last = arena.Allocate(kSize);
+  for (int i = 0; i < 100; ++i) {
+    char *p = arena.Allocate(kSize);
+    if (p == last + kSize) {
+      ++num_contiguous;
+    }
+    last = p;
+  }
+  EXPECT_LT(90, num_contiguous);
+}
+
+}  // namespace
+}  // namespace gbase
@@ -0,0 +1,119 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/epoch_manager.h"
+
+#include "base/logging.h"
+
+namespace gbase {
+
+EpochManager::EpochManager() : epoch_(0) {
+  for (int i = 0; i < 3; ++i) {
+    readers_[i].count.store(0);
+  }
+}
+
+EpochManager::~EpochManager() {
+  for (int i = 0; i < 3; ++i) {
+    DCHECK_EQ(0, readers_[i].count.load());
+    FreeObjects(&retired_[i]);
+  }
+}
+
+uint64 EpochManager::Enter() {
+  while (true) {
+    const uint64 epoch = epoch_.load();
+    readers_[epoch % 3].count.fetch_add(1);
+    // The epoch may have advanced before the count was published. Then
+    // the writer did not see this reader, so retry with the new epoch.
+    if (epoch_.load() == epoch) {
+      return epoch;
+    }
+    readers_[epoch % 3].count.fetch_sub(1);
+  }
+}
+
+void EpochManager::EnterAt(uint64 epoch) {
+  // The epoch cannot advance past |epoch| + 1 while the caller is in it,
+  // so no retry is needed.
+  readers_[epoch % 3].count.fetch_add(1);
+}
+
+void EpochManager::Exit(uint64 epoch) {
+  readers_[epoch % 3].count.fetch_sub(1);
+}
+
+void EpochManager::Retire(void *ptr, Deleter deleter) {
+  {
+    scoped_lock l(&mutex_);
+    // Loaded after |ptr| was unlinked, so any reader entering this epoch
+    // or later cannot reach |ptr|.
+    const RetiredObject object = { ptr, deleter };
+    retired_[epoch_.load() % 3].push_back(object);
+  }
+  TryReclaim();
+}
+
+void EpochManager::TryReclaim() {
+  std::vector<RetiredObject> reclaimable;
+  {
+    scoped_lock l(&mutex_);
+    if (!TryAdvance()) {
+      return;
+    }
+    // The epoch is now e + 1, and no reader is left in e - 1, so the
+    // objects retired in e - 1 are unreachable.
+    reclaimable.swap(retired_[(epoch_.load() + 1) % 3]);
+  }
+  FreeObjects(&reclaimable);
+}
+
+size_t EpochManager::num_retired() const {
+  scoped_lock l(&mutex_);
+  return retired_[0].size() + retired_[1].size() + retired_[2].size();
+}
+
+bool EpochManager::TryAdvance() {
+  const uint64 epoch = epoch_.load();
+  if (readers_[(epoch + 2) % 3].count.load() != 0) {
+    return false;
+  }
+  epoch_.store(epoch + 1);
+  return true;
+}
+
+// static
+void EpochManager::FreeObjects(std::vector<RetiredObject> *objects) {
+  for (size_t i = 0; i < objects->size(); ++i) {
+    (*objects)[i].deleter((*objects)[i].ptr);
+  }
+  objects->clear();
+}
+
+}  // namespace gbase
@@ -0,0 +1,143 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_BASE_EPOCH_MANAGER_H_
+#define GBASE_BASE_EPOCH_MANAGER_H_
+
+#include <atomic>
+#include <vector>
+
+#include "base/mutex.h"
+#include "base/port.h"
+
+namespace gbase {
+
+// EpochManager defers freeing objects that lock-free readers may still be
+// reading. Readers bracket each access with Enter() and Exit(). A writer
+// first makes an object unreachable for new readers, and then passes it to
+// Retire(). The object is freed after every reader that could have seen it
+// has exited.
+//
+// The global epoch advances only when no reader remains in the previous
+// epoch, so readers are always in the current or the previous epoch. An
+// object retired in epoch e is therefore freed when the epoch advances to
+// e + 2.
+//
+// Enter() and Exit() are lock-free. Retire() takes an internal lock, and
+// Retire() calls from many writers are safe.
+//
+// Usage:
+//   uint64 epoch = manager.Enter();
+//   ... read shared nodes ...
+//   manager.Exit(epoch);
+//
+//   // Writer, after unlinking |node|:
+//   manager.Retire(node, &DeleteNode);
+class EpochManager {
+ public:
+  typedef void (*Deleter)(void *ptr);
+
+  EpochManager();
+  // Frees all the retired objects.
+  // REQUIRES: No reader is in a critical section.
+  ~EpochManager();
+
+  // Enters a read-side critical section, and returns the token to be
+  // passed to Exit().
+  uint64 Enter();
+
+  // Enters a read-side critical section in |epoch|, which the caller is
+  // already in, so that the new section can see everything the caller can.
+  // Must be balanced by Exit(epoch).
+  // REQUIRES: The caller is in a critical section of |epoch|.
+  void EnterAt(uint64 epoch);
+
+  // Leaves the critical section entered by Enter() or EnterAt().
+  void Exit(uint64 epoch);
+
+  // Defers calling |deleter| with |ptr| until no reader can see it.
+  // REQUIRES: |ptr| is no longer reachable by a reader entering now.
+  void Retire(void *ptr, Deleter deleter);
+
+  // Advances the epoch if possible, and frees the objects which became
+  // safe to free. Retire() calls this, so explicit calls are only needed
+  // to release memory when no more objects are retired.
+  void TryReclaim();
+
+  // Returns the number of retired objects which are not freed yet.
+  size_t num_retired() const;
+
+  // Keeps the critical section for its lifetime.
+  class ScopedReader {
+   public:
+    explicit ScopedReader(EpochManager *manager)
+        : manager_(manager), epoch_(manager->Enter()) {}
+    ~ScopedReader() {
+      manager_->Exit(epoch_);
+    }
+
+   private:
+    EpochManager *manager_;
+    const uint64 epoch_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedReader);
+  };
+
+ private:
+  struct RetiredObject {
+    void *ptr;
+    Deleter deleter;
+  };
+
+  // The number of readers in an epoch, padded to have its own cache line
+  // so that readers of different epochs do not share a cache line.
+  struct ReaderCount {
+    std::atomic<int64> count;
+    char padding[64 - sizeof(std::atomic<int64>)];
+  };
+
+  // Returns true if the epoch advanced.
+  bool TryAdvance();
+  static void FreeObjects(std::vector<RetiredObject> *objects);
+
+  std::atomic<uint64> epoch_;
+  // Indexed by epoch % 3. Only the current and the previous epochs can
+  // have readers, and the third one is the epoch being reclaimed.
+  ReaderCount readers_[3];
+
+  mutable Mutex mutex_;
+  // Objects retired in each epoch, indexed by epoch % 3. Guarded by mutex_.
+  std::vector<RetiredObject> retired_[3];
+
+  DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+}  // namespace gbase
+
+#endif  // GBASE_BASE_EPOCH_MANAGER_H_
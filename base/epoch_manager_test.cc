@@ -0,0 +1,189 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "base/epoch_manager.h"
+
+#include <atomic>
+#include <vector>
+
+#include "base/port.h"
+#include "base/thread.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace {
+
+std::atomic<int> g_deleted_count(0);
+
+void DeleteInt(void *ptr) {
+  delete static_cast<int *>(ptr);
+  g_deleted_count.fetch_add(1);
+}
+
+TEST(EpochManagerTest, RetireWithoutReaders) {
+  g_deleted_count = 0;
+  EpochManager manager;
+  manager.Retire(new int(1), &DeleteInt);
+  manager.Retire(new int(2), &DeleteInt);
+  // Objects are freed two epochs after they are retired.
+  manager.TryReclaim();
+  manager.TryReclaim();
+  EXPECT_EQ(0, manager.num_retired());
+  EXPECT_EQ(2, g_deleted_count.load());
+}
+
+TEST(EpochManagerTest, ReaderBlocksReclamation) {
+  g_deleted_count = 0;
+  EpochManager manager;
+  const uint64 epoch = manager.Enter();
+  manager.Retire(new int(1), &DeleteInt);
+  for (int i = 0; i < 10; ++i) {
+    manager.TryReclaim();
+  }
+  EXPECT_EQ(1, manager.num_retired());
+  EXPECT_EQ(0, g_deleted_count.load());
+
+  // A reader which entered after the retirement does not block it.
+  {
+    EpochManager::ScopedReader reader(&manager);
+    manager.Exit(epoch);
+    manager.TryReclaim();
+    manager.TryReclaim();
+  }
+  EXPECT_EQ(0, manager.num_retired());
+  EXPECT_EQ(1, g_deleted_count.load());
+}
+
+TEST(EpochManagerTest, EnterAtBlocksReclamation) {
+  g_deleted_count = 0;
+  EpochManager manager;
+  const uint64 epoch = manager.Enter();
+  manager.Retire(new int(1), &DeleteInt);
+  // Joins the epoch of the first reader, which may not be current anymore.
+  manager.EnterAt(epoch);
+  manager.Exit(epoch);
+  for (int i = 0; i < 10; ++i) {
+    manager.TryReclaim();
+  }
+  EXPECT_EQ(1, manager.num_retired());
+  EXPECT_EQ(0, g_deleted_count.load());
+
+  manager.Exit(epoch);
+  manager.TryReclaim();
+  manager.TryReclaim();
+  EXPECT_EQ(0, manager.num_retired());
+  EXPECT_EQ(1, g_deleted_count.load());
+}
+
+TEST(EpochManagerTest, DestructorFreesRetiredObjects) {
+  g_deleted_count = 0;
+  {
+    EpochManager manager;
+    const uint64 epoch = manager.Enter();
+    manager.Retire(new int(1), &DeleteInt);
+    manager.Exit(epoch);
+  }
+  EXPECT_EQ(1, g_deleted_count.load());
+}
+
+// Readers dereference the current pointer while the writer keeps replacing
+// and retiring it. A freed object would be caught by the sanity check, or
+// by memory checkers.
+struct Object {
+  static const uint32 kMagic = 0x12345678;
+  Object() : magic(kMagic) {}
+  ~Object() {
+    magic = 0;
+  }
+  uint32 magic;
+};
+
+void DeleteObject(void *ptr) {
+  delete static_cast<Object *>(ptr);
+}
+
+class ReaderThread : public Thread {
+ public:
+  ReaderThread(EpochManager *manager, std::atomic<Object *> *current,
+               std::atomic<bool> *done)
+      : manager_(manager), current_(current), done_(done), errors_(0) {}
+
+  virtual void Run() {
+    while (!done_->load()) {
+      EpochManager::ScopedReader reader(manager_);
+      const Object *object = current_->load();
+      if (object->magic != Object::kMagic) {
+        ++errors_;
+      }
+    }
+  }
+
+  int errors() const {
+    return errors_;
+  }
+
+ private:
+  EpochManager *manager_;
+  std::atomic<Object *> *current_;
+  std::atomic<bool> *done_;
+  int errors_;
+};
+
+TEST(EpochManagerTest, ConcurrentReaders) {
+  const int kNumThreads = 4;
+  EpochManager manager;
+  std::atomic<Object *> current(new Object);
+  std::atomic<bool> done(false);
+
+  std::vector<ReaderThread *> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(new ReaderThread(&manager, &current, &done));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("ReaderThread");
+  }
+
+  for (int i = 0; i < 100000; ++i) {
+    Object *old_object = current.exchange(new Object);
+    manager.Retire(old_object, &DeleteObject);
+  }
+  done = true;
+
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+    EXPECT_EQ(0, threads[i]->errors());
+    delete threads[i];
+  }
+  manager.TryReclaim();
+  manager.TryReclaim();
+  EXPECT_EQ(0, manager.num_retired());
+  delete current.load();
+}
+
+}  // namespace
+}  // namespace gbase
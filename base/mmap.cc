@@ -234,4 +234,18 @@ int Mmap::MaybeMUnlock(const void *addr, size_t len) {
 
 #undef GBASE_HAVE_MLOCK
 
+#if defined(OS_WIN) || defined(OS_NACL)
+int Mmap::MaybeAdviseWillNeed(const void *addr, size_t len) {
+  return -1;
+}
+#else  // defined(OS_WIN) || defined(OS_NACL)
+int Mmap::MaybeAdviseWillNeed(const void *addr, size_t len) {
+  const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+  const uintptr_t aligned = begin & ~(page_size - 1);
+  return madvise(reinterpret_cast<void *>(aligned), len + (begin - aligned),
+                 MADV_WILLNEED);
+}
+#endif  // defined(OS_WIN) || defined(OS_NACL)
+
 }  // namespace gbase
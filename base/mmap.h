@@ -67,6 +67,11 @@ class Mmap : public MmapSyncInterface {
   static int MaybeMLock(const void *addr, size_t len);
   static int MaybeMUnlock(const void *addr, size_t len);
 
+  // Advises the kernel that the pages in [addr, addr + len) will be accessed
+  // soon, so that they can be read ahead asynchronously. |addr| doesn't need
+  // to be page aligned. Returns -1 on the platforms without madvise.
+  static int MaybeAdviseWillNeed(const void *addr, size_t len);
+
   char &operator[](size_t n) { return *(text_ + n); }
   char operator[](size_t n) const { return *(text_ + n); }
   char *begin() { return text_; }
@@ -99,6 +99,26 @@ TEST(MmapTest, MmapTest) {
   }
 }
 
+TEST(MmapTest, MaybeAdviseWillNeedTest) {
+  const string filename = FileUtil::JoinPath(FLAGS_test_tmpdir, "test.db");
+  {
+    OutputFileStream ofs(filename.c_str(), ios::binary | ios::out);
+    const string data(16384, 'a');
+    ofs.write(data.data(), data.size());
+  }
+  {
+    Mmap mmap;
+    ASSERT_TRUE(mmap.Open(filename.c_str(), "r"));
+#if defined(OS_WIN) || defined(OS_NACL)
+    EXPECT_EQ(-1, Mmap::MaybeAdviseWillNeed(mmap.begin() + 10, 5000));
+#else
+    EXPECT_EQ(0, Mmap::MaybeAdviseWillNeed(mmap.begin() + 10, 5000));
+#endif  // defined(OS_WIN) || defined(OS_NACL)
+    EXPECT_EQ('a', mmap[5009]);
+  }
+  FileUtil::Unlink(filename);
+}
+
 TEST(MmapTest, MaybeMLockTest) {
   const size_t data_len = 32;
   std::unique_ptr<void, void (*)(void*)> addr(malloc(data_len), &free);
@@ -171,6 +171,13 @@ inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg) {
   return false;
 }
 
+// Hints the CPU to bring the cache line of |addr| into the cache.
+inline void Prefetch(const void *addr) {
+#if defined(__GNUC__)
+  __builtin_prefetch(addr);
+#endif
+}
+
 } // namespace port
 } // namespace gbase
 
@@ -8,29 +8,44 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
-// Reads require a guarantee that the SkipList will not be destroyed
-// while the read is in progress.  Apart from that, reads progress
-// without any internal locking or synchronization.
+// Insert() and Delete() require external synchronization, most likely a
+// mutex.  InsertConcurrently() can be called from many threads at once
+// without any external synchronization, but must not run concurrently with
+// Insert() or Delete().  Reads require a guarantee that the SkipList will
+// not be destroyed while the read is in progress.  Apart from that, reads
+// progress without any internal locking or synchronization.
 //
 // Invariants:
 //
-// (1) Allocated nodes are never deleted until the SkipList is
-// destroyed.  This is trivially guaranteed by the code since we
-// never delete any skip list nodes.
+// (1) A node is never freed while a reader can see it.  If the list
+// allocates from an Arena or a ConcurrentArena, nodes live until the arena
+// is destroyed.
+// Otherwise nodes are allocated from the heap, and a node removed by
+// Delete() is handed to an EpochManager, which frees it after every
+// Iterator that could have reached it is gone.
 //
-// (2) The contents of a Node except for the next/prev pointers are
-// immutable after the Node has been linked into the SkipList.
-// Only Insert() modifies the list, and it is careful to initialize
-// a node and use release-stores to publish the nodes in one or
-// more lists.
+// (2) The contents of a Node except for the next/prev pointers and the
+// deleted mark are immutable after the Node has been linked into the
+// SkipList.  Only Insert(), InsertConcurrently() and Delete() modify the
+// list, and they are careful to initialize a node and use release-stores
+// (or compare-and-swaps with release semantics) to publish the nodes in
+// one or more lists.
+//
+// (3) Delete() first marks the node as deleted, and then unlinks it from
+// the top level down.  Readers skip marked nodes, and the next pointers
+// of an unlinked node stay intact, so a reader positioned on it can still
+// move forward.
 //
 // ... prev vs. next pointer ordering ...
 
 #include <assert.h>
 #include <stdlib.h>
+#include <atomic>
 #include "base/port.h"
 #include "base/arena.h"
+#include "base/concurrent_arena.h"
+#include "base/epoch_manager.h"
+#include "base/mutex.h"
 #include "base/random.h"
 
 namespace gbase {
@@ -42,25 +57,77 @@ class SkipList {
  private:
   struct Node;
 
+  enum { kMaxHeight = 12 };
+
+  // The predecessors of a position on every level.  Kept across searches
+  // for increasing keys, so that a search can start from the previous
+  // position instead of head_.
+  struct Splice {
+    Splice() : height(0), prev() { }
+    // Number of valid entries in prev.  0 means that nothing is cached.
+    int height;
+    Node* prev[kMaxHeight];
+  };
+
  public:
   // Create a new SkipList object that will use "cmp" for comparing keys,
   // and will allocate memory using "*arena".  Objects allocated in the arena
   // must remain allocated for the lifetime of the skiplist object.
-  explicit SkipList(Comparator cmp, Arena* arena);
+  SkipList(Comparator cmp, Arena* arena);
+
+  // Same as above, but allocates from a ConcurrentArena, so that
+  // InsertConcurrently() and AllocateKey() take no lock at all.
+  SkipList(Comparator cmp, ConcurrentArena* arena);
+
+  // Allocates nodes from the heap instead of an arena.  The nodes removed
+  // by Delete() are freed once no reader can see them.
+  explicit SkipList(Comparator cmp);
+  ~SkipList();
 
   // Insert key into the list.
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Insert keys[0..n-1] into the list.  Each key is searched from the
+  // position of the previous one, so loading sequential or nearly
+  // sequential keys costs close to O(1) per key instead of O(log n).
+  // REQUIRES: keys are sorted in increasing order, and nothing that
+  // compares equal to any of them is currently in the list.
+  void InsertSortedBatch(const Key* keys, size_t n);
+
+  // Like Insert(), but can be called from many threads at once.  Each
+  // level is linked with a compare-and-swap.  Unless the list allocates
+  // from a ConcurrentArena, concurrent inserters serialize on the
+  // allocation of the node.
+  // REQUIRES: nothing that compares equal to key is currently in the list,
+  // or is being inserted concurrently.
+  void InsertConcurrently(const Key& key);
+
+  // Allocates "bytes" bytes from the arena of the list.  Safe to call
+  // concurrently with InsertConcurrently(), so that concurrent writers can
+  // allocate the memory referenced by their keys.
+  char* AllocateKey(size_t bytes);
+
+  // Removes the entry that compares equal to key.  Returns false if there
+  // is no such entry.  The memory of the entry is reclaimed only if the
+  // list was created without an arena.
+  bool Delete(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
   // Iteration over the contents of a skip list
+  // If the list has no arena, an iterator keeps the nodes it can reach
+  // from being freed during its lifetime, so long-lived iterators delay
+  // the reclamation of deleted nodes.
   class Iterator {
    public:
     // Initialize an iterator over the specified list.
     // The returned iterator is not valid.
     explicit Iterator(const SkipList* list);
+    Iterator(const Iterator& other);
+    Iterator& operator=(const Iterator& other);
+    ~Iterator();
 
     // Returns true iff the iterator is positioned at a valid node.
     bool Valid() const;
@@ -80,6 +147,12 @@ class SkipList {
     // Advance to the first entry with a key >= target
     void Seek(const Key& target);
 
+    // Same as Seek(), but the search starts from where the previous
+    // SeekForward() ended (finger search), which is much faster when
+    // targets increase in small steps.  A smaller target falls back to a
+    // search from the beginning of the list.
+    void SeekForward(const Key& target);
+
     // Position at the first entry in list.
     // Final state of iterator is Valid() iff list is not empty.
     void SeekToFirst();
@@ -89,34 +162,61 @@ class SkipList {
     void SeekToLast();
 
    private:
+    void Pin();
+    // Pins the epoch of "other", in which its node is safe to read.
+    void PinAt(const Iterator& other);
+    void Unpin();
+    // Moves forward or backward to the nearest node which is not deleted.
+    void SkipDeletedForward();
+    void SkipDeletedBackward();
+
     const SkipList* list_;
     Node* node_;
+    // Position of the last SeekForward().
+    Splice splice_;
+    // The epoch entered by this iterator.  Used only if list_ has no arena.
+    uint64 epoch_;
     // Intentionally copyable
   };
 
  private:
-  enum { kMaxHeight = 12 };
-
   // Immutable after construction
   Comparator const compare_;
   Arena* const arena_;    // Arena used for allocations of nodes
+  ConcurrentArena* const concurrent_arena_;  // Used instead of arena_
 
   Node* const head_;
 
-  // Modified only by Insert().  Read racily by readers, but stale
-  // values are ok.
-  port::AtomicPointer max_height_;   // Height of the entire list
+  // Modified only by Insert() and InsertConcurrently().  Read racily by
+  // readers, but stale values are ok.
+  std::atomic<int> max_height_;   // Height of the entire list
 
   inline int GetMaxHeight() const {
-    return static_cast<int>(
-        reinterpret_cast<intptr_t>(max_height_.NoBarrier_Load()));
+    return max_height_.load(std::memory_order_relaxed);
   }
 
-  // Read/written only by Insert().
+  // Read/written only by Insert(), or by InsertConcurrently() and
+  // AllocateKey() with alloc_mutex_ held.
   Random rnd_;
 
+  // Serializes the use of arena_ and rnd_ by concurrent inserters.  Not
+  // used with concurrent_arena_.
+  Mutex alloc_mutex_;
+
+  // Source of random heights for InsertConcurrently() without a lock.
+  std::atomic<uint64> height_counter_;
+
+  // Defers freeing deleted nodes.  Used only if the list has no arena.
+  mutable EpochManager epoch_;
+
+  bool HasArena() const {
+    return arena_ != NULL || concurrent_arena_ != NULL;
+  }
+
   Node* NewNode(const Key& key, int height);
+  static void DeleteNode(void* node);
   int RandomHeight();
+  int RandomHeightConcurrently();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -129,6 +229,22 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting from "before" at "level", find the adjacent nodes "*out_prev"
+  // and "*out_next" such that *out_prev < key <= *out_next.  "before" must
+  // be head_ or a node whose key is less than key.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** out_prev, Node** out_next) const;
+
+  // Same as FindGreaterOrEqual(), but fills "splice" with the predecessors
+  // of key on every level.  The search reuses the levels of the previous
+  // position in "splice" which still come before key.
+  Node* FindWithSplice(const Key& key, Splice* splice) const;
+
+  // Insert key at the position found with "splice", and move "splice" to
+  // the position right after key.
+  // REQUIRES: External synchronization.
+  void InsertWithSplice(const Key& key, Splice* splice);
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -145,52 +261,155 @@ class SkipList {
 // Implementation details follow
 template<typename Key, class Comparator>
 struct SkipList<Key,Comparator>::Node {
-  explicit Node(const Key& k) : key(k) { }
+  explicit Node(const Key& k) : key(k), deleted_(false) { }
 
   Key const key;
 
+  bool IsDeleted() const {
+    return deleted_.load(std::memory_order_acquire);
+  }
+  void MarkDeleted() {
+    deleted_.store(true, std::memory_order_release);
+  }
+
   // Accessors/mutators for links.  Wrapped in methods so we can
   // add the appropriate barriers as necessary.
   Node* Next(int n) {
     assert(n >= 0);
     // Use an 'acquire load' so that we observe a fully initialized
     // version of the returned Node.
-    return reinterpret_cast<Node*>(next_[n].Acquire_Load());
+    return next_[n].load(std::memory_order_acquire);
   }
   void SetNext(int n, Node* x) {
     assert(n >= 0);
     // Use a 'release store' so that anybody who reads through this
     // pointer observes a fully initialized version of the inserted node.
-    next_[n].Release_Store(x);
+    next_[n].store(x, std::memory_order_release);
+  }
+
+  // Replaces the link at level n with x only if it is still expected.
+  // Has release semantics on success, like SetNext().
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].compare_exchange_strong(expected, x,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed);
   }
 
   // No-barrier variants that can be safely used in a few locations.
   Node* NoBarrier_Next(int n) {
     assert(n >= 0);
-    return reinterpret_cast<Node*>(next_[n].NoBarrier_Load());
+    return next_[n].load(std::memory_order_relaxed);
   }
   void NoBarrier_SetNext(int n, Node* x) {
     assert(n >= 0);
-    next_[n].NoBarrier_Store(x);
+    next_[n].store(x, std::memory_order_relaxed);
   }
 
  private:
+  std::atomic<bool> deleted_;
+
   // Array of length equal to the node height.  next_[0] is lowest level link.
-  port::AtomicPointer next_[1];
+  std::atomic<Node*> next_[1];
 };
 
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
-  char* mem = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+  const size_t size =
+      sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+  char* mem;
+  if (concurrent_arena_ != NULL) {
+    mem = concurrent_arena_->AllocateAligned(size);
+  } else if (arena_ != NULL) {
+    mem = arena_->AllocateAligned(size);
+  } else {
+    mem = new char[size];
+  }
   return new (mem) Node(key);
 }
 
 template<typename Key, class Comparator>
-inline SkipList<Key,Comparator>::Iterator::Iterator(const SkipList* list) {
-  list_ = list;
-  node_ = NULL;
+void SkipList<Key,Comparator>::DeleteNode(void* node) {
+  static_cast<Node*>(node)->~Node();
+  delete[] static_cast<char*>(node);
+}
+
+template<typename Key, class Comparator>
+inline SkipList<Key,Comparator>::Iterator::Iterator(const SkipList* list)
+    : list_(list), node_(NULL), epoch_(0) {
+  Pin();
+}
+
+template<typename Key, class Comparator>
+inline SkipList<Key,Comparator>::Iterator::Iterator(const Iterator& other)
+    : list_(other.list_), node_(other.node_), epoch_(0) {
+  // A node deleted before now may already be retired, so the copy joins
+  // the epoch of "other" instead of the current one.
+  PinAt(other);
+}
+
+template<typename Key, class Comparator>
+inline typename SkipList<Key,Comparator>::Iterator&
+SkipList<Key,Comparator>::Iterator::operator=(const Iterator& other) {
+  if (this != &other) {
+    const SkipList* old_list = list_;
+    const uint64 old_epoch = epoch_;
+    PinAt(other);
+    if (!old_list->HasArena()) {
+      old_list->epoch_.Exit(old_epoch);
+    }
+    list_ = other.list_;
+    node_ = other.node_;
+    // The nodes of the old splice may be freed once unpinned, or belong to
+    // another list.
+    splice_.height = 0;
+  }
+  return *this;
+}
+
+template<typename Key, class Comparator>
+inline SkipList<Key,Comparator>::Iterator::~Iterator() {
+  Unpin();
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::Pin() {
+  if (!list_->HasArena()) {
+    epoch_ = list_->epoch_.Enter();
+  }
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::PinAt(const Iterator& other) {
+  if (!other.list_->HasArena()) {
+    other.list_->epoch_.EnterAt(other.epoch_);
+    epoch_ = other.epoch_;
+  }
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::Unpin() {
+  if (!list_->HasArena()) {
+    list_->epoch_.Exit(epoch_);
+  }
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::SkipDeletedForward() {
+  while (node_ != NULL && node_->IsDeleted()) {
+    node_ = node_->Next(0);
+  }
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::SkipDeletedBackward() {
+  while (node_ != list_->head_ && node_->IsDeleted()) {
+    node_ = list_->FindLessThan(node_->key);
+  }
+  if (node_ == list_->head_) {
+    node_ = NULL;
+  }
 }
 
 template<typename Key, class Comparator>
@@ -208,6 +427,7 @@ template<typename Key, class Comparator>
 inline void SkipList<Key,Comparator>::Iterator::Next() {
   assert(Valid());
   node_ = node_->Next(0);
+  SkipDeletedForward();
 }
 
 template<typename Key, class Comparator>
@@ -216,27 +436,32 @@ inline void SkipList<Key,Comparator>::Iterator::Prev() {
   // last node that falls before key.
   assert(Valid());
   node_ = list_->FindLessThan(node_->key);
-  if (node_ == list_->head_) {
-    node_ = NULL;
-  }
+  SkipDeletedBackward();
 }
 
 template<typename Key, class Comparator>
 inline void SkipList<Key,Comparator>::Iterator::Seek(const Key& target) {
   node_ = list_->FindGreaterOrEqual(target, NULL);
+  SkipDeletedForward();
+}
+
+template<typename Key, class Comparator>
+inline void SkipList<Key,Comparator>::Iterator::SeekForward(
+    const Key& target) {
+  node_ = list_->FindWithSplice(target, &splice_);
+  SkipDeletedForward();
 }
 
 template<typename Key, class Comparator>
 inline void SkipList<Key,Comparator>::Iterator::SeekToFirst() {
   node_ = list_->head_->Next(0);
+  SkipDeletedForward();
 }
 
 template<typename Key, class Comparator>
 inline void SkipList<Key,Comparator>::Iterator::SeekToLast() {
   node_ = list_->FindLast();
-  if (node_ == list_->head_) {
-    node_ = NULL;
-  }
+  SkipDeletedBackward();
 }
 
 template<typename Key, class Comparator>
@@ -252,6 +477,24 @@ int SkipList<Key,Comparator>::RandomHeight() {
   return height;
 }
 
+template<typename Key, class Comparator>
+int SkipList<Key,Comparator>::RandomHeightConcurrently() {
+  // Same distribution as RandomHeight(), taking two bits per level from a
+  // shared counter scrambled by the finalizer of MurmurHash3.
+  uint64 bits = height_counter_.fetch_add(1, std::memory_order_relaxed);
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ULL;
+  bits ^= bits >> 33;
+  int height = 1;
+  while (height < kMaxHeight && (bits & 3) == 0) {
+    height++;
+    bits >>= 2;
+  }
+  return height;
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // NULL n is considered infinite
@@ -280,6 +523,73 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::FindSpliceForLevel(const Key& key,
+                                                  Node* before, int level,
+                                                  Node** out_prev,
+                                                  Node** out_next) const {
+  while (true) {
+    Node* next = before->Next(level);
+    if (KeyIsAfterNode(key, next)) {
+      before = next;
+    } else {
+      *out_prev = before;
+      *out_next = next;
+      return;
+    }
+  }
+}
+
+template<typename Key, class Comparator>
+typename SkipList<Key,Comparator>::Node*
+SkipList<Key,Comparator>::FindWithSplice(const Key& key,
+                                         Splice* splice) const {
+  const int max_height = GetMaxHeight();
+
+  // Find the lowest level whose cached predecessor still comes before key
+  // and is followed by a node >= key.  Upper levels are sparser, so their
+  // predecessors bracket key as well.  If the list grew taller, or a
+  // cached node is deleted or not before key, start over from head_.
+  bool restart = (splice->height != max_height);
+  int level = restart ? max_height : 0;
+  Node* next = NULL;
+  while (level < max_height) {
+    Node* prev = splice->prev[level];
+    if (prev != head_ && (prev->IsDeleted() || !KeyIsAfterNode(key, prev))) {
+      restart = true;
+      level = max_height;
+      break;
+    }
+    next = prev->Next(level);
+    if (!KeyIsAfterNode(key, next)) {
+      break;
+    }
+    level++;
+  }
+  if (level == 0) {
+    return next;
+  }
+
+  // Walk down from there.  On each level, start from either the cached
+  // predecessor or the one found on the level above, whichever is closer
+  // to key.
+  Node* before =
+      (restart || level == max_height) ? head_ : splice->prev[level];
+  for (int i = level - 1; i >= 0; i--) {
+    if (!restart) {
+      Node* cached = splice->prev[i];
+      if (before == head_ ||
+          (cached != head_ && compare_(before->key, cached->key) < 0)) {
+        before = cached;
+      }
+    }
+    FindSpliceForLevel(key, before, i, &splice->prev[i], &next);
+    before = splice->prev[i];
+  }
+  splice->height = max_height;
+  return next;
+}
+
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
@@ -325,20 +635,80 @@ template<typename Key, class Comparator>
 SkipList<Key,Comparator>::SkipList(Comparator cmp, Arena* arena)
     : compare_(cmp),
       arena_(arena),
-      head_(NewNode(0 /* any key will do */, kMaxHeight)),
-      max_height_(reinterpret_cast<void*>(1)),
-      rnd_(0xdeadbeef) {
+      concurrent_arena_(NULL),
+      head_(NewNode(Key() /* any key will do */, kMaxHeight)),
+      max_height_(1),
+      rnd_(0xdeadbeef),
+      height_counter_(0) {
+  for (int i = 0; i < kMaxHeight; i++) {
+    head_->SetNext(i, NULL);
+  }
+}
+
+template<typename Key, class Comparator>
+SkipList<Key,Comparator>::SkipList(Comparator cmp, ConcurrentArena* arena)
+    : compare_(cmp),
+      arena_(NULL),
+      concurrent_arena_(arena),
+      head_(NewNode(Key() /* any key will do */, kMaxHeight)),
+      max_height_(1),
+      rnd_(0xdeadbeef),
+      height_counter_(0) {
+  for (int i = 0; i < kMaxHeight; i++) {
+    head_->SetNext(i, NULL);
+  }
+}
+
+template<typename Key, class Comparator>
+SkipList<Key,Comparator>::SkipList(Comparator cmp)
+    : compare_(cmp),
+      arena_(NULL),
+      concurrent_arena_(NULL),
+      head_(NewNode(Key() /* any key will do */, kMaxHeight)),
+      max_height_(1),
+      rnd_(0xdeadbeef),
+      height_counter_(0) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, NULL);
   }
 }
 
+template<typename Key, class Comparator>
+SkipList<Key,Comparator>::~SkipList() {
+  if (HasArena()) {
+    return;
+  }
+  // Deleted nodes are freed by epoch_.
+  Node* x = head_;
+  while (x != NULL) {
+    Node* next = x->NoBarrier_Next(0);
+    DeleteNode(x);
+    x = next;
+  }
+}
+
 template<typename Key, class Comparator>
 void SkipList<Key,Comparator>::Insert(const Key& key) {
-  // TODO(opt): We can use a barrier-free variant of FindGreaterOrEqual()
-  // here since Insert() is externally synchronized.
-  Node* prev[kMaxHeight];
-  Node* x = FindGreaterOrEqual(key, prev);
+  Splice splice;
+  InsertWithSplice(key, &splice);
+}
+
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertSortedBatch(const Key* keys, size_t n) {
+  Splice splice;
+  for (size_t i = 0; i < n; i++) {
+    assert(i == 0 || compare_(keys[i - 1], keys[i]) < 0);
+    InsertWithSplice(keys[i], &splice);
+  }
+}
+
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertWithSplice(const Key& key,
+                                                Splice* splice) {
+  // TODO(opt): We can use a barrier-free variant of FindWithSplice()
+  // here since the insertion is externally synchronized.
+  Node* x = FindWithSplice(key, splice);
+  Node** prev = splice->prev;
 
   // Our data structure does not allow duplicate insertion
   assert(x == NULL || !Equal(key, x->key));
@@ -348,6 +718,7 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
     for (int i = GetMaxHeight(); i < height; i++) {
       prev[i] = head_;
     }
+    splice->height = height;
     //fprintf(stderr, "Change height from %d to %d\n", max_height_, height);
 
     // It is ok to mutate max_height_ without any synchronization
@@ -357,7 +728,7 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
     // the loop below.  In the former case the reader will
     // immediately drop to the next level since NULL sorts after all
     // keys.  In the latter case the reader will use the new node.
-    max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
+    max_height_.store(height, std::memory_order_relaxed);
   }
 
   x = NewNode(key, height);
@@ -367,12 +738,105 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
     x->NoBarrier_SetNext(i, prev[i]->NoBarrier_Next(i));
     prev[i]->SetNext(i, x);
   }
+
+  // x precedes the following keys on the levels it is linked to.
+  for (int i = 0; i < height; i++) {
+    prev[i] = x;
+  }
+}
+
+template<typename Key, class Comparator>
+char* SkipList<Key,Comparator>::AllocateKey(size_t bytes) {
+  if (concurrent_arena_ != NULL) {
+    return concurrent_arena_->Allocate(bytes);
+  }
+  scoped_lock l(&alloc_mutex_);
+  return arena_->Allocate(bytes);
+}
+
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+  Node* x;
+  int height;
+  if (concurrent_arena_ != NULL) {
+    height = RandomHeightConcurrently();
+    x = NewNode(key, height);
+  } else {
+    scoped_lock l(&alloc_mutex_);
+    height = RandomHeight();
+    x = NewNode(key, height);
+  }
+
+  // Raise max_height_ first.  As in Insert(), readers that observe the
+  // new height before the node is linked just see NULL links from head_
+  // and drop to the next level.
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  // Compute the splice at every level from the top, reusing the node found
+  // on the level above as the starting point of the level below.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, before, i, &prev[i], &next[i]);
+    before = prev[i];
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || compare_(key, next[0]->key) < 0);
+
+  // Link bottom-up so that the node is reachable on level 0 before it is
+  // reachable from any upper level.  If another inserter changed the
+  // splice in the meantime, the CAS fails and we recompute the splice on
+  // that level starting from the stale prev, which still precedes key
+  // because nodes are never removed.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+      assert(i > 0 || next[0] == NULL || compare_(key, next[0]->key) < 0);
+    }
+  }
+}
+
+template<typename Key, class Comparator>
+bool SkipList<Key,Comparator>::Delete(const Key& key) {
+  Node* prev[kMaxHeight];
+  Node* x = FindGreaterOrEqual(key, prev);
+  if (x == NULL || !Equal(key, x->key)) {
+    return false;
+  }
+
+  x->MarkDeleted();
+  // prev[i] is the last node before key on level i, so x is linked on
+  // level i iff prev[i] points to it.
+  for (int i = GetMaxHeight() - 1; i >= 0; i--) {
+    if (prev[i]->NoBarrier_Next(i) == x) {
+      prev[i]->SetNext(i, x->NoBarrier_Next(i));
+    }
+  }
+
+  if (!HasArena()) {
+    epoch_.Retire(x, &DeleteNode);
+  }
+  return true;
 }
 
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
-  Node* x = FindGreaterOrEqual(key, NULL);
-  if (x != NULL && Equal(key, x->key)) {
+  Iterator iter(this);
+  iter.Seek(key);
+  if (iter.Valid() && Equal(key, iter.key())) {
     return true;
   } else {
     return false;
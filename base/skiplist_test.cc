@@ -3,11 +3,15 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "base/skiplist.h"
+#include <atomic>
 #include <set>
+#include <vector>
 #include "base/arena.h"
+#include "base/concurrent_arena.h"
 #include "base/hash.h"
 #include "base/random.h"
 #include "base/mutex.h"
+#include "base/thread.h"
 
 #include "gtest/gtest.h"
 
@@ -285,5 +289,402 @@ class ConcurrentTest {
   }
 };
 
+
+class InsertThread : public Thread {
+ public:
+  InsertThread(SkipList<Key, Comparator> *list, int id, int num_threads,
+               int num_keys)
+      : list_(list), id_(id), num_threads_(num_threads),
+        num_keys_(num_keys) {}
+
+  virtual void Run() {
+    // Each thread inserts a disjoint set of keys in a shuffled order.
+    Random rnd(id_ + 1);
+    std::vector<Key> keys;
+    for (Key k = id_; k < num_keys_; k += num_threads_) {
+      keys.push_back(k);
+    }
+    for (size_t i = keys.size(); i > 1; --i) {
+      std::swap(keys[i - 1], keys[rnd.Uniform(i)]);
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+      list_->InsertConcurrently(keys[i]);
+    }
+  }
+
+ private:
+  SkipList<Key, Comparator> *list_;
+  const int id_;
+  const int num_threads_;
+  const int num_keys_;
+};
+
+void TestInsertConcurrently(SkipList<Key, Comparator> *list) {
+  const int kNumThreads = 8;
+  const int kNumKeys = 20000;
+
+  std::vector<InsertThread *> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.push_back(new InsertThread(list, i, kNumThreads, kNumKeys));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("InsertThread");
+  }
+
+  // Readers run concurrently with the writers and must always observe a
+  // sorted list.
+  for (int i = 0; i < 20; ++i) {
+    SkipList<Key, Comparator>::Iterator iter(list);
+    iter.SeekToFirst();
+    Key last = 0;
+    bool first = true;
+    for (; iter.Valid(); iter.Next()) {
+      if (!first) {
+        ASSERT_LT(last, iter.key());
+      }
+      last = iter.key();
+      first = false;
+    }
+  }
+
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+    delete threads[i];
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(list);
+  iter.SeekToFirst();
+  for (Key k = 0; k < kNumKeys; ++k) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  EXPECT_FALSE(iter.Valid());
+
+  for (Key k = 0; k < kNumKeys; ++k) {
+    EXPECT_TRUE(list->Contains(k));
+  }
+  EXPECT_FALSE(list->Contains(kNumKeys));
+}
+
+TEST(SkipTest, InsertConcurrently) {
+  Arena arena;
+  SkipList<Key, Comparator> list(Comparator(), &arena);
+  TestInsertConcurrently(&list);
+}
+
+TEST(SkipTest, InsertConcurrentlyWithConcurrentArena) {
+  ConcurrentArena arena;
+  SkipList<Key, Comparator> list(Comparator(), &arena);
+  TestInsertConcurrently(&list);
+}
+
+
+TEST(SkipTest, Delete) {
+  const int N = 2000;
+  const int R = 5000;
+  Random rnd(301);
+  Arena arena;
+  Comparator cmp;
+  // Deletion works with and without an arena.
+  SkipList<Key, Comparator> arena_list(cmp, &arena);
+  SkipList<Key, Comparator> heap_list(cmp);
+  SkipList<Key, Comparator> *lists[] = { &arena_list, &heap_list };
+  for (int l = 0; l < 2; ++l) {
+    SkipList<Key, Comparator> *list = lists[l];
+    std::set<Key> keys;
+    for (int i = 0; i < N; i++) {
+      Key key = rnd.Next() % R;
+      if (rnd.OneIn(3)) {
+        ASSERT_EQ(keys.erase(key) == 1, list->Delete(key));
+      } else if (keys.insert(key).second) {
+        list->Insert(key);
+      }
+    }
+
+    for (int i = 0; i < R; i++) {
+      ASSERT_EQ(keys.count(i) == 1, list->Contains(i));
+    }
+
+    SkipList<Key, Comparator>::Iterator iter(list);
+    iter.SeekToFirst();
+    for (std::set<Key>::const_iterator it = keys.begin(); it != keys.end();
+         ++it) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*it, iter.key());
+      iter.Next();
+    }
+    ASSERT_FALSE(iter.Valid());
+
+    iter.SeekToLast();
+    for (std::set<Key>::const_reverse_iterator it = keys.rbegin();
+         it != keys.rend(); ++it) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(*it, iter.key());
+      iter.Prev();
+    }
+    ASSERT_FALSE(iter.Valid());
+  }
+}
+
+// Counts the live instances to check that deleted nodes are freed.
+struct CountedKey {
+  static std::atomic<int> num_live;
+
+  CountedKey() : value(0) { num_live.fetch_add(1); }
+  explicit CountedKey(uint64_t v) : value(v) { num_live.fetch_add(1); }
+  CountedKey(const CountedKey &other) : value(other.value) {
+    num_live.fetch_add(1);
+  }
+  ~CountedKey() { num_live.fetch_sub(1); }
+
+  uint64_t value;
+};
+
+std::atomic<int> CountedKey::num_live(0);
+
+struct CountedKeyComparator {
+  int operator()(const CountedKey &a, const CountedKey &b) const {
+    return Comparator()(a.value, b.value);
+  }
+};
+
+TEST(SkipTest, DeleteReclaimsNodes) {
+  const int kSize = 100;
+  {
+    CountedKeyComparator cmp;
+    SkipList<CountedKey, CountedKeyComparator> list(cmp);
+    for (int i = 0; i < kSize; ++i) {
+      list.Insert(CountedKey(i));
+    }
+    // Replace every key many times.  Without readers, a deleted node is
+    // freed after two more deletions, so the memory stays bounded.
+    for (int round = 1; round < 100; ++round) {
+      for (int i = 0; i < kSize; ++i) {
+        ASSERT_TRUE(list.Delete(CountedKey((round - 1) * kSize + i)));
+        list.Insert(CountedKey(round * kSize + i));
+        // The live nodes, the head and at most two retired nodes.
+        ASSERT_LE(CountedKey::num_live.load(), kSize + 1 + 2);
+      }
+    }
+
+    // An iterator keeps the nodes it can reach alive.
+    {
+      SkipList<CountedKey, CountedKeyComparator>::Iterator iter(&list);
+      iter.SeekToFirst();
+      ASSERT_TRUE(iter.Valid());
+      const uint64_t first = iter.key().value;
+      for (int i = 0; i < kSize; ++i) {
+        ASSERT_TRUE(list.Delete(CountedKey(99 * kSize + i)));
+      }
+      EXPECT_LE(kSize + 1, CountedKey::num_live.load());
+      EXPECT_EQ(first, iter.key().value);
+      iter.Next();
+      EXPECT_FALSE(iter.Valid());
+    }
+    list.Insert(CountedKey(0));
+    ASSERT_TRUE(list.Delete(CountedKey(0)));
+    list.Insert(CountedKey(0));
+    ASSERT_TRUE(list.Delete(CountedKey(0)));
+    EXPECT_GE(1 + 2, CountedKey::num_live.load());
+  }
+  EXPECT_EQ(0, CountedKey::num_live.load());
+}
+
+TEST(SkipTest, CopiedIteratorKeepsNodeAlive) {
+  typedef SkipList<CountedKey, CountedKeyComparator> CountedList;
+  {
+    CountedKeyComparator cmp;
+    CountedList list(cmp);
+    for (int i = 0; i < 10; ++i) {
+      list.Insert(CountedKey(i));
+    }
+    CountedList::Iterator *iter = new CountedList::Iterator(&list);
+    iter->Seek(CountedKey(5));
+    ASSERT_TRUE(list.Delete(CountedKey(5)));
+
+    // The deleted node is reachable only through the copies, which must
+    // keep it alive after the original iterator is gone.
+    CountedList::Iterator copied(*iter);
+    CountedList::Iterator assigned(&list);
+    assigned = *iter;
+    delete iter;
+    ASSERT_TRUE(list.Delete(CountedKey(6)));
+    ASSERT_TRUE(list.Delete(CountedKey(7)));
+    EXPECT_EQ(10 + 1, CountedKey::num_live.load());
+
+    ASSERT_TRUE(copied.Valid());
+    EXPECT_EQ(5, copied.key().value);
+    copied.Next();
+    ASSERT_TRUE(copied.Valid());
+    EXPECT_EQ(8, copied.key().value);
+    ASSERT_TRUE(assigned.Valid());
+    EXPECT_EQ(5, assigned.key().value);
+  }
+  EXPECT_EQ(0, CountedKey::num_live.load());
+}
+
+class DeleteThread : public Thread {
+ public:
+  DeleteThread(SkipList<Key, Comparator> *list, int num_keys)
+      : list_(list), num_keys_(num_keys) {}
+
+  virtual void Run() {
+    // Keeps only the even keys, and toggles the odd ones.
+    Random rnd(17);
+    std::vector<bool> present(num_keys_, false);
+    for (int i = 0; i < 200000; ++i) {
+      const Key key = (rnd.Next() % (num_keys_ / 2)) * 2 + 1;
+      if (present[key]) {
+        list_->Delete(key);
+      } else {
+        list_->Insert(key);
+      }
+      present[key] = !present[key];
+    }
+  }
+
+ private:
+  SkipList<Key, Comparator> *list_;
+  const int num_keys_;
+};
+
+TEST(SkipTest, DeleteWithConcurrentReaders) {
+  const int kNumKeys = 1000;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp);
+  for (Key k = 0; k < kNumKeys; k += 2) {
+    list.Insert(k);
+  }
+
+  DeleteThread writer(&list, kNumKeys);
+  writer.SetJoinable(true);
+  writer.Start("DeleteThread");
+
+  // Readers must always see every even key in order, regardless of the
+  // concurrent deletions of the odd ones.
+  Random rnd(29);
+  for (int i = 0; i < 200; ++i) {
+    SkipList<Key, Comparator>::Iterator iter(&list);
+    iter.Seek(rnd.Next() % kNumKeys);
+    Key expected_even = iter.Valid() ? (iter.key() + 1) / 2 * 2 : kNumKeys;
+    for (; iter.Valid(); iter.Next()) {
+      const Key key = iter.key();
+      ASSERT_LT(key, kNumKeys);
+      if (key % 2 == 0) {
+        ASSERT_EQ(expected_even, key);
+        expected_even += 2;
+      }
+    }
+    ASSERT_EQ(kNumKeys, expected_even);
+    ASSERT_TRUE(list.Contains(rnd.Next() % (kNumKeys / 2) * 2));
+  }
+
+  writer.Join();
+}
+
+
+TEST(SkipTest, InsertSortedBatch) {
+  Random rnd(401);
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  std::set<Key> keys;
+
+  // Interleave sparse random batches with the keys already in the list.
+  for (int batch = 0; batch < 20; ++batch) {
+    std::set<Key> batch_keys;
+    const Key base = rnd.Next() % 10000;
+    const int step = 1 + rnd.Next() % 50;
+    for (int i = 0; i < 200; ++i) {
+      const Key key = base + i * step + rnd.Next() % step;
+      if (keys.count(key) == 0) {
+        batch_keys.insert(key);
+      }
+    }
+    std::vector<Key> sorted(batch_keys.begin(), batch_keys.end());
+    list.InsertSortedBatch(sorted.data(), sorted.size());
+    keys.insert(batch_keys.begin(), batch_keys.end());
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (std::set<Key>::const_iterator it = keys.begin(); it != keys.end();
+       ++it) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(*it, iter.key());
+    iter.Next();
+  }
+  ASSERT_FALSE(iter.Valid());
+}
+
+TEST(SkipTest, SeekForward) {
+  const int N = 2000;
+  const int R = 5000;
+  Random rnd(501);
+  std::set<Key> keys;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp);
+  for (int i = 0; i < N; i++) {
+    Key key = rnd.Next() % R;
+    if (keys.insert(key).second) {
+      list.Insert(key);
+    }
+  }
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  Key target = 0;
+  for (int i = 0; i < 3000; ++i) {
+    // Mostly increasing targets, sometimes jumping backward.
+    if (rnd.OneIn(50)) {
+      target = rnd.Next() % R;
+    } else {
+      target += rnd.Next() % 8;
+    }
+    // The list changes between the searches.
+    if (rnd.OneIn(4)) {
+      const Key key = rnd.Next() % (R + 100);
+      if (keys.erase(key) == 1) {
+        ASSERT_TRUE(list.Delete(key));
+      } else {
+        keys.insert(key);
+        list.Insert(key);
+      }
+    }
+
+    iter.SeekForward(target);
+    std::set<Key>::const_iterator it = keys.lower_bound(target);
+    if (it == keys.end()) {
+      ASSERT_FALSE(iter.Valid()) << target;
+    } else {
+      ASSERT_TRUE(iter.Valid()) << target;
+      ASSERT_EQ(*it, iter.key());
+    }
+  }
+}
+
+TEST(SkipTest, AssignIterator) {
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp);
+  SkipList<Key, Comparator> other_list(cmp);
+  for (Key i = 0; i < 1000; i++) {
+    list.Insert(i * 2);
+    other_list.Insert(i * 2 + 1);
+  }
+
+  // The assigned iterator does not reuse the position of the last
+  // SeekForward() on the other list.
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekForward(1000);
+  ASSERT_TRUE(iter.Valid());
+  ASSERT_EQ(1000, iter.key());
+  iter = SkipList<Key, Comparator>::Iterator(&other_list);
+  iter.SeekForward(1500);
+  ASSERT_TRUE(iter.Valid());
+  ASSERT_EQ(1501, iter.key());
+  iter.SeekForward(1600);
+  ASSERT_TRUE(iter.Valid());
+  ASSERT_EQ(1601, iter.key());
+}
+
 }  // namespace
 }  // namespace gbase
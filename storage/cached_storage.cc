@@ -0,0 +1,446 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/cached_storage.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/coding.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "base/unnamed_event.h"
+#include "storage/lru_cache.h"
+#include "storage/storage_interface.h"
+#include "storage/write_batch.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+const size_t kDefaultCacheCapacity = 1024 * 1024;
+const size_t kDefaultMaxDirtyCount = 1024;
+
+// Value of a cache entry. |found| is false for a negative entry.
+struct CachedValue {
+  bool found;
+  string value;
+};
+
+void DeleteCachedValue(const StringPiece &key, void *value) {
+  delete reinterpret_cast<CachedValue *>(value);
+}
+
+// Backend read shared by the concurrent misses of the same key.
+struct Load {
+  Load() : invalidated(false), found(false) {}
+
+  // Set when the key is updated during the read, so that the result is
+  // not cached.
+  bool invalidated;
+  // Threads waiting for the result.
+  std::vector<UnnamedEvent *> waiters;
+  bool found;
+  string value;
+};
+
+class CachedStorageImpl : public StorageInterface {
+ public:
+  CachedStorageImpl(StorageInterface *backend,
+                    const CachedStorage::Options &options)
+      : backend_(backend),
+        options_(options),
+        cache_(NewLRUCache(options.cache_capacity)),
+        epoch_(cache_->NewId()) {}
+
+  virtual ~CachedStorageImpl() {
+    if (!dirty_.empty() && !Sync()) {
+      LOG(ERROR) << "cannot write " << dirty_.size() << " pending updates";
+    }
+  }
+
+  virtual bool Open(const string &filename) {
+    scoped_lock l(&mutex_);
+    dirty_.clear();
+    InvalidateAll();
+    return backend_->Open(filename);
+  }
+
+  virtual bool Sync() {
+    scoped_lock l(&mutex_);
+    return FlushDirty() && backend_->Sync();
+  }
+
+  virtual bool Lookup(const string &key, string *value) const {
+    CHECK(value);
+    const string cache_key = GetCacheKey(key);
+    bool found = false;
+    if (LookupCache(cache_key, value, &found)) {
+      return found;
+    }
+
+    std::shared_ptr<Load> load;
+    UnnamedEvent event;
+    bool leader = false;
+    {
+      scoped_lock l(&mutex_);
+      if (LookupDirty(key, value, &found) ||
+          LookupCache(cache_key, value, &found)) {
+        return found;
+      }
+      std::map<string, std::shared_ptr<Load> >::iterator it =
+          loads_.find(key);
+      if (it == loads_.end()) {
+        load.reset(new Load);
+        loads_[key] = load;
+        leader = true;
+      } else {
+        load = it->second;
+        load->waiters.push_back(&event);
+      }
+    }
+
+    if (!leader) {
+      event.Wait(-1);
+      // The leader notifies under |mutex_|, so taking it waits for Notify()
+      // to return before |event| goes out of scope.
+      scoped_lock l(&mutex_);
+      if (load->found) {
+        value->assign(load->value);
+      }
+      return load->found;
+    }
+
+    found = backend_->Lookup(key, value);
+    scoped_lock l(&mutex_);
+    if (!load->invalidated && (found || options_.cache_misses)) {
+      InsertCache(cache_key, found ? value : NULL);
+    }
+    loads_.erase(key);
+    load->found = found;
+    if (found) {
+      load->value = *value;
+    }
+    for (size_t i = 0; i < load->waiters.size(); ++i) {
+      load->waiters[i]->Notify();
+    }
+    return found;
+  }
+
+  virtual bool Insert(const string &key, const string &value) {
+    scoped_lock l(&mutex_);
+    if (options_.write_policy == CachedStorage::WRITE_BACK) {
+      dirty_[key].reset(new string(value));
+      UpdateCache(key, &value);
+      return MaybeFlushDirty();
+    }
+    if (!backend_->Insert(key, value)) {
+      InvalidateCache(key);
+      return false;
+    }
+    UpdateCache(key, &value);
+    return true;
+  }
+
+  virtual bool Erase(const string &key) {
+    scoped_lock l(&mutex_);
+    if (options_.write_policy == CachedStorage::WRITE_BACK) {
+      string value;
+      bool found = false;
+      if (!LookupDirty(key, &value, &found) &&
+          !LookupCache(GetCacheKey(key), &value, &found)) {
+        found = backend_->Lookup(key, &value);
+      }
+      if (!found) {
+        return false;
+      }
+      dirty_[key].reset();
+      UpdateCache(key, NULL);
+      return MaybeFlushDirty();
+    }
+    const bool result = backend_->Erase(key);
+    UpdateCache(key, NULL);
+    return result;
+  }
+
+  virtual bool Write(const WriteBatch &batch) {
+    scoped_lock l(&mutex_);
+    if (options_.write_policy == CachedStorage::WRITE_BACK) {
+      CacheUpdater updater(this, true);
+      if (!batch.Iterate(&updater)) {
+        return false;
+      }
+      return MaybeFlushDirty();
+    }
+    if (!backend_->Write(batch)) {
+      // The batch may be partially applied.
+      CacheInvalidator invalidator(this);
+      batch.Iterate(&invalidator);
+      return false;
+    }
+    CacheUpdater updater(this, false);
+    return batch.Iterate(&updater);
+  }
+
+  virtual bool Clear() {
+    scoped_lock l(&mutex_);
+    dirty_.clear();
+    InvalidateAll();
+    return backend_->Clear();
+  }
+
+  virtual size_t Size() const {
+    return backend_->Size();
+  }
+
+  virtual Iterator *NewIterator() const {
+    return backend_->NewIterator();
+  }
+
+ private:
+  // Pending updates of WRITE_BACK. NULL value means erasure.
+  typedef std::map<string, std::unique_ptr<string> > DirtyMap;
+
+  class CacheUpdater : public WriteBatch::Handler {
+   public:
+    CacheUpdater(CachedStorageImpl *storage, bool dirty)
+        : storage_(storage), dirty_(dirty) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      const string key_str = key.as_string();
+      const string value_str = value.as_string();
+      if (dirty_) {
+        storage_->dirty_[key_str].reset(new string(value_str));
+      }
+      storage_->UpdateCache(key_str, &value_str);
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      const string key_str = key.as_string();
+      if (dirty_) {
+        storage_->dirty_[key_str].reset();
+      }
+      storage_->UpdateCache(key_str, NULL);
+    }
+
+   private:
+    CachedStorageImpl *storage_;
+    const bool dirty_;
+  };
+
+  class CacheInvalidator : public WriteBatch::Handler {
+   public:
+    explicit CacheInvalidator(CachedStorageImpl *storage)
+        : storage_(storage) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      storage_->InvalidateCache(key.as_string());
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      storage_->InvalidateCache(key.as_string());
+    }
+
+   private:
+    CachedStorageImpl *storage_;
+  };
+
+  // Cache key is |epoch_| + |key|, so that Clear() can drop all the
+  // entries by changing |epoch_|.
+  string GetCacheKey(const string &key) const {
+    string cache_key;
+    cache_key.reserve(8 + key.size());
+    PutFixed64(&cache_key, epoch_.load());
+    cache_key.append(key);
+    return cache_key;
+  }
+
+  // Returns true if |cache_key| is cached, and sets |*found| to false if
+  // the entry is negative.
+  bool LookupCache(const string &cache_key, string *value,
+                   bool *found) const {
+    Cache::Handle *handle = cache_->Lookup(cache_key);
+    if (handle == NULL) {
+      return false;
+    }
+    const CachedValue *cached =
+        reinterpret_cast<const CachedValue *>(cache_->Value(handle));
+    *found = cached->found;
+    if (cached->found) {
+      value->assign(cached->value);
+    }
+    cache_->Release(handle);
+    return true;
+  }
+
+  // Inserts a negative entry if |value| is NULL.
+  void InsertCache(const string &cache_key, const string *value) const {
+    CachedValue *cached = new CachedValue;
+    cached->found = (value != NULL);
+    if (value != NULL) {
+      cached->value = *value;
+    }
+    const size_t charge = cache_key.size() + cached->value.size();
+    cache_->Release(
+        cache_->Insert(cache_key, cached, charge, &DeleteCachedValue));
+  }
+
+  // The following methods require |mutex_|.
+  bool LookupDirty(const string &key, string *value, bool *found) const {
+    DirtyMap::const_iterator it = dirty_.find(key);
+    if (it == dirty_.end()) {
+      return false;
+    }
+    *found = (it->second != NULL);
+    if (*found) {
+      value->assign(*it->second);
+    }
+    return true;
+  }
+
+  // Caches the updated value, which is NULL for erasure, and discards the
+  // result of the concurrent backend read.
+  void UpdateCache(const string &key, const string *value) {
+    CancelLoad(key);
+    if (value != NULL || options_.cache_misses) {
+      InsertCache(GetCacheKey(key), value);
+    } else {
+      cache_->Erase(GetCacheKey(key));
+    }
+  }
+
+  void InvalidateCache(const string &key) {
+    CancelLoad(key);
+    cache_->Erase(GetCacheKey(key));
+  }
+
+  void CancelLoad(const string &key) {
+    std::map<string, std::shared_ptr<Load> >::iterator it = loads_.find(key);
+    if (it != loads_.end()) {
+      it->second->invalidated = true;
+    }
+  }
+
+  void InvalidateAll() {
+    epoch_ = cache_->NewId();
+    for (std::map<string, std::shared_ptr<Load> >::iterator it =
+             loads_.begin(); it != loads_.end(); ++it) {
+      it->second->invalidated = true;
+    }
+  }
+
+  bool MaybeFlushDirty() {
+    if (dirty_.size() < options_.max_dirty_count) {
+      return true;
+    }
+    return FlushDirty();
+  }
+
+  bool FlushDirty() {
+    if (dirty_.empty()) {
+      return true;
+    }
+    WriteBatch batch;
+    for (DirtyMap::const_iterator it = dirty_.begin(); it != dirty_.end();
+         ++it) {
+      if (it->second == NULL) {
+        batch.Erase(it->first);
+      } else {
+        batch.Insert(it->first, *it->second);
+      }
+    }
+    bool result = true;
+    if (!backend_->Write(batch)) {
+      // Keeping a rejected update pending would fail all the later flushes.
+      LOG(WARNING) << "cannot write " << dirty_.size()
+                   << " pending updates as a batch";
+      result = FlushDirtyOneByOne();
+    }
+    dirty_.clear();
+    return result;
+  }
+
+  // Writes the pending updates one by one. The rejected ones are dropped
+  // and removed from the cache.
+  bool FlushDirtyOneByOne() {
+    bool result = true;
+    for (DirtyMap::const_iterator it = dirty_.begin(); it != dirty_.end();
+         ++it) {
+      string value;
+      const bool written = (it->second == NULL) ?
+          (backend_->Erase(it->first) ||
+           !backend_->Lookup(it->first, &value)) :
+          backend_->Insert(it->first, *it->second);
+      if (!written) {
+        LOG(ERROR) << "cannot write the pending update of " << it->first;
+        InvalidateCache(it->first);
+        result = false;
+      }
+    }
+    return result;
+  }
+
+  std::unique_ptr<StorageInterface> backend_;
+  const CachedStorage::Options options_;
+  std::unique_ptr<Cache> cache_;
+  // Guards the updates, |dirty_| and |loads_|. Cache hits don't take it.
+  mutable Mutex mutex_;
+  std::atomic<uint64> epoch_;
+  DirtyMap dirty_;
+  // Backend reads in progress.
+  mutable std::map<string, std::shared_ptr<Load> > loads_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachedStorageImpl);
+};
+
+}  // namespace
+
+CachedStorage::Options::Options()
+    : cache_capacity(kDefaultCacheCapacity),
+      write_policy(WRITE_THROUGH),
+      cache_misses(true),
+      max_dirty_count(kDefaultMaxDirtyCount) {}
+
+StorageInterface *CachedStorage::New(StorageInterface *backend) {
+  return New(backend, Options());
+}
+
+StorageInterface *CachedStorage::New(StorageInterface *backend,
+                                     const Options &options) {
+  CHECK(backend);
+  return new CachedStorageImpl(backend, options);
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,86 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_CACHED_STORAGE_H_
+#define GBASE_STORAGE_CACHED_STORAGE_H_
+
+#include "base/port.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+
+// Wraps a storage with an LRU cache of the key-value pairs.
+// Lookup() reads the backend on a cache miss and caches the result. The
+// concurrent misses of the same key wait for the first one, so that only
+// one of them reads the backend. Operations are thread-safe if the backend
+// is thread-safe.
+class CachedStorage {
+ public:
+  enum WritePolicy {
+    // Insert/Erase/Write update the backend and then the cache.
+    WRITE_THROUGH,
+    // Insert/Erase/Write only record the updates in memory, and the updates
+    // are written to the backend as one batch by Sync(), or when
+    // |max_dirty_count| keys are pending. If the backend rejects the batch,
+    // the updates are written one by one, and the ones still rejected are
+    // dropped and make the flush fail. Size() and NewIterator() don't
+    // reflect the pending updates.
+    WRITE_BACK,
+  };
+
+  struct Options {
+    Options();
+
+    // Capacity of the cache in bytes of the keys and the values.
+    size_t cache_capacity;
+
+    WritePolicy write_policy;
+
+    // Caches the keys not found in the backend too.
+    bool cache_misses;
+
+    // Used only for WRITE_BACK.
+    size_t max_dirty_count;
+  };
+
+  // Takes the ownership of |backend|.
+  // Caller must take ownership of the returned object.
+  static StorageInterface *New(StorageInterface *backend);
+  static StorageInterface *New(StorageInterface *backend,
+                               const Options &options);
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(CachedStorage);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_CACHED_STORAGE_H_
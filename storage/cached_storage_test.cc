@@ -0,0 +1,202 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/cached_storage.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/number_util.h"
+#include "base/port.h"
+#include "base/thread.h"
+#include "storage/counting_storage.h"
+#include "storage/storage_interface.h"
+#include "storage/tiny_storage.h"
+#include "storage/write_batch.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+class LookupThread : public Thread {
+ public:
+  LookupThread(const StorageInterface *storage, const string &key)
+      : storage_(storage), key_(key), found_(false) {}
+
+  virtual void Run() {
+    found_ = storage_->Lookup(key_, &value_);
+  }
+
+  bool found() const {
+    return found_;
+  }
+  const string &value() const {
+    return value_;
+  }
+
+ private:
+  const StorageInterface *storage_;
+  const string key_;
+  bool found_;
+  string value_;
+};
+
+}  // namespace
+
+TEST(CachedStorageTest, WriteThroughTest) {
+  CountingStorage *backend = new CountingStorage;
+  std::unique_ptr<StorageInterface> storage(CachedStorage::New(backend));
+  string value;
+
+  EXPECT_TRUE(storage->Insert("key1", "value1"));
+  EXPECT_EQ(1, backend->num_writes());
+  EXPECT_TRUE(storage->Lookup("key1", &value));
+  EXPECT_EQ("value1", value);
+  EXPECT_EQ(0, backend->num_lookups());
+
+  // Negative caching.
+  EXPECT_FALSE(storage->Lookup("key2", &value));
+  EXPECT_FALSE(storage->Lookup("key2", &value));
+  EXPECT_EQ(1, backend->num_lookups());
+  EXPECT_TRUE(storage->Insert("key2", "value2"));
+  EXPECT_TRUE(storage->Lookup("key2", &value));
+  EXPECT_EQ("value2", value);
+  EXPECT_EQ(1, backend->num_lookups());
+
+  EXPECT_TRUE(storage->Erase("key1"));
+  EXPECT_FALSE(storage->Erase("key1"));
+  EXPECT_FALSE(storage->Lookup("key1", &value));
+  EXPECT_EQ(1, backend->num_lookups());
+
+  WriteBatch batch;
+  batch.Insert("key3", "value3");
+  batch.Erase("key2");
+  EXPECT_TRUE(storage->Write(batch));
+  EXPECT_TRUE(storage->Lookup("key3", &value));
+  EXPECT_EQ("value3", value);
+  EXPECT_FALSE(storage->Lookup("key2", &value));
+  EXPECT_EQ(1, backend->num_lookups());
+  EXPECT_EQ(1, storage->Size());
+
+  // Read-through after Clear().
+  EXPECT_TRUE(storage->Clear());
+  EXPECT_FALSE(storage->Lookup("key3", &value));
+  EXPECT_EQ(2, backend->num_lookups());
+}
+
+TEST(CachedStorageTest, WriteBackTest) {
+  CachedStorage::Options options;
+  options.write_policy = CachedStorage::WRITE_BACK;
+  options.cache_misses = false;
+  options.max_dirty_count = 10;
+  CountingStorage *backend = new CountingStorage;
+  EXPECT_TRUE(backend->Insert("erased", "value"));
+  std::unique_ptr<StorageInterface> storage(
+      CachedStorage::New(backend, options));
+  string value;
+
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(storage->Insert("key", "value" + NumberUtil::SimpleItoa(i)));
+  }
+  EXPECT_TRUE(storage->Erase("erased"));
+  EXPECT_FALSE(storage->Erase("erased"));
+  EXPECT_FALSE(storage->Erase("not_exist"));
+  EXPECT_EQ(1, backend->num_writes());
+  EXPECT_TRUE(storage->Lookup("key", &value));
+  EXPECT_EQ("value99", value);
+  EXPECT_FALSE(storage->Lookup("erased", &value));
+  EXPECT_TRUE(backend->Lookup("erased", &value));
+
+  EXPECT_TRUE(storage->Sync());
+  EXPECT_EQ(2, backend->num_writes());
+  EXPECT_TRUE(backend->Lookup("key", &value));
+  EXPECT_EQ("value99", value);
+  EXPECT_FALSE(backend->Lookup("erased", &value));
+
+  // Flushed when |max_dirty_count| keys are pending.
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(storage->Insert("key" + NumberUtil::SimpleItoa(i), "value"));
+  }
+  EXPECT_EQ(3, backend->num_writes());
+  EXPECT_EQ(11, backend->Size());
+}
+
+TEST(CachedStorageTest, WriteBackRejectedTest) {
+  CachedStorage::Options options;
+  options.write_policy = CachedStorage::WRITE_BACK;
+  options.max_dirty_count = 3;
+  // TinyStorage rejects the too long values.
+  CountingStorage *backend = new CountingStorage(TinyStorage::New());
+  std::unique_ptr<StorageInterface> storage(
+      CachedStorage::New(backend, options));
+  string value;
+
+  EXPECT_TRUE(storage->Insert("key1", "value1"));
+  EXPECT_TRUE(storage->Insert("long", string(10000, 'x')));
+  EXPECT_FALSE(storage->Insert("key2", "value2"));
+
+  // The other updates are written, and the rejected one is dropped.
+  EXPECT_TRUE(backend->Lookup("key1", &value));
+  EXPECT_TRUE(backend->Lookup("key2", &value));
+  EXPECT_FALSE(storage->Lookup("long", &value));
+
+  // The dropped update doesn't block the later flushes.
+  EXPECT_TRUE(storage->Insert("key3", "value3"));
+  EXPECT_TRUE(storage->Insert("key4", "value4"));
+  EXPECT_TRUE(storage->Insert("key5", "value5"));
+  EXPECT_TRUE(backend->Lookup("key5", &value));
+  EXPECT_EQ("value5", value);
+  EXPECT_EQ(5, backend->Size());
+}
+
+TEST(CachedStorageTest, SingleFlightTest) {
+  const int kNumThreads = 8;
+  CountingStorage *backend = new CountingStorage;
+  EXPECT_TRUE(backend->Insert("key", "value"));
+  backend->set_lookup_delay_msec(100);
+  std::unique_ptr<StorageInterface> storage(CachedStorage::New(backend));
+
+  std::vector<std::unique_ptr<LookupThread> > threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back(new LookupThread(storage.get(), "key"));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("LookupThread");
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+    EXPECT_TRUE(threads[i]->found());
+    EXPECT_EQ("value", threads[i]->value());
+  }
+  EXPECT_EQ(1, backend->num_lookups());
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,96 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/counting_storage.h"
+
+#include "base/logging.h"
+#include "base/util.h"
+#include "storage/memory_storage.h"
+
+namespace gbase {
+namespace storage {
+
+CountingStorage::CountingStorage()
+    : storage_(MemoryStorage::New()), num_lookups_(0), num_writes_(0),
+      num_syncs_(0), lookup_delay_msec_(0) {}
+
+CountingStorage::CountingStorage(StorageInterface *storage)
+    : storage_(storage), num_lookups_(0), num_writes_(0), num_syncs_(0),
+      lookup_delay_msec_(0) {
+  CHECK(storage);
+}
+
+CountingStorage::~CountingStorage() {}
+
+bool CountingStorage::Open(const string &filename) {
+  return storage_->Open(filename);
+}
+
+bool CountingStorage::Sync() {
+  ++num_syncs_;
+  return storage_->Sync();
+}
+
+bool CountingStorage::Lookup(const string &key, string *value) const {
+  ++num_lookups_;
+  if (lookup_delay_msec_ > 0) {
+    Util::Sleep(lookup_delay_msec_);
+  }
+  return storage_->Lookup(key, value);
+}
+
+bool CountingStorage::Insert(const string &key, const string &value) {
+  ++num_writes_;
+  return storage_->Insert(key, value);
+}
+
+bool CountingStorage::Erase(const string &key) {
+  ++num_writes_;
+  return storage_->Erase(key);
+}
+
+bool CountingStorage::Write(const WriteBatch &batch) {
+  ++num_writes_;
+  return storage_->Write(batch);
+}
+
+bool CountingStorage::Clear() {
+  return storage_->Clear();
+}
+
+size_t CountingStorage::Size() const {
+  return storage_->Size();
+}
+
+StorageInterface::Iterator *CountingStorage::NewIterator() const {
+  return storage_->NewIterator();
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,101 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_COUNTING_STORAGE_H_
+#define GBASE_STORAGE_COUNTING_STORAGE_H_
+
+// Storage for unittest which counts the accesses to the wrapped storage.
+//
+// Usage:
+// {
+//   CountingStorage *backend = new CountingStorage;  // Wraps MemoryStorage.
+//   std::unique_ptr<StorageInterface> storage(CachedStorage::New(backend));
+//   ... (Do something)
+//   EXPECT_EQ(1, backend->num_lookups());
+// }
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "base/port.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+
+class CountingStorage : public StorageInterface {
+ public:
+  // Wraps a new MemoryStorage.
+  CountingStorage();
+  // Takes the ownership of |storage|.
+  explicit CountingStorage(StorageInterface *storage);
+  virtual ~CountingStorage();
+
+  virtual bool Open(const string &filename);
+  virtual bool Sync();
+  virtual bool Lookup(const string &key, string *value) const;
+  virtual bool Insert(const string &key, const string &value);
+  virtual bool Erase(const string &key);
+  virtual bool Write(const WriteBatch &batch);
+  virtual bool Clear();
+  virtual size_t Size() const;
+  virtual Iterator *NewIterator() const;
+
+  int num_lookups() const {
+    return num_lookups_;
+  }
+  // Number of Insert(), Erase() and Write() calls.
+  int num_writes() const {
+    return num_writes_;
+  }
+  int num_syncs() const {
+    return num_syncs_;
+  }
+
+  // Delays every Lookup() by |msec|.
+  void set_lookup_delay_msec(uint32 msec) {
+    lookup_delay_msec_ = msec;
+  }
+
+ private:
+  std::unique_ptr<StorageInterface> storage_;
+  // Lookup() may be called concurrently.
+  mutable std::atomic<int> num_lookups_;
+  int num_writes_;
+  int num_syncs_;
+  uint32 lookup_delay_msec_;
+
+  DISALLOW_COPY_AND_ASSIGN(CountingStorage);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_COUNTING_STORAGE_H_
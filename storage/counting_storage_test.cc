@@ -0,0 +1,94 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/counting_storage.h"
+
+#include <memory>
+#include <string>
+
+#include "storage/memory_storage.h"
+#include "storage/write_batch.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+TEST(CountingStorageTest, CountsAccesses) {
+  CountingStorage storage;
+  EXPECT_EQ(0, storage.num_lookups());
+  EXPECT_EQ(0, storage.num_writes());
+  EXPECT_EQ(0, storage.num_syncs());
+
+  EXPECT_TRUE(storage.Insert("key1", "value1"));
+  EXPECT_TRUE(storage.Insert("key2", "value2"));
+  EXPECT_TRUE(storage.Erase("key2"));
+  EXPECT_EQ(3, storage.num_writes());
+
+  WriteBatch batch;
+  batch.Insert("key3", "value3");
+  batch.Insert("key4", "value4");
+  EXPECT_TRUE(storage.Write(batch));
+  EXPECT_EQ(4, storage.num_writes());
+
+  string value;
+  EXPECT_TRUE(storage.Lookup("key1", &value));
+  EXPECT_EQ("value1", value);
+  EXPECT_FALSE(storage.Lookup("key2", &value));
+  EXPECT_EQ(2, storage.num_lookups());
+  EXPECT_EQ(3, storage.Size());
+
+  EXPECT_TRUE(storage.Sync());
+  EXPECT_EQ(1, storage.num_syncs());
+
+  std::unique_ptr<StorageInterface::Iterator> iter(storage.NewIterator());
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("key1", iter->key());
+
+  EXPECT_TRUE(storage.Clear());
+  EXPECT_EQ(0, storage.Size());
+  EXPECT_EQ(4, storage.num_writes());
+}
+
+TEST(CountingStorageTest, WrapsGivenStorage) {
+  StorageInterface *memory = MemoryStorage::New();
+  EXPECT_TRUE(memory->Insert("key", "value"));
+  CountingStorage storage(memory);
+
+  string value;
+  EXPECT_TRUE(storage.Lookup("key", &value));
+  EXPECT_EQ("value", value);
+  EXPECT_EQ(1, storage.num_lookups());
+  EXPECT_EQ(0, storage.num_writes());
+}
+
+}  // namespace
+}  // namespace storage
+}  // namespace gbase
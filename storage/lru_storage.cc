@@ -37,8 +37,10 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "base/bloom_filter.h"
 #include "base/clock.h"
 #include "base/file_stream.h"
 #include "base/file_util.h"
@@ -46,6 +48,8 @@
 #include "base/logging.h"
 #include "base/mmap.h"
 #include "base/port.h"
+#include "base/random.h"
+#include "base/string_piece.h"
 #include "base/util.h"
 
 namespace gbase {
@@ -55,52 +59,60 @@ namespace {
 const size_t kMaxLRUSize   = 1000000;  // 1M
 const size_t kMaxValueSize = 1024;     // 1024 byte
 
-template <class T>
-inline void ReadValue(char **ptr, T *value) {
-  memcpy(value, *ptr, sizeof(*value));
-  *ptr += sizeof(*value);
-}
+// Header is [value_size(4)][size(4)][seed(4)]. The top bit of value_size
+// is set when the records are stored in COLUMNAR_LAYOUT.
+const size_t kHeaderSize = 12;
+const uint32 kColumnarLayoutFlag = 0x80000000;
 
-uint64 GetFP(const char *ptr) {
-  return *reinterpret_cast<const uint64 *>(ptr);
-}
+// Same default as the approximated LRU of Redis. Larger values make the
+// eviction closer to the exact LRU at the cost of more random reads.
+const size_t kDefaultEvictionSampleSize = 5;
+const uint32 kEvictionRandomSeed = 0x76fef;
 
-uint32 GetTimeStamp(const char *ptr) {
-  return *reinterpret_cast<const uint32 *>(ptr + 8);
-}
+// Format of the filter sidecar:
+// |magic(uint32 file_size ^ kFilterMagicId)|digest(uint64)|
+// |name_size(uint32)|name(variable length)|filter(variable length)|
+const uint32 kFilterMagicId = 0x2e1f5b7d;  // random seed
+const char kFilterFileSuffix[] = ".filter";
 
-const char* GetValue(const char *ptr) {
-  return ptr + 12;
-}
+// The filter is rebuilt when the number of fingerprints inserted after
+// the last build exceeds max(kMinPendingFilterSize, used_size / 16).
+const size_t kMinPendingFilterSize = 64;
 
-void Update(char *ptr) {
-  const uint32 last_access_time = static_cast<uint32>(Clock::GetTime());
-  memcpy(ptr + 8, reinterpret_cast<const char *>(&last_access_time), 4);
-}
+// MultiLookup() issues madvise() only for the batches of this size or more,
+// as the system calls don't pay off for a few keys.
+const size_t kMinAdviseWillNeedSize = 8;
 
-void Update(char *ptr, uint64 fp, const char *value, size_t value_size) {
-  const uint32 last_access_time = static_cast<uint32>(Clock::GetTime());
-  memcpy(ptr,     reinterpret_cast<const char *>(&fp), 8);
-  memcpy(ptr + 8, reinterpret_cast<const char *>(&last_access_time), 4);
-  memcpy(ptr + 12, value, value_size);
+// Values on the same or adjacent pages of this size are advised with a
+// single madvise().  Mmap::MaybeAdviseWillNeed() aligns the ranges to the
+// actual page size.
+const uintptr_t kAdvisePageSize = 4096;
+
+template <class T>
+inline void ReadValue(char **ptr, T *value) {
+  memcpy(value, *ptr, sizeof(*value));
+  *ptr += sizeof(*value);
 }
 
+typedef std::pair<uint32, size_t> TimeStampAndSlot;
+
 class CompareByTimeStamp {
  public:
-  bool operator()(const char *a, const char *b) const {
-    return GetTimeStamp(a) > GetTimeStamp(b);
+  bool operator()(const TimeStampAndSlot &a,
+                  const TimeStampAndSlot &b) const {
+    return a.first > b.first;
   }
 };
 }  // namespace
 
 class LRUStorage::Node {
  public:
-  Node(): next(NULL), prev(NULL), value(NULL) {
+  Node(): next(NULL), prev(NULL), slot(0) {
   }
 
   Node *next;
   Node *prev;
-  char *value;
+  size_t slot;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(Node);
@@ -127,10 +139,10 @@ class LRUStorage::LRUList {
     top_ = last_ = NULL;
   }
 
-  Node *Add(char *value) {
+  Node *Add(size_t slot) {
     if (size_ < max_size_) {
       Node *node = new Node;
-      node->value = value;
+      node->slot = slot;
       if (last_ == NULL) {
         node->prev = NULL;
         top_ = node;
@@ -198,8 +210,16 @@ LRUStorage *LRUStorage::Create(const char *filename,
                                size_t value_size,
                                size_t size,
                                uint32 seed) {
+  return Create(filename, value_size, size, seed, ROW_LAYOUT);
+}
+
+LRUStorage *LRUStorage::Create(const char *filename,
+                               size_t value_size,
+                               size_t size,
+                               uint32 seed,
+                               Layout layout) {
   std::unique_ptr<LRUStorage> n(new LRUStorage);
-  if (!n->OpenOrCreate(filename, value_size, size, seed)) {
+  if (!n->OpenOrCreate(filename, value_size, size, seed, layout)) {
     LOG(ERROR) << "could not open LRUStorage";
     return NULL;
   }
@@ -210,6 +230,14 @@ bool LRUStorage::CreateStorageFile(const char *filename,
                                    size_t value_size,
                                    size_t size,
                                    uint32 seed) {
+  return CreateStorageFile(filename, value_size, size, seed, ROW_LAYOUT);
+}
+
+bool LRUStorage::CreateStorageFile(const char *filename,
+                                   size_t value_size,
+                                   size_t size,
+                                   uint32 seed,
+                                   Layout layout) {
   if (value_size == 0 || value_size > kMaxValueSize) {
     LOG(ERROR) << "value_size is out of range";
     return false;
@@ -231,7 +259,10 @@ bool LRUStorage::CreateStorageFile(const char *filename,
     return false;
   }
 
-  const uint32 value_size_uint32 = static_cast<uint32>(value_size);
+  uint32 value_size_uint32 = static_cast<uint32>(value_size);
+  if (layout == COLUMNAR_LAYOUT) {
+    value_size_uint32 |= kColumnarLayoutFlag;
+  }
   const uint32 size_uint32 = static_cast<uint32>(size);
 
   ofs.write(reinterpret_cast<const char *>(&value_size_uint32),
@@ -240,14 +271,11 @@ bool LRUStorage::CreateStorageFile(const char *filename,
             sizeof(size_uint32));
   ofs.write(reinterpret_cast<const char *>(&seed),
             sizeof(seed));
-  std::vector<char> ary(value_size, '\0');
-  const uint32 last_access_time = 0;
-  const uint64 fp = 0;
 
+  // Both layouts have the same size and an empty entry is all zero, so
+  // the body can be written record by record regardless of the layout.
+  std::vector<char> ary(value_size + 12, '\0');
   for (size_t i = 0; i < size; ++i) {
-    ofs.write(reinterpret_cast<const char *>(&fp), sizeof(fp));
-    ofs.write(reinterpret_cast<const char *>(&last_access_time),
-              sizeof(last_access_time));
     ofs.write(reinterpret_cast<const char *>(&ary[0]),
               static_cast<std::streamsize>(ary.size() * sizeof(ary[0])));
   }
@@ -262,8 +290,7 @@ bool LRUStorage::Clear() {
       lru_list_->size() == 0) {
     return true;
   }
-  const size_t offset =
-      sizeof(value_size_) + sizeof(size_) + sizeof(seed_);
+  const size_t offset = kHeaderSize;
   if (offset >= mmap_->size()) {   // should not happen
     return false;
   }
@@ -291,48 +318,40 @@ bool LRUStorage::Merge(const LRUStorage &storage) {
     return false;
   }
 
-  std::vector<const char *> ary;
-
-  // this file
-  {
-    const char *begin = begin_;
-    const char *end = end_;
-    while (begin < end) {
-      ary.push_back(begin);
-      begin += (value_size_ + 12);
-    }
+  // The slot of the target storage is offset by size_.
+  std::vector<TimeStampAndSlot> ary;
+  for (size_t i = 0; i < size_; ++i) {
+    ary.push_back(std::make_pair(GetTimeStamp(i), i));
   }
-
-  // target file
-  {
-    const char *begin = storage.begin_;
-    const char *end = storage.end_;
-    while (begin < end) {
-      ary.push_back(begin);
-      begin += (value_size_ + 12);
-    }
+  for (size_t i = 0; i < storage.size_; ++i) {
+    ary.push_back(std::make_pair(storage.GetTimeStamp(i), size_ + i));
   }
 
   std::stable_sort(ary.begin(), ary.end(), CompareByTimeStamp());
 
-  string buf;
+  std::vector<uint64> fps;
+  std::vector<uint32> timestamps;
+  string values;
   std::set<uint64> seen;   // remove duplicated entries.
-  for (size_t i = 0; i < ary.size(); ++i) {
-    if (!seen.insert(GetFP(ary[i])).second) {
+  for (size_t i = 0; i < ary.size() && fps.size() < size_; ++i) {
+    const LRUStorage &src = ary[i].second < size_ ? *this : storage;
+    const size_t slot =
+        ary[i].second < size_ ? ary[i].second : ary[i].second - size_;
+    const uint64 fp = src.GetFP(slot);
+    if (!seen.insert(fp).second) {
       continue;
     }
-    buf.append(const_cast<const char *>(ary[i]), value_size_ + 12);
+    fps.push_back(fp);
+    timestamps.push_back(ary[i].first);
+    values.append(src.GetValue(slot), value_size_);
   }
 
-  const size_t old_size = static_cast<size_t>(end_ - begin_);
-  const size_t new_size = min(buf.size(), old_size);
-
   // TODO(taku): this part is not atomic.
   // If the converter process is killed while memcpy or memset is running,
   // the storage data will be broken.
-  memcpy(begin_, buf.data(), new_size);
-  if (new_size < old_size) {
-    memset(begin_ + new_size, '\0', old_size - new_size);
+  memset(begin_, '\0', static_cast<size_t>(end_ - begin_));
+  for (size_t i = 0; i < fps.size(); ++i) {
+    UpdateEntry(i, fps[i], values.data() + i * value_size_, timestamps[i]);
   }
 
   return Open(mmap_->begin(), mmap_->size());
@@ -342,8 +361,13 @@ LRUStorage::LRUStorage()
     : value_size_(0),
       size_(0),
       seed_(0),
-      last_item_(NULL),
-      begin_(NULL), end_(NULL) {}
+      layout_(ROW_LAYOUT),
+      eviction_policy_(EXACT_LRU),
+      eviction_sample_size_(kDefaultEvictionSampleSize),
+      last_item_(0),
+      begin_(NULL), end_(NULL),
+      random_(new Random(kEvictionRandomSeed)),
+      filter_policy_(NULL) {}
 
 LRUStorage::~LRUStorage() {
   Close();
@@ -353,12 +377,21 @@ bool LRUStorage::OpenOrCreate(const char *filename,
                               size_t new_value_size,
                               size_t new_size,
                               uint32 new_seed) {
+  return OpenOrCreate(filename, new_value_size, new_size, new_seed,
+                      ROW_LAYOUT);
+}
+
+bool LRUStorage::OpenOrCreate(const char *filename,
+                              size_t new_value_size,
+                              size_t new_size,
+                              uint32 new_seed,
+                              Layout new_layout) {
   if (!FileUtil::FileExists(filename)) {
     // This is also an expected scenario. Let's create a new data file.
     VLOG(1) << filename << " does not exist. Creating a new one.";
     if (!LRUStorage::CreateStorageFile(filename,
                                        new_value_size,
-                                       new_size, new_seed)) {
+                                       new_size, new_seed, new_layout)) {
       LOG(ERROR) << "CreateStorageFile failed against " << filename;
       return false;
     }
@@ -376,7 +409,7 @@ bool LRUStorage::OpenOrCreate(const char *filename,
     //     data file and the content is actually valid.
     if (!LRUStorage::CreateStorageFile(filename,
                                        new_value_size,
-                                       new_size, new_seed)) {
+                                       new_size, new_seed, new_layout)) {
       LOG(ERROR) << "CreateStorageFile failed";
       return false;
     }
@@ -388,10 +421,11 @@ bool LRUStorage::OpenOrCreate(const char *filename,
   }
 
   // File format has changed
-  if (new_value_size != value_size() || new_size != size()) {
+  if (new_value_size != value_size() || new_size != size() ||
+      new_layout != layout()) {
     Close();
     if (!LRUStorage::CreateStorageFile(filename, new_value_size,
-                                       new_size, new_seed)) {
+                                       new_size, new_seed, new_layout)) {
       LOG(ERROR) << "CreateStorageFile failed";
       return false;
     }
@@ -402,7 +436,8 @@ bool LRUStorage::OpenOrCreate(const char *filename,
     }
   }
 
-  if (new_value_size != value_size() || new_size != size()) {
+  if (new_value_size != value_size() || new_size != size() ||
+      new_layout != layout()) {
     Close();
     LOG(ERROR) << "file is broken";
     return false;
@@ -425,7 +460,7 @@ bool LRUStorage::Open(const char *filename) {
     return false;
   }
 
-  if (mmap_->size() < 8) {
+  if (mmap_->size() < kHeaderSize) {
     LOG(ERROR) << "file size is too small";
     return false;
   }
@@ -435,6 +470,10 @@ bool LRUStorage::Open(const char *filename) {
 }
 
 bool LRUStorage::Open(char *ptr, size_t ptr_size) {
+  // Don't keep the index of the previous data if this fails.
+  lru_list_.reset();
+  map_.clear();
+
   begin_ = ptr;
   end_ = ptr + ptr_size;
 
@@ -445,6 +484,10 @@ bool LRUStorage::Open(char *ptr, size_t ptr_size) {
   ReadValue<uint32>(&begin_, &size_uint32);
   ReadValue<uint32>(&begin_, &seed_);
 
+  layout_ = (value_size_uint32 & kColumnarLayoutFlag) ?
+      COLUMNAR_LAYOUT : ROW_LAYOUT;
+  value_size_uint32 &= ~kColumnarLayoutFlag;
+
   value_size_ = static_cast<size_t>(value_size_uint32);
   size_ = static_cast<size_t>(size_uint32);
 
@@ -463,37 +506,48 @@ bool LRUStorage::Open(char *ptr, size_t ptr_size) {
     return false;
   }
 
-  const size_t file_size = mmap_->size() - 12;
+  const size_t file_size = mmap_->size() - kHeaderSize;
   if ((value_size_ + 12) * size_ != file_size) {
     LOG(ERROR) << "LRU file is broken";
     return false;
   }
 
-  std::vector<char *> ary;
-  char *begin = begin_;
-  char *end = end_;
-  while (begin < end) {
-    ary.push_back(begin);
-    begin += (value_size_ + 12);
+  // In COLUMNAR_LAYOUT, this scan only touches the timestamp region.
+  std::vector<TimeStampAndSlot> ary;
+  ary.reserve(size_);
+  for (size_t i = 0; i < size_; ++i) {
+    ary.push_back(std::make_pair(GetTimeStamp(i), i));
   }
   std::stable_sort(ary.begin(), ary.end(), CompareByTimeStamp());
 
   lru_list_.reset(new LRUList(size_));
   map_.clear();
-  last_item_ = NULL;
+  last_item_ = size_;
   for (size_t i = 0; i < ary.size(); ++i) {
-    if (GetTimeStamp(ary[i]) != 0) {
-      Node *node = lru_list_->Add(ary[i]);
-      map_.insert(std::make_pair(GetFP(ary[i]), node));
-    } else if (last_item_ == NULL) {
-      last_item_ = ary[i];
+    if (ary[i].first != 0) {
+      Node *node = lru_list_->Add(ary[i].second);
+      map_.insert(std::make_pair(GetFP(ary[i].second), node));
+    } else if (last_item_ == size_) {
+      last_item_ = ary[i].second;
     }
   }
 
+  filter_.clear();
+  pending_filter_fps_.clear();
+  if (filter_policy_ != NULL && !LoadFilter()) {
+    BuildFilter();
+  }
+
   return true;
 }
 
 void LRUStorage::Close() {
+  if (filter_policy_ != NULL && lru_list_.get() != NULL &&
+      !filename_.empty()) {
+    SaveFilter();
+  }
+  filter_.clear();
+  pending_filter_fps_.clear();
   filename_.clear();
   mmap_.reset();
   lru_list_.reset();
@@ -508,12 +562,71 @@ const char* LRUStorage::Lookup(const string &key) const {
 const char* LRUStorage::Lookup(const string &key,
                                uint32 *last_access_time) const {
   const uint64 fp = Hash::FingerprintWithSeed(key, seed_);
+  if (!KeyMayMatch(fp)) {
+    return NULL;
+  }
   std::map<uint64, Node *>::const_iterator it = map_.find(fp);
   if (it == map_.end()) {
     return NULL;
   }
-  *last_access_time = GetTimeStamp(it->second->value);
-  return GetValue(it->second->value);
+  *last_access_time = GetTimeStamp(it->second->slot);
+  return GetValue(it->second->slot);
+}
+
+void LRUStorage::MultiLookup(const std::vector<string> &keys,
+                             std::vector<const char *> *values) const {
+  DCHECK(values);
+  values->assign(keys.size(), NULL);
+
+  std::vector<size_t> slots(keys.size(), size_);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const uint64 fp = Hash::FingerprintWithSeed(keys[i], seed_);
+    if (!KeyMayMatch(fp)) {
+      continue;
+    }
+    std::map<uint64, Node *>::const_iterator it = map_.find(fp);
+    if (it != map_.end()) {
+      slots[i] = it->second->slot;
+    }
+  }
+
+  // Asks the kernel to page in the values which are not resident yet.
+  if (keys.size() >= kMinAdviseWillNeedSize) {
+    std::vector<uintptr_t> addresses;
+    addresses.reserve(slots.size());
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (slots[i] < size_) {
+        addresses.push_back(
+            reinterpret_cast<uintptr_t>(GetValuePtr(slots[i])));
+      }
+    }
+    std::sort(addresses.begin(), addresses.end());
+    // Coalesces the values into page ranges [begin, end).
+    size_t i = 0;
+    while (i < addresses.size()) {
+      const uintptr_t begin = addresses[i];
+      uintptr_t end = begin + value_size_;
+      ++i;
+      while (i < addresses.size() &&
+             addresses[i] / kAdvisePageSize <= end / kAdvisePageSize + 1) {
+        end = std::max(end, addresses[i] + value_size_);
+        ++i;
+      }
+      Mmap::MaybeAdviseWillNeed(reinterpret_cast<const void *>(begin),
+                                end - begin);
+    }
+  }
+  for (size_t i = 0; i < slots.size(); ++i) {
+    if (slots[i] < size_) {
+      port::Prefetch(GetValuePtr(slots[i]));
+    }
+  }
+
+  for (size_t i = 0; i < slots.size(); ++i) {
+    if (slots[i] < size_) {
+      (*values)[i] = GetValue(slots[i]);
+    }
+  }
 }
 
 bool LRUStorage::GetAllValues(std::vector<string> *values) const {
@@ -522,15 +635,22 @@ bool LRUStorage::GetAllValues(std::vector<string> *values) const {
   }
   DCHECK(values);
   values->clear();
+  std::vector<TimeStampAndSlot> ary;
   for (const Node *node = lru_list_->GetLastNode();
        node != NULL;
        node = node->prev) {
+    ary.push_back(std::make_pair(GetTimeStamp(node->slot), node->slot));
+  }
+  std::reverse(ary.begin(), ary.end());
+  if (eviction_policy_ == SAMPLED_LRU) {
+    // The list is not ordered in this mode.
+    std::stable_sort(ary.begin(), ary.end(), CompareByTimeStamp());
+  }
+  for (size_t i = 0; i < ary.size(); ++i) {
     // Default constructor of string is not applicable
     // because value's size() must return value_size_.
-    DCHECK(node->value);
-    values->push_back(string(GetValue(node->value), value_size_));
+    values->push_back(string(GetValue(ary[i].second), value_size_));
   }
-  std::reverse(values->begin(), values->end());
   return true;
 }
 
@@ -542,8 +662,8 @@ bool LRUStorage::Touch(const string &key) {
   const uint64 fp = Hash::FingerprintWithSeed(key, seed_);
   std::map<uint64, Node *>::iterator it = map_.find(fp);
   if (it != map_.end()) {     // find in the cache
-    Update(it->second->value);
-    lru_list_->MoveToTop(it->second);
+    UpdateTimeStamp(it->second->slot);
+    Promote(it->second);
     return true;
   }
   return false;
@@ -557,31 +677,27 @@ bool LRUStorage::Insert(const string &key, const char *value) {
   const uint64 fp = Hash::FingerprintWithSeed(key, seed_);
   std::map<uint64, Node *>::iterator it = map_.find(fp);
   if (it != map_.end()) {     // find in the cache
-    Update(it->second->value, fp, value, value_size_);
-    lru_list_->MoveToTop(it->second);
+    UpdateEntry(it->second->slot, fp, value);
+    Promote(it->second);
   } else if (lru_list_->size() >= size_ ||
-             last_item_ == NULL) {  // not found, but cache is FULL
-    Node *node = lru_list_->GetLastNode();
-    const uint64 old_fp = GetFP(node->value);  // remove oldest item
+             last_item_ >= size_) {  // not found, but cache is FULL
+    Node *node = GetEvictionNode();
+    const uint64 old_fp = GetFP(node->slot);  // remove oldest item
     std::map<uint64, Node *>::iterator old_it = map_.find(old_fp);
     if (old_it != map_.end()) {
       map_.erase(old_it);
     }
-    lru_list_->MoveToTop(node);
-    Update(node->value, fp, value, value_size_);
+    Promote(node);
+    UpdateEntry(node->slot, fp, value);
     map_.insert(std::make_pair(fp, node));
-  } else if (last_item_ < mmap_->end()) {  // not found, cahce is not FULL
+    AddToFilter(fp);
+  } else {  // not found, cahce is not FULL
     Node *node = lru_list_->Add(last_item_);
-    lru_list_->MoveToTop(node);
-    Update(node->value, fp, value, value_size_);
+    Promote(node);
+    UpdateEntry(node->slot, fp, value);
     map_.insert(std::make_pair(fp, node));
-    last_item_ += (value_size_ + 12);
-    if (last_item_ >= mmap_->end()) {
-      last_item_ = NULL;
-    }
-  } else {
-    LOG(ERROR) << "insertion failed";
-    return false;
+    AddToFilter(fp);
+    ++last_item_;
   }
 
   return true;
@@ -595,13 +711,210 @@ bool LRUStorage::TryInsert(const string &key, const char *value) {
   const uint64 fp = Hash::FingerprintWithSeed(key, seed_);
   std::map<uint64, Node *>::iterator it = map_.find(fp);
   if (it != map_.end()) {     // find in the cache
-    Update(it->second->value, fp, value, value_size_);
-    lru_list_->MoveToTop(it->second);
+    UpdateEntry(it->second->slot, fp, value);
+    Promote(it->second);
+  }
+
+  return true;
+}
+
+void LRUStorage::Promote(Node *node) {
+  if (eviction_policy_ == EXACT_LRU) {
+    lru_list_->MoveToTop(node);
+  }
+}
+
+LRUStorage::Node *LRUStorage::GetEvictionNode() {
+  if (eviction_policy_ == SAMPLED_LRU) {
+    Node *node = GetSampledEvictionNode();
+    if (node != NULL) {
+      return node;
+    }
+  }
+  return lru_list_->GetLastNode();
+}
+
+LRUStorage::Node *LRUStorage::GetSampledEvictionNode() {
+  Node *oldest = NULL;
+  for (size_t i = 0; i < eviction_sample_size_; ++i) {
+    const size_t slot = random_->Uniform(size_);
+    // Skips free slots and slots shadowed by a duplicated fingerprint.
+    std::map<uint64, Node *>::iterator it = map_.find(GetFP(slot));
+    if (it == map_.end() || it->second->slot != slot) {
+      continue;
+    }
+    if (oldest == NULL ||
+        GetTimeStamp(slot) < GetTimeStamp(oldest->slot)) {
+      oldest = it->second;
+    }
+  }
+  return oldest;
+}
+
+void LRUStorage::set_eviction_policy(EvictionPolicy policy) {
+  if (policy == eviction_policy_) {
+    return;
+  }
+  eviction_policy_ = policy;
+  if (policy == EXACT_LRU && mmap_.get() != NULL && lru_list_.get() != NULL) {
+    Open(mmap_->begin(), mmap_->size());
+  }
+}
+
+LRUStorage::EvictionPolicy LRUStorage::eviction_policy() const {
+  return eviction_policy_;
+}
+
+void LRUStorage::set_eviction_sample_size(size_t sample_size) {
+  DCHECK_GT(sample_size, 0);
+  eviction_sample_size_ = sample_size;
+}
+
+size_t LRUStorage::eviction_sample_size() const {
+  return eviction_sample_size_;
+}
+
+LRUStorage::Layout LRUStorage::layout() const {
+  return layout_;
+}
+
+void LRUStorage::set_filter_policy(const FilterPolicy *policy) {
+  filter_policy_ = policy;
+  filter_.clear();
+  pending_filter_fps_.clear();
+  if (filter_policy_ != NULL && lru_list_.get() != NULL && !LoadFilter()) {
+    BuildFilter();
   }
+}
+
+bool LRUStorage::KeyMayMatch(uint64 fp) const {
+  if (filter_policy_ == NULL) {
+    return true;
+  }
+  const StringPiece key(reinterpret_cast<const char *>(&fp), sizeof(fp));
+  return filter_policy_->KeyMayMatch(key, filter_) ||
+      pending_filter_fps_.find(fp) != pending_filter_fps_.end();
+}
+
+void LRUStorage::AddToFilter(uint64 fp) {
+  if (filter_policy_ == NULL) {
+    return;
+  }
+  pending_filter_fps_.insert(fp);
+  if (pending_filter_fps_.size() >
+      std::max(kMinPendingFilterSize, map_.size() / 16)) {
+    BuildFilter();
+  }
+}
+
+void LRUStorage::BuildFilter() {
+  DCHECK(filter_policy_);
+  std::vector<StringPiece> keys;
+  keys.reserve(map_.size());
+  for (std::map<uint64, Node *>::const_iterator it = map_.begin();
+       it != map_.end(); ++it) {
+    keys.push_back(StringPiece(reinterpret_cast<const char *>(&it->first),
+                               sizeof(it->first)));
+  }
+  filter_.clear();
+  pending_filter_fps_.clear();
+  filter_policy_->CreateFilter(keys.empty() ? NULL : &keys[0],
+                               static_cast<int>(keys.size()), &filter_);
+}
 
+bool LRUStorage::LoadFilter() {
+  DCHECK(filter_policy_);
+  if (filename_.empty()) {
+    return false;
+  }
+
+  Mmap mmap;
+  const string filter_filename = filename_ + kFilterFileSuffix;
+  if (!mmap.Open(filter_filename.c_str(), "r")) {
+    VLOG(1) << "cannot open " << filter_filename;
+    return false;
+  }
+
+  char *begin = mmap.begin();
+  const char *end = begin + mmap.size();
+  uint32 magic = 0;
+  uint64 digest = 0;
+  uint32 name_size = 0;
+  if (mmap.size() < sizeof(magic) + sizeof(digest) + sizeof(name_size)) {
+    LOG(WARNING) << "filter file is too small";
+    return false;
+  }
+  ReadValue<uint32>(&begin, &magic);
+  ReadValue<uint64>(&begin, &digest);
+  ReadValue<uint32>(&begin, &name_size);
+
+  if ((magic ^ kFilterMagicId) != mmap.size()) {
+    LOG(WARNING) << "filter magic is broken";
+    return false;
+  }
+
+  if (begin + name_size > end ||
+      StringPiece(begin, name_size) != filter_policy_->Name()) {
+    VLOG(1) << "filter policy has changed";
+    return false;
+  }
+  begin += name_size;
+
+  // The storage may be updated without the filter, e.g., by Merge().
+  if (digest != GetIndexDigest()) {
+    VLOG(1) << "filter is stale";
+    return false;
+  }
+
+  filter_.assign(begin, end - begin);
+  pending_filter_fps_.clear();
+  return true;
+}
+
+bool LRUStorage::SaveFilter() {
+  DCHECK(filter_policy_);
+  if (!pending_filter_fps_.empty()) {
+    BuildFilter();
+  }
+
+  const string filter_filename = filename_ + kFilterFileSuffix;
+  const string output_filename = filter_filename + ".tmp";
+  {
+    OutputFileStream ofs(output_filename.c_str(), ios::binary | ios::out);
+    if (!ofs) {
+      LOG(ERROR) << "cannot open " << output_filename;
+      return false;
+    }
+
+    const uint64 digest = GetIndexDigest();
+    const string name = filter_policy_->Name();
+    const uint32 name_size = static_cast<uint32>(name.size());
+    const uint32 magic = static_cast<uint32>(
+        sizeof(magic) + sizeof(digest) + sizeof(name_size) +
+        name.size() + filter_.size()) ^ kFilterMagicId;
+    ofs.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
+    ofs.write(reinterpret_cast<const char *>(&digest), sizeof(digest));
+    ofs.write(reinterpret_cast<const char *>(&name_size), sizeof(name_size));
+    ofs.write(name.data(), name.size());
+    ofs.write(filter_.data(), filter_.size());
+  }
+
+  if (!FileUtil::AtomicRename(output_filename, filter_filename)) {
+    LOG(ERROR) << "AtomicRename failed";
+    return false;
+  }
   return true;
 }
 
+uint64 LRUStorage::GetIndexDigest() const {
+  uint64 digest = map_.size();
+  for (std::map<uint64, Node *>::const_iterator it = map_.begin();
+       it != map_.end(); ++it) {
+    digest = digest * 0x100000001b3ULL + it->first;
+  }
+  return digest;
+}
+
 size_t LRUStorage::value_size() const {
   return value_size_;
 }
@@ -627,12 +940,12 @@ void LRUStorage::Write(size_t i,
                        const string &value,
                        uint32 last_access_time) {
   DCHECK_LT(i, size_);
-  char *ptr = begin_ + (i * (value_size_ + 12));
-  memcpy(ptr,     reinterpret_cast<const char *>(&fp), 8);
-  memcpy(ptr + 8, reinterpret_cast<const char *>(&last_access_time), 4);
   if (value.size() == value_size_) {
-    memcpy(ptr + 12, value.data(), value_size_);
+    UpdateEntry(i, fp, value.data(), last_access_time);
   } else {
+    memcpy(GetFPPtr(i), reinterpret_cast<const char *>(&fp), 8);
+    memcpy(GetTimeStampPtr(i),
+           reinterpret_cast<const char *>(&last_access_time), 4);
     LOG(ERROR) << "value size is not " << value_size_ << " byte.";
   }
 }
@@ -642,10 +955,62 @@ void LRUStorage::Read(size_t i,
                       string *value,
                       uint32 *last_access_time) const {
   DCHECK_LT(i, size_);
-  const char *ptr = begin_ + (i * (value_size_ + 12));
-  *fp = GetFP(ptr);
-  value->assign(GetValue(ptr), value_size_);
-  *last_access_time = GetTimeStamp(ptr);
+  *fp = GetFP(i);
+  value->assign(GetValue(i), value_size_);
+  *last_access_time = GetTimeStamp(i);
+}
+
+// ROW_LAYOUT:      [fp(8)][timestamp(4)][value] x size
+// COLUMNAR_LAYOUT: [fp(8)] x size, [timestamp(4)] x size, [value] x size
+char *LRUStorage::GetFPPtr(size_t i) const {
+  if (layout_ == COLUMNAR_LAYOUT) {
+    return begin_ + i * 8;
+  }
+  return begin_ + i * (value_size_ + 12);
+}
+
+char *LRUStorage::GetTimeStampPtr(size_t i) const {
+  if (layout_ == COLUMNAR_LAYOUT) {
+    return begin_ + size_ * 8 + i * 4;
+  }
+  return begin_ + i * (value_size_ + 12) + 8;
+}
+
+char *LRUStorage::GetValuePtr(size_t i) const {
+  if (layout_ == COLUMNAR_LAYOUT) {
+    return begin_ + size_ * 12 + i * value_size_;
+  }
+  return begin_ + i * (value_size_ + 12) + 12;
+}
+
+uint64 LRUStorage::GetFP(size_t i) const {
+  return *reinterpret_cast<const uint64 *>(GetFPPtr(i));
+}
+
+uint32 LRUStorage::GetTimeStamp(size_t i) const {
+  return *reinterpret_cast<const uint32 *>(GetTimeStampPtr(i));
+}
+
+const char *LRUStorage::GetValue(size_t i) const {
+  return GetValuePtr(i);
+}
+
+void LRUStorage::UpdateTimeStamp(size_t i) {
+  const uint32 last_access_time = static_cast<uint32>(Clock::GetTime());
+  memcpy(GetTimeStampPtr(i),
+         reinterpret_cast<const char *>(&last_access_time), 4);
+}
+
+void LRUStorage::UpdateEntry(size_t i, uint64 fp, const char *value) {
+  UpdateEntry(i, fp, value, static_cast<uint32>(Clock::GetTime()));
+}
+
+void LRUStorage::UpdateEntry(size_t i, uint64 fp, const char *value,
+                             uint32 last_access_time) {
+  memcpy(GetFPPtr(i), reinterpret_cast<const char *>(&fp), 8);
+  memcpy(GetTimeStampPtr(i),
+         reinterpret_cast<const char *>(&last_access_time), 4);
+  memcpy(GetValuePtr(i), value, value_size_);
 }
 
 }  // namespace storage
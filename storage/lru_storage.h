@@ -32,6 +32,7 @@
 
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -39,12 +40,32 @@
 
 namespace gbase {
 
+class FilterPolicy;
 class Mmap;
+class Random;
 
 namespace storage {
 
 class LRUStorage {
  public:
+  enum EvictionPolicy {
+    // Keeps an exact recency list. Every hit moves the entry to the top
+    // of the list, and the bottom entry is evicted.
+    EXACT_LRU,
+    // Keeps no recency order. A hit only updates the timestamp, and an
+    // eviction samples random slots and evicts the oldest one of them.
+    SAMPLED_LRU,
+  };
+
+  enum Layout {
+    // Records are stored as [fp(8)][timestamp(4)][value] x size.
+    ROW_LAYOUT,
+    // Fingerprints, timestamps and values are stored in separate
+    // contiguous regions, so that timestamp scans don't touch values
+    // and values are paged in only on hits.
+    COLUMNAR_LAYOUT,
+  };
+
   LRUStorage();
   ~LRUStorage();
 
@@ -58,6 +79,11 @@ class LRUStorage {
                     size_t new_value_size,
                     size_t new_size,
                     uint32 new_seed);
+  bool OpenOrCreate(const char *filename,
+                    size_t new_value_size,
+                    size_t new_size,
+                    uint32 new_seed,
+                    Layout new_layout);
 
   // Lookup key
   const char *Lookup(const string &key,
@@ -65,6 +91,13 @@ class LRUStorage {
 
   const char *Lookup(const string &key) const;
 
+  // Looks up |keys| in a batch. (*values)[i] is the value of keys[i], or
+  // NULL if not found. All the fingerprints are resolved first and the
+  // records are prefetched before they are read, so that the memory and
+  // page-fault latency of the keys overlap.
+  void MultiLookup(const std::vector<string> &keys,
+                   std::vector<const char *> *values) const;
+
   // Returns all values.
   // The order is new to old (*values->begin() is the newest).
   bool GetAllValues(std::vector<string> *values) const;
@@ -89,6 +122,24 @@ class LRUStorage {
   bool TryInsert(const string &key,
                  const char *value);
 
+  // Changes the eviction policy. The recency list is rebuilt from the
+  // timestamps when switching back to EXACT_LRU.
+  void set_eviction_policy(EvictionPolicy policy);
+  EvictionPolicy eviction_policy() const;
+
+  // Number of slots examined per eviction in SAMPLED_LRU mode.
+  void set_eviction_sample_size(size_t sample_size);
+  size_t eviction_sample_size() const;
+
+  Layout layout() const;
+
+  // Sets the filter policy used to reject missing keys before probing the
+  // index. The filter is built over the fingerprints and persisted to
+  // "<filename>.filter" on Close(). The sidecar is reused on Open() only
+  // if it matches the entries in the storage. |policy| is not owned and
+  // must outlive this storage. NULL disables the filter.
+  void set_filter_policy(const FilterPolicy *policy);
+
   size_t value_size() const;
   size_t size() const;
   size_t used_size() const;
@@ -118,12 +169,22 @@ class LRUStorage {
                             size_t value_size,
                             size_t size,
                             uint32 seed);
+  static LRUStorage *Create(const char *filename,
+                            size_t value_size,
+                            size_t size,
+                            uint32 seed,
+                            Layout layout);
 
   // Create an empty LRU db file
   static bool CreateStorageFile(const char *filename,
                                 size_t value_size,
                                 size_t size,
                                 uint32 seed);
+  static bool CreateStorageFile(const char *filename,
+                                size_t value_size,
+                                size_t size,
+                                uint32 seed,
+                                Layout layout);
  private:
   class LRUList;
   class Node;
@@ -131,16 +192,52 @@ class LRUStorage {
   // load from memory buffer
   bool Open(char *ptr, size_t ptr_size);
 
+  // Accessors to the |i| th entry in the mapped region.
+  char *GetFPPtr(size_t i) const;
+  char *GetTimeStampPtr(size_t i) const;
+  char *GetValuePtr(size_t i) const;
+  uint64 GetFP(size_t i) const;
+  uint32 GetTimeStamp(size_t i) const;
+  const char *GetValue(size_t i) const;
+  void UpdateTimeStamp(size_t i);
+  void UpdateEntry(size_t i, uint64 fp, const char *value);
+  void UpdateEntry(size_t i, uint64 fp, const char *value,
+                   uint32 last_access_time);
+
+  // Returns false if |fp| is definitely not in the storage.
+  bool KeyMayMatch(uint64 fp) const;
+  void AddToFilter(uint64 fp);
+  void BuildFilter();
+  bool LoadFilter();
+  bool SaveFilter();
+  uint64 GetIndexDigest() const;
+
+  // Moves |node| to the top of the list if the policy keeps the order.
+  void Promote(Node *node);
+
+  // Returns the node to be evicted when the storage is full.
+  Node *GetEvictionNode();
+  Node *GetSampledEvictionNode();
+
   size_t value_size_;
   size_t size_;
   uint32 seed_;
-  char *last_item_;
+  Layout layout_;
+  EvictionPolicy eviction_policy_;
+  size_t eviction_sample_size_;
+  // The first free slot, or size_ if there is no free slot.
+  size_t last_item_;
   char *begin_;
   char *end_;
   string filename_;
   std::map<uint64, Node *> map_;
   std::unique_ptr<LRUList> lru_list_;
   std::unique_ptr<Mmap> mmap_;
+  std::unique_ptr<Random> random_;
+  const FilterPolicy *filter_policy_;
+  string filter_;
+  // Fingerprints inserted after the filter was built.
+  std::set<uint64> pending_filter_fps_;
 
   DISALLOW_COPY_AND_ASSIGN(LRUStorage);
 };
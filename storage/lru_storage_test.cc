@@ -30,14 +30,19 @@
 #include "storage/lru_storage.h"
 
 #include <algorithm>
+#include <memory>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "base/bloom_filter.h"
+#include "base/clock.h"
+#include "base/clock_mock.h"
 #include "base/file_stream.h"
 #include "base/file_util.h"
 #include "base/logging.h"
+#include "base/number_util.h"
 #include "base/port.h"
 #include "base/util.h"
 #include "base/random.h"
@@ -314,6 +319,84 @@ TEST_F(LRUStorageTest, Merge) {
   FileUtil::Unlink(file2);
 }
 
+TEST_F(LRUStorageTest, FilterTest) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  const string file = GetTemporaryFilePath();
+  const string filter_file = file + ".filter";
+  LRUStorage::CreateStorageFile(file.c_str(), 4, 1000, 0x76fef);
+
+  {
+    LRUStorage storage;
+    storage.set_filter_policy(policy.get());
+    EXPECT_TRUE(storage.Open(file.c_str()));
+    for (uint32 i = 0; i < 500; ++i) {
+      EXPECT_TRUE(storage.Insert("key" + NumberUtil::SimpleItoa(i),
+                                 reinterpret_cast<const char *>(&i)));
+    }
+    for (uint32 i = 0; i < 500; ++i) {
+      const uint32 *v = reinterpret_cast<const uint32 *>(
+          storage.Lookup("key" + NumberUtil::SimpleItoa(i)));
+      ASSERT_TRUE(v != NULL);
+      EXPECT_EQ(i, *v);
+      EXPECT_TRUE(storage.Lookup("missing" + NumberUtil::SimpleItoa(i)) == NULL);
+    }
+  }
+  EXPECT_TRUE(FileUtil::FileExists(filter_file));
+
+  // Updates the storage without the filter.
+  {
+    LRUStorage storage;
+    EXPECT_TRUE(storage.Open(file.c_str()));
+    const uint32 v = 500;
+    EXPECT_TRUE(storage.Insert("key500", reinterpret_cast<const char *>(&v)));
+  }
+
+  // The stale sidecar is not used.
+  {
+    LRUStorage storage;
+    EXPECT_TRUE(storage.Open(file.c_str()));
+    storage.set_filter_policy(policy.get());
+    for (uint32 i = 0; i <= 500; ++i) {
+      EXPECT_TRUE(storage.Lookup("key" + NumberUtil::SimpleItoa(i)) != NULL);
+    }
+  }
+
+  FileUtil::Unlink(filter_file);
+}
+
+TEST_F(LRUStorageTest, MultiLookupTest) {
+  const string file = GetTemporaryFilePath();
+  LRUStorage::CreateStorageFile(file.c_str(), 4, 100, 0x76fef);
+  LRUStorage storage;
+  EXPECT_TRUE(storage.Open(file.c_str()));
+
+  std::vector<string> keys;
+  for (uint32 i = 0; i < 50; ++i) {
+    const string key = "key" + NumberUtil::SimpleItoa(i);
+    if (i % 2 == 0) {
+      EXPECT_TRUE(storage.Insert(key, reinterpret_cast<const char *>(&i)));
+    }
+    keys.push_back(key);
+  }
+
+  std::vector<const char *> values;
+  storage.MultiLookup(keys, &values);
+  ASSERT_EQ(keys.size(), values.size());
+  for (uint32 i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(storage.Lookup(keys[i]), values[i]);
+    if (i % 2 == 0) {
+      ASSERT_TRUE(values[i] != NULL);
+      EXPECT_EQ(i, *reinterpret_cast<const uint32 *>(values[i]));
+    } else {
+      EXPECT_TRUE(values[i] == NULL);
+    }
+  }
+
+  keys.clear();
+  storage.MultiLookup(keys, &values);
+  EXPECT_TRUE(values.empty());
+}
+
 TEST_F(LRUStorageTest, InvalidFileOpenTest) {
   LRUStorage storage;
   EXPECT_FALSE(storage.Insert("test", NULL));
@@ -326,6 +409,118 @@ TEST_F(LRUStorageTest, InvalidFileOpenTest) {
   EXPECT_FALSE(storage.Insert("test", NULL));
 }
 
+TEST_F(LRUStorageTest, ColumnarLayoutTest) {
+  const int kSize[] = {10, 100, 1000, 10000};
+  const string file = GetTemporaryFilePath();
+  for (int i = 0; i < arraysize(kSize); ++i) {
+    LRUStorage::CreateStorageFile(file.c_str(), 4, kSize[i], 0x76fef,
+                                  LRUStorage::COLUMNAR_LAYOUT);
+    LRUStorage storage;
+    EXPECT_TRUE(storage.Open(file.c_str()));
+    EXPECT_EQ(LRUStorage::COLUMNAR_LAYOUT, storage.layout());
+    EXPECT_EQ(kSize[i], storage.size());
+    EXPECT_EQ(4, storage.value_size());
+    RunTest(&storage, kSize[i]);
+  }
+
+  // Merge between different layouts.
+  const string file2 = GetTemporaryFilePath() + ".tmp";
+  {
+    LRUStorage::CreateStorageFile(file.c_str(), 4, 4, 0x76fef,
+                                  LRUStorage::COLUMNAR_LAYOUT);
+    LRUStorage::CreateStorageFile(file2.c_str(), 4, 4, 0x76fef);
+    LRUStorage storage1;
+    EXPECT_TRUE(storage1.Open(file.c_str()));
+    storage1.Write(0, 1, "abcd", 10);
+    storage1.Write(1, 2, "efgh", 30);
+
+    LRUStorage storage2;
+    EXPECT_TRUE(storage2.Open(file2.c_str()));
+    EXPECT_EQ(LRUStorage::ROW_LAYOUT, storage2.layout());
+    storage2.Write(0, 3, "ijkl", 20);
+    storage2.Write(1, 2, "mnop", 40);
+
+    EXPECT_TRUE(storage1.Merge(storage2));
+    EXPECT_EQ(3, storage1.used_size());
+
+    uint64 fp;
+    string value;
+    uint32 last_access_time;
+    storage1.Read(0, &fp, &value, &last_access_time);
+    EXPECT_EQ(2, fp);
+    EXPECT_EQ("mnop", value);
+    EXPECT_EQ(40, last_access_time);
+    storage1.Read(1, &fp, &value, &last_access_time);
+    EXPECT_EQ(3, fp);
+    EXPECT_EQ("ijkl", value);
+    storage1.Read(2, &fp, &value, &last_access_time);
+    EXPECT_EQ(1, fp);
+    EXPECT_EQ("abcd", value);
+  }
+
+  // Layout change recreates the file.
+  {
+    LRUStorage storage;
+    EXPECT_TRUE(storage.OpenOrCreate(file2.c_str(), 4, 4, 0x76fef,
+                                     LRUStorage::COLUMNAR_LAYOUT));
+    EXPECT_EQ(LRUStorage::COLUMNAR_LAYOUT, storage.layout());
+    EXPECT_EQ(0, storage.used_size());
+  }
+  FileUtil::Unlink(file2);
+}
+
+TEST_F(LRUStorageTest, SampledEvictionTest) {
+  ClockMock clock(1000, 0);
+  Clock::SetClockForUnitTest(&clock);
+
+  const string file = GetTemporaryFilePath();
+  LRUStorage::CreateStorageFile(file.c_str(), 4, 4, 0x76fef);
+  LRUStorage storage;
+  EXPECT_TRUE(storage.Open(file.c_str()));
+  storage.set_eviction_policy(LRUStorage::SAMPLED_LRU);
+  EXPECT_EQ(LRUStorage::SAMPLED_LRU, storage.eviction_policy());
+  // Samples enough slots to find the oldest entry.
+  storage.set_eviction_sample_size(64);
+
+  const char *kKeys[] = {"a", "b", "c", "d"};
+  for (uint32 i = 0; i < arraysize(kKeys); ++i) {
+    EXPECT_TRUE(storage.Insert(kKeys[i], reinterpret_cast<const char *>(&i)));
+    clock.PutClockForward(1, 0);
+  }
+  EXPECT_EQ(4, storage.used_size());
+
+  // "a" becomes the newest one, so "b" is evicted.
+  EXPECT_TRUE(storage.Touch("a"));
+  clock.PutClockForward(1, 0);
+  const uint32 v = 4;
+  EXPECT_TRUE(storage.Insert("e", reinterpret_cast<const char *>(&v)));
+  EXPECT_EQ(4, storage.used_size());
+  EXPECT_TRUE(storage.Lookup("a") != NULL);
+  EXPECT_TRUE(storage.Lookup("b") == NULL);
+  EXPECT_TRUE(storage.Lookup("c") != NULL);
+  EXPECT_TRUE(storage.Lookup("d") != NULL);
+  EXPECT_TRUE(storage.Lookup("e") != NULL);
+
+  // Values are sorted by timestamp.
+  std::vector<string> values;
+  EXPECT_TRUE(storage.GetAllValues(&values));
+  ASSERT_EQ(4, values.size());
+  const uint32 kExpected[] = {4, 0, 3, 2};
+  for (size_t i = 0; i < arraysize(kExpected); ++i) {
+    EXPECT_EQ(kExpected[i],
+              *reinterpret_cast<const uint32 *>(values[i].data()));
+  }
+
+  // The recency list is rebuilt, so "c" is evicted.
+  storage.set_eviction_policy(LRUStorage::EXACT_LRU);
+  clock.PutClockForward(1, 0);
+  EXPECT_TRUE(storage.Insert("f", reinterpret_cast<const char *>(&v)));
+  EXPECT_TRUE(storage.Lookup("c") == NULL);
+  EXPECT_TRUE(storage.Lookup("d") != NULL);
+
+  Clock::SetClockForUnitTest(NULL);
+}
+
 class LRUStorageOpenOrCreateTest : public testing::Test {
  protected:
   LRUStorageOpenOrCreateTest() {}
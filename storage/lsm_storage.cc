@@ -0,0 +1,1151 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/lsm_storage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/bloom_filter.h"
+#include "base/coding.h"
+#include "base/file_stream.h"
+#include "base/file_util.h"
+#include "base/logging.h"
+#include "base/mmap.h"
+#include "base/mutex.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "base/thread.h"
+#include "base/unnamed_event.h"
+#include "base/util.h"
+#include "storage/lru_cache.h"
+#include "storage/memtable.h"
+#include "storage/pinned_slice.h"
+#include "storage/sstable.h"
+#include "storage/write_batch.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+const size_t kDefaultWriteBufferSize = 4 * 1024 * 1024;  // 4MByte
+const size_t kDefaultCompactionTrigger = 4;
+const int kDefaultBloomBitsPerKey = 10;
+const size_t kDefaultBlockCacheSize = 8 * 1024 * 1024;  // 8MByte
+
+const uint32 kManifestVersion = 0;
+const uint32 kManifestMagicId = 0x6a2d91c3;  // random seed
+const char kManifestFileName[] = "MANIFEST";
+
+// Batches of the waiting writers are merged up to this size.
+const size_t kMaxBatchGroupSize = 1024 * 1024;  // 1MByte
+
+// Immutable sorted table file, which is an SSTable whose value is
+// |type(uint8)|value|.
+class SortedTable {
+ public:
+  SortedTable(const string &filename, const FilterPolicy *filter_policy,
+              Cache *block_cache)
+      : filename_(filename), obsolete_(false) {
+    options_.filter_policy = filter_policy;
+    options_.block_cache = block_cache;
+  }
+
+  ~SortedTable() {
+    table_.reset();
+    if (obsolete_) {
+      FileUtil::Unlink(filename_);
+    }
+  }
+
+  bool Open() {
+    table_.reset(SSTable::Open(options_, filename_));
+    return table_.get() != NULL;
+  }
+
+  // Returns true if the table has an entry of |key|. |value| points to
+  // the mapped file.
+  bool Get(const StringPiece &key, StringPiece *value,
+           ValueType *type) const {
+    if (!table_->Get(key, value) || value->empty()) {
+      return false;
+    }
+    *type = static_cast<ValueType>((*value)[0]);
+    value->remove_prefix(1);
+    return true;
+  }
+
+  EntryIterator *NewIterator() const {
+    return new Iterator(table_->NewIterator());
+  }
+
+  size_t file_size() const {
+    return table_->file_size();
+  }
+
+  // The file is removed when the last reference is released.
+  void MarkObsolete() {
+    obsolete_ = true;
+  }
+
+ private:
+  class Iterator : public EntryIterator {
+   public:
+    // Takes the ownership of |iter|.
+    explicit Iterator(SSTable::Iterator *iter) : iter_(iter) {}
+
+    virtual bool Valid() const {
+      return iter_->Valid();
+    }
+
+    virtual void SeekToFirst() {
+      iter_->SeekToFirst();
+      SkipBrokenEntries();
+    }
+
+    virtual void SeekToLast() {
+      iter_->SeekToLast();
+      SkipBrokenEntriesBackward();
+    }
+
+    virtual void Seek(const StringPiece &target) {
+      iter_->Seek(target);
+      SkipBrokenEntries();
+    }
+
+    virtual void Next() {
+      iter_->Next();
+      SkipBrokenEntries();
+    }
+
+    virtual void Prev() {
+      iter_->Prev();
+      SkipBrokenEntriesBackward();
+    }
+
+    virtual StringPiece key() const {
+      return iter_->key();
+    }
+
+    virtual StringPiece value() const {
+      StringPiece value = iter_->value();
+      value.remove_prefix(1);
+      return value;
+    }
+
+    virtual ValueType type() const {
+      return static_cast<ValueType>(iter_->value()[0]);
+    }
+
+   private:
+    void SkipBrokenEntries() {
+      while (iter_->Valid() && iter_->value().empty()) {
+        LOG(ERROR) << "entry is broken: " << iter_->key();
+        iter_->Next();
+      }
+    }
+
+    void SkipBrokenEntriesBackward() {
+      while (iter_->Valid() && iter_->value().empty()) {
+        LOG(ERROR) << "entry is broken: " << iter_->key();
+        iter_->Prev();
+      }
+    }
+
+    std::unique_ptr<SSTable::Iterator> iter_;
+  };
+
+  const string filename_;
+  SSTable::Options options_;
+  std::unique_ptr<SSTable> table_;
+  bool obsolete_;
+
+  DISALLOW_COPY_AND_ASSIGN(SortedTable);
+};
+
+// Writes entries from the first entry of |it| to |filename|. Deletions
+// are not written if |drop_deletions| is true. Returns the number of
+// written entries, or -1 on failure.
+int64 WriteSortedTable(const string &filename,
+                       const FilterPolicy *filter_policy,
+                       bool drop_deletions, EntryIterator *it) {
+  SSTableBuilder::Options options;
+  options.filter_policy = filter_policy;
+  SSTableBuilder builder(options, filename);
+  string buf;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    if (drop_deletions && it->type() == kTypeDeletion) {
+      continue;
+    }
+    buf.assign(1, static_cast<char>(it->type()));
+    buf.append(it->value().data(), it->value().size());
+    builder.Add(it->key(), buf);
+  }
+  if (!builder.Finish()) {
+    LOG(ERROR) << "cannot write " << filename;
+    return -1;
+  }
+  return static_cast<int64>(builder.num_entries());
+}
+
+template <typename T>
+void DeleteSharedPtr(void *arg) {
+  delete reinterpret_cast<std::shared_ptr<T> *>(arg);
+}
+
+// Pins |data| owned by |owner|.
+template <typename T>
+void PinShared(const std::shared_ptr<T> &owner, const StringPiece &data,
+               PinnedSlice *value) {
+  value->Pin(data, &DeleteSharedPtr<T>, new std::shared_ptr<T>(owner));
+}
+
+// Merges the iterators. If the same key is in multiple iterators, the
+// entry of the iterator which comes first in |children| is used.
+class MergingIterator : public EntryIterator {
+ public:
+  // Takes the ownership of |children|.
+  explicit MergingIterator(const std::vector<EntryIterator *> &children)
+      : children_(children), current_(NULL), direction_(kForward) {}
+
+  virtual ~MergingIterator() {
+    for (size_t i = 0; i < children_.size(); ++i) {
+      delete children_[i];
+    }
+  }
+
+  virtual bool Valid() const {
+    return current_ != NULL;
+  }
+
+  virtual void SeekToFirst() {
+    for (size_t i = 0; i < children_.size(); ++i) {
+      children_[i]->SeekToFirst();
+    }
+    direction_ = kForward;
+    FindSmallest();
+  }
+
+  virtual void SeekToLast() {
+    for (size_t i = 0; i < children_.size(); ++i) {
+      children_[i]->SeekToLast();
+    }
+    direction_ = kReverse;
+    FindLargest();
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    for (size_t i = 0; i < children_.size(); ++i) {
+      children_[i]->Seek(target);
+    }
+    direction_ = kForward;
+    FindSmallest();
+  }
+
+  virtual void Next() {
+    const string key = current_->key().as_string();
+    if (direction_ != kForward) {
+      // Positions all the children at or after |key|.
+      for (size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->Seek(key);
+      }
+      direction_ = kForward;
+    }
+    for (size_t i = 0; i < children_.size(); ++i) {
+      if (children_[i]->Valid() && children_[i]->key() == key) {
+        children_[i]->Next();
+      }
+    }
+    FindSmallest();
+  }
+
+  virtual void Prev() {
+    const string key = current_->key().as_string();
+    if (direction_ != kReverse) {
+      // Positions all the children before |key|.
+      for (size_t i = 0; i < children_.size(); ++i) {
+        children_[i]->Seek(key);
+        if (children_[i]->Valid()) {
+          children_[i]->Prev();
+        } else {
+          children_[i]->SeekToLast();
+        }
+      }
+      direction_ = kReverse;
+    } else {
+      for (size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->Valid() && children_[i]->key() == key) {
+          children_[i]->Prev();
+        }
+      }
+    }
+    FindLargest();
+  }
+
+  virtual StringPiece key() const {
+    return current_->key();
+  }
+
+  virtual StringPiece value() const {
+    return current_->value();
+  }
+
+  virtual ValueType type() const {
+    return current_->type();
+  }
+
+ private:
+  enum Direction {
+    kForward,
+    kReverse,
+  };
+
+  void FindSmallest() {
+    current_ = NULL;
+    for (size_t i = 0; i < children_.size(); ++i) {
+      if (children_[i]->Valid() &&
+          (current_ == NULL || children_[i]->key() < current_->key())) {
+        current_ = children_[i];
+      }
+    }
+  }
+
+  void FindLargest() {
+    current_ = NULL;
+    for (size_t i = 0; i < children_.size(); ++i) {
+      if (children_[i]->Valid() &&
+          (current_ == NULL || current_->key() < children_[i]->key())) {
+        current_ = children_[i];
+      }
+    }
+  }
+
+  std::vector<EntryIterator *> children_;
+  EntryIterator *current_;
+  Direction direction_;
+};
+
+class LSMStorageImpl : public StorageInterface {
+ public:
+  explicit LSMStorageImpl(const LSMStorage::Options &options);
+  virtual ~LSMStorageImpl();
+
+  virtual bool Open(const string &filename);
+  virtual bool Sync();
+  virtual bool Lookup(const string &key, string *value) const;
+  // The value is pinned by the reference to the memtable or the table.
+  virtual bool LookupPinned(const StringPiece &key, PinnedSlice *value) const;
+  virtual bool Insert(const string &key, const string &value);
+  virtual bool Erase(const string &key);
+  // Concurrent writers are merged into one group and applied by the
+  // writer at the front of the queue.
+  virtual bool Write(const WriteBatch &batch);
+  virtual bool Clear();
+  // This iterates all the entries.
+  virtual size_t Size() const;
+  // The iterator reads the snapshot at the creation, so the storage can be
+  // modified while it is alive.
+  virtual Iterator *NewIterator() const;
+
+ private:
+  struct Writer {
+    explicit Writer(const WriteBatch *b)
+        : batch(b), done(false), result(false) {}
+
+    // NULL for an exclusive operation like Sync(), which is not merged.
+    const WriteBatch *batch;
+    bool done;
+    bool result;
+    UnnamedEvent event;
+  };
+
+  class MemTableInserter : public WriteBatch::Handler {
+   public:
+    MemTableInserter(MemTable *mem, uint64 sequence)
+        : mem_(mem), sequence_(sequence) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      mem_->Add(sequence_++, kTypeValue, key, value);
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      mem_->Add(sequence_++, kTypeDeletion, key, "");
+    }
+
+   private:
+    MemTable *mem_;
+    uint64 sequence_;
+  };
+
+  struct TableInfo {
+    uint64 number;
+    size_t tier;
+    std::shared_ptr<SortedTable> table;
+  };
+
+  class SnapshotIterator;
+
+  class BackgroundThread : public Thread {
+   public:
+    explicit BackgroundThread(LSMStorageImpl *storage) : storage_(storage) {}
+    virtual void Run() {
+      storage_->BackgroundWork();
+    }
+
+   private:
+    LSMStorageImpl *storage_;
+  };
+
+  // Copies the current memtables and tables, and the last sequence
+  // visible to readers.
+  void GetSnapshot(std::shared_ptr<MemTable> *mem,
+                   std::shared_ptr<MemTable> *imm,
+                   std::vector<TableInfo> *tables,
+                   uint64 *sequence) const;
+
+  // The following methods require |mutex_|.
+  // Waits until |w| is at the front of |writers_| or is done by another
+  // writer. |mutex_| is released while waiting.
+  void EnterWriterQueue(Writer *w);
+  // Removes the writers from the front to |last_writer|, and wakes up them
+  // and the next writer.
+  void LeaveWriterQueue(Writer *leader, Writer *last_writer, bool result);
+  // Merges the batches of the waiting writers into |tmp_batch| if any.
+  const WriteBatch *BuildBatchGroup(Writer **last_writer,
+                                    WriteBatch *tmp_batch);
+  void MakeRoomForWrite();
+  MemTable *NewMemTable() const;
+  void MaybeScheduleBackgroundWork();
+  bool PickCompaction(size_t *begin, size_t *end) const;
+  bool WriteManifest();
+
+  void BackgroundWork();
+  bool FlushMemTable(const std::shared_ptr<MemTable> &imm, uint64 number);
+  bool Compact(const std::vector<TableInfo> &inputs, bool drop_deletions,
+               uint64 number);
+  void WaitForBackgroundWork();
+  bool OpenInternal(const string &filename);
+  bool ReadManifest();
+  string GetTableFileName(uint64 number) const;
+
+  const LSMStorage::Options options_;
+  std::unique_ptr<const FilterPolicy> filter_policy_;
+  // NULL if the block cache is disabled.
+  std::unique_ptr<Cache> block_cache_;
+  string dirname_;
+  mutable Mutex mutex_;
+  std::shared_ptr<MemTable> mem_;
+  std::shared_ptr<MemTable> imm_;
+  // Newer table comes first.
+  std::vector<TableInfo> tables_;
+  // Only the writer at the front inserts into |mem_|.
+  std::deque<Writer *> writers_;
+  uint64 next_file_number_;
+  // Entries newer than this are being inserted by a writer.
+  uint64 last_sequence_;
+  bool bg_scheduled_;
+  bool bg_error_;
+  // Notified when |imm_| is flushed, and when |bg_scheduled_| is cleared.
+  UnnamedEvent bg_done_event_;
+  BackgroundThread bg_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(LSMStorageImpl);
+};
+
+LSMStorageImpl::LSMStorageImpl(const LSMStorage::Options &options)
+    : options_(options),
+      filter_policy_(NewBloomFilterPolicy(options.bloom_bits_per_key)),
+      block_cache_(options.block_cache_size > 0 ?
+                   NewLRUCache(options.block_cache_size) : NULL),
+      mem_(NewMemTable()),
+      next_file_number_(1),
+      last_sequence_(0),
+      bg_scheduled_(false),
+      bg_error_(false),
+      bg_thread_(this) {}
+
+LSMStorageImpl::~LSMStorageImpl() {
+  if (!dirname_.empty()) {
+    Sync();
+  }
+  WaitForBackgroundWork();
+  bg_thread_.Join();
+}
+
+bool LSMStorageImpl::Open(const string &filename) {
+  Writer w(NULL);
+  mutex_.Lock();
+  EnterWriterQueue(&w);
+  mutex_.Unlock();
+  WaitForBackgroundWork();
+  mutex_.Lock();
+  const bool result = OpenInternal(filename);
+  LeaveWriterQueue(&w, &w, result);
+  mutex_.Unlock();
+  return result;
+}
+
+bool LSMStorageImpl::OpenInternal(const string &filename) {
+  dirname_ = filename;
+  mem_.reset(NewMemTable());
+  imm_.reset();
+  tables_.clear();
+  next_file_number_ = 1;
+  bg_error_ = false;
+  if (!FileUtil::DirectoryExists(dirname_) &&
+      !FileUtil::CreateDirectory(dirname_)) {
+    LOG(ERROR) << "cannot create " << dirname_;
+    dirname_.clear();
+    return false;
+  }
+  if (!ReadManifest()) {
+    tables_.clear();
+    dirname_.clear();
+    return false;
+  }
+  return true;
+}
+
+// Format of the manifest:
+// |magic(uint32 kManifestMagicId)|version(uint32)|next_file_number(uint64)|
+// |num_tables(uint32)|number(uint64)|tier(uint32)|...
+bool LSMStorageImpl::ReadManifest() {
+  const string filename = FileUtil::JoinPath(dirname_, kManifestFileName);
+  Mmap mmap;
+  if (!mmap.Open(filename.c_str(), "r")) {
+    // It happens mostly when the storage is new.
+    VLOG(1) << "cannot open:" << filename;
+    return true;
+  }
+
+  StringPiece input(mmap.begin(), mmap.size());
+  if (input.size() < 20 || DecodeFixed32(input.data()) != kManifestMagicId ||
+      DecodeFixed32(input.data() + 4) != kManifestVersion) {
+    LOG(ERROR) << "manifest is broken";
+    return false;
+  }
+  next_file_number_ = DecodeFixed64(input.data() + 8);
+  const uint32 num_tables = DecodeFixed32(input.data() + 16);
+  input.remove_prefix(20);
+  if (input.size() != num_tables * 12) {
+    LOG(ERROR) << "manifest is broken";
+    return false;
+  }
+
+  for (uint32 i = 0; i < num_tables; ++i) {
+    TableInfo info;
+    info.number = DecodeFixed64(input.data() + i * 12);
+    info.tier = DecodeFixed32(input.data() + i * 12 + 8);
+    info.table.reset(new SortedTable(GetTableFileName(info.number),
+                                     filter_policy_.get(),
+                                     block_cache_.get()));
+    if (!info.table->Open()) {
+      return false;
+    }
+    tables_.push_back(info);
+  }
+  return true;
+}
+
+bool LSMStorageImpl::WriteManifest() {
+  string output;
+  PutFixed32(&output, kManifestMagicId);
+  PutFixed32(&output, kManifestVersion);
+  PutFixed64(&output, next_file_number_);
+  PutFixed32(&output, static_cast<uint32>(tables_.size()));
+  for (size_t i = 0; i < tables_.size(); ++i) {
+    PutFixed64(&output, tables_[i].number);
+    PutFixed32(&output, static_cast<uint32>(tables_[i].tier));
+  }
+
+  const string filename = FileUtil::JoinPath(dirname_, kManifestFileName);
+  const string output_filename = filename + ".tmp";
+  {
+    OutputFileStream ofs(output_filename.c_str(), ios::binary | ios::out);
+    if (!ofs) {
+      LOG(ERROR) << "cannot open " << output_filename;
+      return false;
+    }
+    ofs.write(output.data(), output.size());
+  }
+  if (!FileUtil::AtomicRename(output_filename, filename)) {
+    LOG(ERROR) << "AtomicRename failed";
+    return false;
+  }
+  return true;
+}
+
+string LSMStorageImpl::GetTableFileName(uint64 number) const {
+  return FileUtil::JoinPath(
+      dirname_, Util::StringPrintf("%06llu.sst",
+                                   static_cast<unsigned long long>(number)));
+}
+
+void LSMStorageImpl::GetSnapshot(std::shared_ptr<MemTable> *mem,
+                                 std::shared_ptr<MemTable> *imm,
+                                 std::vector<TableInfo> *tables,
+                                 uint64 *sequence) const {
+  scoped_lock l(&mutex_);
+  *mem = mem_;
+  *imm = imm_;
+  *tables = tables_;
+  *sequence = last_sequence_;
+}
+
+bool LSMStorageImpl::Lookup(const string &key, string *value) const {
+  PinnedSlice pinned;
+  if (!LookupPinned(key, &pinned)) {
+    return false;
+  }
+  value->assign(pinned.data().data(), pinned.size());
+  return true;
+}
+
+bool LSMStorageImpl::LookupPinned(const StringPiece &key,
+                                  PinnedSlice *value) const {
+  std::shared_ptr<MemTable> mem, imm;
+  std::vector<TableInfo> tables;
+  uint64 sequence = 0;
+  GetSnapshot(&mem, &imm, &tables, &sequence);
+  value->Reset();
+
+  // The memtable is read without the lock, as the skip list allows
+  // concurrent readers with a single writer. A batch being inserted is
+  // not visible until it is completed.
+  StringPiece data;
+  ValueType type = kTypeValue;
+  if (mem->Get(key, sequence, &data, &type)) {
+    PinShared(mem, data, value);
+  } else if (imm.get() != NULL && imm->Get(key, sequence, &data, &type)) {
+    PinShared(imm, data, value);
+  } else {
+    size_t i = 0;
+    while (i < tables.size() && !tables[i].table->Get(key, &data, &type)) {
+      ++i;
+    }
+    if (i == tables.size()) {
+      return false;
+    }
+    PinShared(tables[i].table, data, value);
+  }
+  if (type != kTypeValue) {
+    value->Reset();
+    return false;
+  }
+  return true;
+}
+
+bool LSMStorageImpl::Insert(const string &key, const string &value) {
+  WriteBatch batch;
+  batch.Insert(key, value);
+  return Write(batch);
+}
+
+bool LSMStorageImpl::Erase(const string &key) {
+  PinnedSlice value;
+  if (!LookupPinned(key, &value)) {
+    VLOG(2) << "cannot erase key: " << key;
+    return false;
+  }
+  WriteBatch batch;
+  batch.Erase(key);
+  return Write(batch);
+}
+
+bool LSMStorageImpl::Write(const WriteBatch &batch) {
+  Writer w(&batch);
+  mutex_.Lock();
+  EnterWriterQueue(&w);
+  if (w.done) {
+    mutex_.Unlock();
+    return w.result;
+  }
+
+  // This writer is the leader of the group.
+  MakeRoomForWrite();
+  Writer *last_writer = &w;
+  WriteBatch tmp_batch;
+  const WriteBatch *group = BuildBatchGroup(&last_writer, &tmp_batch);
+  const std::shared_ptr<MemTable> mem = mem_;
+  const uint64 sequence = last_sequence_ + 1;
+  mutex_.Unlock();
+
+  // The other writers are waiting in the queue, so the memtable is
+  // updated without the lock.
+  MemTableInserter inserter(mem.get(), sequence);
+  const bool result = group->Iterate(&inserter);
+
+  mutex_.Lock();
+  // Makes the group visible to readers at once.
+  last_sequence_ += group->Count();
+  LeaveWriterQueue(&w, last_writer, result);
+  mutex_.Unlock();
+  return result;
+}
+
+void LSMStorageImpl::EnterWriterQueue(Writer *w) {
+  writers_.push_back(w);
+  while (!w->done && w != writers_.front()) {
+    mutex_.Unlock();
+    w->event.Wait(-1);
+    mutex_.Lock();
+  }
+}
+
+void LSMStorageImpl::LeaveWriterQueue(Writer *leader, Writer *last_writer,
+                                      bool result) {
+  while (true) {
+    Writer *ready = writers_.front();
+    writers_.pop_front();
+    if (ready != leader) {
+      ready->result = result;
+      ready->done = true;
+      ready->event.Notify();
+    }
+    if (ready == last_writer) {
+      break;
+    }
+  }
+  if (!writers_.empty()) {
+    writers_.front()->event.Notify();
+  }
+}
+
+const WriteBatch *LSMStorageImpl::BuildBatchGroup(Writer **last_writer,
+                                                  WriteBatch *tmp_batch) {
+  Writer *first = writers_.front();
+  const WriteBatch *result = first->batch;
+  size_t size = first->batch->contents().size();
+  *last_writer = first;
+  for (std::deque<Writer *>::const_iterator it = writers_.begin() + 1;
+       it != writers_.end(); ++it) {
+    const Writer *w = *it;
+    if (w->batch == NULL) {
+      break;
+    }
+    size += w->batch->contents().size();
+    if (size > kMaxBatchGroupSize) {
+      break;
+    }
+    if (result == first->batch) {
+      tmp_batch->Append(*first->batch);
+      result = tmp_batch;
+    }
+    tmp_batch->Append(*w->batch);
+    *last_writer = *it;
+  }
+  return result;
+}
+
+MemTable *LSMStorageImpl::NewMemTable() const {
+  ArenaOptions arena_options;
+  // Let the blocks grow with the memtable, so that a large memtable is
+  // made of a few large blocks instead of thousands of small ones.
+  arena_options.max_block_size =
+      std::max(arena_options.block_size, options_.write_buffer_size / 8);
+  arena_options.use_huge_pages = options_.use_huge_pages;
+  return new MemTable(arena_options);
+}
+
+void LSMStorageImpl::MakeRoomForWrite() {
+  while (mem_->ApproximateMemoryUsage() >= options_.write_buffer_size &&
+         !dirname_.empty()) {
+    if (imm_.get() == NULL) {
+      imm_.swap(mem_);
+      mem_.reset(NewMemTable());
+      MaybeScheduleBackgroundWork();
+      return;
+    }
+    if (bg_error_) {
+      // The flush does not progress until Sync() retries it.
+      return;
+    }
+    // Stalls until the previous memtable is flushed, so that a slow disk
+    // does not let the memtables grow without bound.  Only the writer at
+    // the front of |writers_| gets here.
+    MaybeScheduleBackgroundWork();
+    mutex_.Unlock();
+    bg_done_event_.Wait(-1);
+    mutex_.Lock();
+  }
+}
+
+// Merges the memtables and the tables of a snapshot, and skips deletions.
+class LSMStorageImpl::SnapshotIterator : public StorageInterface::Iterator {
+ public:
+  explicit SnapshotIterator(const LSMStorageImpl *storage) {
+    uint64 sequence = 0;
+    storage->GetSnapshot(&mem_, &imm_, &tables_, &sequence);
+    std::vector<EntryIterator *> children;
+    children.push_back(mem_->NewIterator(sequence));
+    if (imm_.get() != NULL) {
+      children.push_back(imm_->NewIterator(sequence));
+    }
+    for (size_t i = 0; i < tables_.size(); ++i) {
+      children.push_back(tables_[i].table->NewIterator());
+    }
+    iter_.reset(new MergingIterator(children));
+  }
+
+  virtual bool Valid() const {
+    return iter_->Valid();
+  }
+
+  virtual void SeekToFirst() {
+    iter_->SeekToFirst();
+    SkipDeletions();
+  }
+
+  virtual void SeekToLast() {
+    iter_->SeekToLast();
+    SkipDeletionsBackward();
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    iter_->Seek(target);
+    SkipDeletions();
+  }
+
+  virtual void Next() {
+    iter_->Next();
+    SkipDeletions();
+  }
+
+  virtual void Prev() {
+    iter_->Prev();
+    SkipDeletionsBackward();
+  }
+
+  virtual StringPiece key() const {
+    return iter_->key();
+  }
+
+  virtual StringPiece value() const {
+    return iter_->value();
+  }
+
+ private:
+  void SkipDeletions() {
+    while (iter_->Valid() && iter_->type() == kTypeDeletion) {
+      iter_->Next();
+    }
+  }
+
+  void SkipDeletionsBackward() {
+    while (iter_->Valid() && iter_->type() == kTypeDeletion) {
+      iter_->Prev();
+    }
+  }
+
+  // Keep the snapshot alive.
+  std::shared_ptr<MemTable> mem_;
+  std::shared_ptr<MemTable> imm_;
+  std::vector<TableInfo> tables_;
+  std::unique_ptr<MergingIterator> iter_;
+};
+
+StorageInterface::Iterator *LSMStorageImpl::NewIterator() const {
+  return new SnapshotIterator(this);
+}
+
+size_t LSMStorageImpl::Size() const {
+  size_t size = 0;
+  SnapshotIterator it(this);
+  for (it.SeekToFirst(); it.Valid(); it.Next()) {
+    ++size;
+  }
+  return size;
+}
+
+bool LSMStorageImpl::Sync() {
+  // Sync() swaps the memtable, so it waits for the preceding writers.
+  Writer w(NULL);
+  mutex_.Lock();
+  EnterWriterQueue(&w);
+  bool result = false;
+  if (!dirname_.empty()) {
+    bg_error_ = false;
+    while (!bg_error_) {
+      if (mem_->empty() && imm_.get() == NULL) {
+        result = WriteManifest();
+        break;
+      }
+      if (imm_.get() == NULL) {
+        imm_.swap(mem_);
+        mem_.reset(NewMemTable());
+      }
+      MaybeScheduleBackgroundWork();
+      mutex_.Unlock();
+      WaitForBackgroundWork();
+      mutex_.Lock();
+    }
+  }
+  LeaveWriterQueue(&w, &w, result);
+  mutex_.Unlock();
+  return result;
+}
+
+bool LSMStorageImpl::Clear() {
+  Writer w(NULL);
+  mutex_.Lock();
+  EnterWriterQueue(&w);
+  mutex_.Unlock();
+  WaitForBackgroundWork();
+  mutex_.Lock();
+  std::vector<TableInfo> tables;
+  tables.swap(tables_);
+  const bool result = dirname_.empty() || WriteManifest();
+  if (result) {
+    // The files are removed only after the manifest stops listing them.
+    for (size_t i = 0; i < tables.size(); ++i) {
+      tables[i].table->MarkObsolete();
+    }
+    mem_.reset(NewMemTable());
+    imm_.reset();
+  } else {
+    tables_.swap(tables);
+  }
+  LeaveWriterQueue(&w, &w, result);
+  mutex_.Unlock();
+  return result;
+}
+
+void LSMStorageImpl::MaybeScheduleBackgroundWork() {
+  if (bg_scheduled_ || bg_error_ || dirname_.empty()) {
+    return;
+  }
+  size_t begin = 0, end = 0;
+  if (imm_.get() == NULL && !PickCompaction(&begin, &end)) {
+    return;
+  }
+  bg_scheduled_ = true;
+  // The previous thread has finished or is about to finish.
+  bg_thread_.Join();
+  bg_thread_.Start("LSMStorage");
+}
+
+bool LSMStorageImpl::PickCompaction(size_t *begin, size_t *end) const {
+  // The tiers of |tables_| are in ascending order.
+  for (size_t i = 0; i < tables_.size(); ) {
+    size_t j = i;
+    while (j < tables_.size() && tables_[j].tier == tables_[i].tier) {
+      ++j;
+    }
+    if (j - i >= options_.compaction_trigger) {
+      *begin = i;
+      *end = j;
+      return true;
+    }
+    i = j;
+  }
+  return false;
+}
+
+void LSMStorageImpl::BackgroundWork() {
+  while (true) {
+    std::shared_ptr<MemTable> imm;
+    std::vector<TableInfo> inputs;
+    bool drop_deletions = false;
+    uint64 number = 0;
+    {
+      scoped_lock l(&mutex_);
+      size_t begin = 0, end = 0;
+      if (imm_.get() != NULL) {
+        imm = imm_;
+      } else if (PickCompaction(&begin, &end)) {
+        inputs.assign(tables_.begin() + begin, tables_.begin() + end);
+        drop_deletions = (end == tables_.size());
+      } else {
+        bg_scheduled_ = false;
+        bg_done_event_.Notify();
+        return;
+      }
+      number = next_file_number_++;
+    }
+
+    const bool result = (imm.get() != NULL) ?
+        FlushMemTable(imm, number) : Compact(inputs, drop_deletions, number);
+    if (!result) {
+      scoped_lock l(&mutex_);
+      bg_error_ = true;
+      bg_scheduled_ = false;
+      bg_done_event_.Notify();
+      return;
+    }
+    if (imm.get() != NULL) {
+      // Wakes up the writer waiting in MakeRoomForWrite().
+      bg_done_event_.Notify();
+    }
+  }
+}
+
+bool LSMStorageImpl::FlushMemTable(const std::shared_ptr<MemTable> &imm,
+                                   uint64 number) {
+  bool drop_deletions = false;
+  {
+    scoped_lock l(&mutex_);
+    drop_deletions = tables_.empty();
+  }
+  const string filename = GetTableFileName(number);
+  std::unique_ptr<EntryIterator> it(imm->NewIterator(kMaxSequenceNumber));
+  const int64 num_entries = WriteSortedTable(
+      filename, filter_policy_.get(), drop_deletions, it.get());
+  if (num_entries < 0) {
+    return false;
+  }
+
+  TableInfo info;
+  info.number = number;
+  info.tier = 0;
+  info.table.reset(new SortedTable(filename, filter_policy_.get(),
+                                   block_cache_.get()));
+  if (!info.table->Open()) {
+    info.table->MarkObsolete();
+    return false;
+  }
+
+  scoped_lock l(&mutex_);
+  if (num_entries > 0) {
+    tables_.insert(tables_.begin(), info);
+  } else {
+    info.table->MarkObsolete();
+  }
+  if (imm_ == imm) {
+    imm_.reset();
+  }
+  return WriteManifest();
+}
+
+bool LSMStorageImpl::Compact(const std::vector<TableInfo> &inputs,
+                             bool drop_deletions, uint64 number) {
+  std::vector<EntryIterator *> children;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    children.push_back(inputs[i].table->NewIterator());
+  }
+  const string filename = GetTableFileName(number);
+  MergingIterator it(children);
+  const int64 num_entries = WriteSortedTable(
+      filename, filter_policy_.get(), drop_deletions, &it);
+  if (num_entries < 0) {
+    return false;
+  }
+
+  TableInfo info;
+  info.number = number;
+  info.tier = inputs.back().tier + 1;
+  info.table.reset(new SortedTable(filename, filter_policy_.get(),
+                                   block_cache_.get()));
+  if (!info.table->Open()) {
+    info.table->MarkObsolete();
+    return false;
+  }
+
+  scoped_lock l(&mutex_);
+  // Only the background work removes tables except Clear(), which may
+  // have removed the inputs.
+  size_t begin = 0;
+  while (begin < tables_.size() &&
+         tables_[begin].number != inputs.front().number) {
+    ++begin;
+  }
+  if (begin + inputs.size() > tables_.size() ||
+      tables_[begin + inputs.size() - 1].number != inputs.back().number) {
+    info.table->MarkObsolete();
+    return true;
+  }
+  const std::vector<TableInfo> old_tables = tables_;
+  tables_.erase(tables_.begin() + begin,
+                tables_.begin() + begin + inputs.size());
+  if (num_entries > 0) {
+    tables_.insert(tables_.begin() + begin, info);
+  } else {
+    info.table->MarkObsolete();
+  }
+  if (!WriteManifest()) {
+    // Keeps the inputs, which the manifest on disk still lists.
+    tables_ = old_tables;
+    info.table->MarkObsolete();
+    return false;
+  }
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    inputs[i].table->MarkObsolete();
+  }
+  return true;
+}
+
+void LSMStorageImpl::WaitForBackgroundWork() {
+  while (true) {
+    {
+      scoped_lock l(&mutex_);
+      if (!bg_scheduled_) {
+        break;
+      }
+    }
+    // The notification is kept until a waiter consumes it, so it is not
+    // lost when the work finishes before Wait() is called.
+    bg_done_event_.Wait(-1);
+  }
+  // Passes the notification on to another waiter if any.  A stale one
+  // only makes the next waiter check |bg_scheduled_| again.
+  bg_done_event_.Notify();
+}
+
+}  // namespace
+
+LSMStorage::Options::Options()
+    : write_buffer_size(kDefaultWriteBufferSize),
+      compaction_trigger(kDefaultCompactionTrigger),
+      bloom_bits_per_key(kDefaultBloomBitsPerKey),
+      block_cache_size(kDefaultBlockCacheSize),
+      use_huge_pages(false) {}
+
+StorageInterface *LSMStorage::New() {
+  return New(Options());
+}
+
+StorageInterface *LSMStorage::New(const Options &options) {
+  return new LSMStorageImpl(options);
+}
+
+StorageInterface *LSMStorage::Create(const char *dirname) {
+  std::unique_ptr<StorageInterface> storage(New());
+  if (!storage->Open(dirname)) {
+    LOG(ERROR) << "cannot open " << dirname;
+    return NULL;
+  }
+  return storage.release();
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,91 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_LSM_STORAGE_H_
+#define GBASE_STORAGE_LSM_STORAGE_H_
+
+#include "base/port.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+
+// Log-structured merge storage for large data.
+// Insert/Erase go to an in-memory skip list (memtable). When the memtable
+// becomes large, it is flushed to an immutable SSTable file with
+// bloom filters in background, and the tables are merged by a background
+// compaction. |filename| passed to Open() is used as a directory.
+// Like other implementations, the data is persistent only after Sync().
+// Operations are thread-safe, and NewIterator() iterates a snapshot, so
+// the storage can be modified while iterating.
+class LSMStorage {
+ public:
+  struct Options {
+    Options();
+
+    // Size of the memtable before it is flushed to a table file.  When the
+    // memtable is full while the previous one is still being flushed, the
+    // writers wait for the flush, so that the memory usage stays within
+    // about twice this size.
+    size_t write_buffer_size;
+
+    // Tables are grouped by tier. Flushed tables are in tier 0, and
+    // this number of tables in a tier are merged into one table of the
+    // next tier.
+    size_t compaction_trigger;
+
+    // Bits per key of the bloom filter of each table.
+    int bloom_bits_per_key;
+
+    // Capacity of the cache of the verified table blocks shared by all the
+    // tables, in bytes of the cache entries.  The contents of the blocks
+    // are read from the mapped files and not charged.  0 disables the
+    // cache.
+    size_t block_cache_size;
+
+    // Backs the memtable with transparent huge pages where available.
+    // See ArenaOptions::use_huge_pages.
+    bool use_huge_pages;
+  };
+
+  // Returns an implementatoin of StorageInterface.
+  // Caller must take ownership of the returned object.
+  // Returns NULL if fails.
+  static StorageInterface *New();
+  static StorageInterface *New(const Options &options);
+  static StorageInterface *Create(const char *dirname);
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(LSMStorage);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_LSM_STORAGE_H_
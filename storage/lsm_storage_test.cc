@@ -0,0 +1,374 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/lsm_storage.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/file_util.h"
+#include "base/flags.h"
+#include "base/number_util.h"
+#include "base/port.h"
+#include "base/thread.h"
+#include "base/util.h"
+#include "storage/pinned_slice.h"
+#include "storage/storage_interface.h"
+#include "storage/write_batch.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+DEFINE_string(test_tmpdir, "/tmp/", "tmp file");
+
+const int kNumBatches = 500;
+
+// Inserts "<id>_a" and "<id>_b" with the same value by a batch.
+class WriterThread : public Thread {
+ public:
+  WriterThread(StorageInterface *storage, int id)
+      : storage_(storage), id_(id), failed_(false) {}
+
+  virtual void Run() {
+    const string prefix = Util::StringPrintf("%d_", id_);
+    for (int i = 1; i <= kNumBatches; ++i) {
+      WriteBatch batch;
+      batch.Insert(prefix + "a", NumberUtil::SimpleItoa(i));
+      batch.Insert(prefix + "b", NumberUtil::SimpleItoa(i));
+      if (!storage_->Write(batch)) {
+        failed_ = true;
+      }
+    }
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+ private:
+  StorageInterface *storage_;
+  const int id_;
+  bool failed_;
+};
+
+// Checks that the batches are visible atomically, i.e. "<id>_a" read after
+// "<id>_b" is never older.
+class ReaderThread : public Thread {
+ public:
+  ReaderThread(StorageInterface *storage, int id)
+      : storage_(storage), id_(id), failed_(false) {}
+
+  virtual void Run() {
+    const string prefix = Util::StringPrintf("%d_", id_);
+    string value;
+    int b = 0;
+    while (b < kNumBatches) {
+      b = storage_->Lookup(prefix + "b", &value) ?
+          NumberUtil::SimpleAtoi(value) : 0;
+      const int a = storage_->Lookup(prefix + "a", &value) ?
+          NumberUtil::SimpleAtoi(value) : 0;
+      if (a < b) {
+        failed_ = true;
+      }
+    }
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+ private:
+  StorageInterface *storage_;
+  const int id_;
+  bool failed_;
+};
+
+}  // namespace
+
+class LSMStorageTest : public testing::Test {
+ protected:
+  LSMStorageTest() {}
+
+  virtual void SetUp() {
+    RemoveDBDirectory();
+  }
+
+  virtual void TearDown() {
+    RemoveDBDirectory();
+  }
+
+  // Removes the tables by Clear() and then the directory.
+  static void RemoveDBDirectory() {
+    const string dirname = GetTemporaryDirectory();
+    if (!FileUtil::DirectoryExists(dirname)) {
+      return;
+    }
+    {
+      std::unique_ptr<StorageInterface> storage(
+          LSMStorage::Create(dirname.c_str()));
+      if (storage.get() != NULL) {
+        storage->Clear();
+      }
+    }
+    FileUtil::Unlink(FileUtil::JoinPath(dirname, "MANIFEST"));
+    FileUtil::RemoveDirectory(dirname);
+  }
+
+  static StorageInterface *CreateStorage() {
+    LSMStorage::Options options;
+    // Makes many tables and compactions.
+    options.write_buffer_size = 4096;
+    options.compaction_trigger = 2;
+    return LSMStorage::New(options);
+  }
+
+  static string GetTemporaryDirectory() {
+    // This name should be unique to each test.
+    return FileUtil::JoinPath(FLAGS_test_tmpdir, "LSMStorageTest_test.db");
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LSMStorageTest);
+};
+
+TEST_F(LSMStorageTest, LSMStorageTest) {
+  const string dirname = GetTemporaryDirectory();
+  const int kSize = 3000;
+
+  std::map<string, string> target;
+  {
+    std::unique_ptr<StorageInterface> storage(CreateStorage());
+    EXPECT_TRUE(storage->Open(dirname));
+    for (int i = 0; i < kSize; ++i) {
+      const string key = Util::StringPrintf("key%d", i);
+      const string value = Util::StringPrintf("value%d", i);
+      EXPECT_TRUE(storage->Insert(key, value));
+      target[key] = value;
+    }
+    // Overwrites and erases some keys.
+    for (int i = 0; i < kSize; i += 3) {
+      const string key = Util::StringPrintf("key%d", i);
+      EXPECT_TRUE(storage->Insert(key, "new"));
+      target[key] = "new";
+    }
+    for (int i = 1; i < kSize; i += 3) {
+      const string key = Util::StringPrintf("key%d", i);
+      EXPECT_TRUE(storage->Erase(key));
+      EXPECT_FALSE(storage->Erase(key));
+      target.erase(key);
+    }
+
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      string value;
+      EXPECT_TRUE(storage->Lookup(it->first, &value));
+      EXPECT_EQ(it->second, value);
+    }
+    string value;
+    EXPECT_FALSE(storage->Lookup("key1", &value));
+    EXPECT_FALSE(storage->Lookup("dummy", &value));
+    EXPECT_EQ(target.size(), storage->Size());
+    EXPECT_TRUE(storage->Sync());
+  }
+
+  // Reopens.
+  {
+    std::unique_ptr<StorageInterface> storage(CreateStorage());
+    EXPECT_TRUE(storage->Open(dirname));
+    EXPECT_EQ(target.size(), storage->Size());
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      string value;
+      EXPECT_TRUE(storage->Lookup(it->first, &value));
+      EXPECT_EQ(it->second, value);
+    }
+    string value;
+    EXPECT_FALSE(storage->Lookup("key1", &value));
+
+    EXPECT_TRUE(storage->Clear());
+    EXPECT_EQ(0, storage->Size());
+    EXPECT_FALSE(storage->Lookup("key0", &value));
+  }
+
+  {
+    std::unique_ptr<StorageInterface> storage(CreateStorage());
+    EXPECT_TRUE(storage->Open(dirname));
+    EXPECT_EQ(0, storage->Size());
+  }
+}
+
+TEST_F(LSMStorageTest, IteratorTest) {
+  std::unique_ptr<StorageInterface> storage(CreateStorage());
+  EXPECT_TRUE(storage->Open(GetTemporaryDirectory()));
+
+  // Makes the entries spread over the memtable and the tables.
+  std::map<string, string> target;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = round; i < 1000; i += 2) {
+      const string key = Util::StringPrintf("key%04d", i);
+      if (round == 2 && i % 3 == 0) {
+        EXPECT_TRUE(storage->Erase(key));
+        target.erase(key);
+      } else {
+        const string value = Util::StringPrintf("value%d_%d", i, round);
+        EXPECT_TRUE(storage->Insert(key, value));
+        target[key] = value;
+      }
+    }
+    if (round == 0) {
+      EXPECT_TRUE(storage->Sync());
+    }
+  }
+
+  std::unique_ptr<StorageInterface::Iterator> iter(storage->NewIterator());
+  ASSERT_TRUE(iter.get() != NULL);
+  std::map<string, string>::const_iterator expected = target.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+    ASSERT_TRUE(expected != target.end());
+    EXPECT_EQ(expected->first, iter->key().as_string());
+    EXPECT_EQ(expected->second, iter->value().as_string());
+  }
+  EXPECT_TRUE(expected == target.end());
+
+  std::map<string, string>::const_reverse_iterator rexpected =
+      target.rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+    ASSERT_TRUE(rexpected != target.rend());
+    EXPECT_EQ(rexpected->first, iter->key().as_string());
+    EXPECT_EQ(rexpected->second, iter->value().as_string());
+  }
+  EXPECT_TRUE(rexpected == target.rend());
+
+  // Changes the direction in the middle.
+  iter->Seek("key0500");
+  expected = target.lower_bound("key0500");
+  for (int i = 0; i < 10; ++i) {
+    iter->Next();
+    ++expected;
+  }
+  for (int i = 0; i < 20; ++i) {
+    iter->Prev();
+    --expected;
+  }
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ(expected->first, iter->key().as_string());
+  iter->Next();
+  ++expected;
+  EXPECT_EQ(expected->first, iter->key().as_string());
+
+  // The iterator reads the snapshot.
+  EXPECT_TRUE(storage->Insert("key0000_new", "new"));
+  EXPECT_TRUE(storage->Erase("key0001"));
+  iter->Seek("key0000");
+  ASSERT_TRUE(iter->Valid());
+  iter->Next();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("key0001", iter->key().as_string());
+
+  iter.reset(storage->NewPrefixIterator("key012"));
+  int num_keys = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    EXPECT_TRUE(iter->key().starts_with("key012"));
+    ++num_keys;
+  }
+  EXPECT_EQ(8, num_keys);
+}
+
+TEST_F(LSMStorageTest, LookupPinnedTest) {
+  std::unique_ptr<StorageInterface> storage(CreateStorage());
+  EXPECT_TRUE(storage->Open(GetTemporaryDirectory()));
+  const string large_value(10000, 'a');
+  EXPECT_TRUE(storage->Insert("mem", "value"));
+  EXPECT_TRUE(storage->Insert("table", large_value));
+  EXPECT_TRUE(storage->Insert("erased", "value"));
+  EXPECT_TRUE(storage->Sync());
+  EXPECT_TRUE(storage->Erase("erased"));
+  EXPECT_TRUE(storage->Insert("mem", "value"));
+
+  PinnedSlice mem_value, table_value, value;
+  EXPECT_TRUE(storage->LookupPinned("mem", &mem_value));
+  EXPECT_EQ("value", mem_value.ToString());
+  EXPECT_TRUE(storage->LookupPinned("table", &table_value));
+  EXPECT_EQ(large_value, table_value.ToString());
+  EXPECT_FALSE(storage->LookupPinned("erased", &value));
+  EXPECT_EQ(0, value.size());
+  EXPECT_FALSE(storage->LookupPinned("dummy", &value));
+
+  // The pinned values are alive after the memtable and the table are
+  // replaced.
+  EXPECT_TRUE(storage->Insert("mem", "new"));
+  EXPECT_TRUE(storage->Insert("table", "new"));
+  EXPECT_TRUE(storage->Clear());
+  EXPECT_EQ("value", mem_value.ToString());
+  EXPECT_EQ(large_value, table_value.ToString());
+}
+
+TEST_F(LSMStorageTest, ConcurrentWriteTest) {
+  const int kNumThreads = 4;
+  std::unique_ptr<StorageInterface> storage(CreateStorage());
+  EXPECT_TRUE(storage->Open(GetTemporaryDirectory()));
+
+  std::vector<std::unique_ptr<WriterThread>> writers;
+  std::vector<std::unique_ptr<ReaderThread>> readers;
+  for (int i = 0; i < kNumThreads; ++i) {
+    writers.emplace_back(new WriterThread(storage.get(), i));
+    readers.emplace_back(new ReaderThread(storage.get(), i));
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    writers[i]->Start("ConcurrentWriteTest");
+    readers[i]->Start("ConcurrentWriteTest");
+  }
+  // Sync() is serialized with the writers.
+  EXPECT_TRUE(storage->Sync());
+  for (int i = 0; i < kNumThreads; ++i) {
+    writers[i]->Join();
+    readers[i]->Join();
+    EXPECT_FALSE(writers[i]->failed());
+    EXPECT_FALSE(readers[i]->failed());
+  }
+
+  EXPECT_EQ(kNumThreads * 2, storage->Size());
+  EXPECT_TRUE(storage->Sync());
+  storage.reset(CreateStorage());
+  EXPECT_TRUE(storage->Open(GetTemporaryDirectory()));
+  for (int i = 0; i < kNumThreads; ++i) {
+    string value;
+    EXPECT_TRUE(storage->Lookup(Util::StringPrintf("%d_a", i), &value));
+    EXPECT_EQ(NumberUtil::SimpleItoa(kNumBatches), value);
+    EXPECT_TRUE(storage->Lookup(Util::StringPrintf("%d_b", i), &value));
+    EXPECT_EQ(NumberUtil::SimpleItoa(kNumBatches), value);
+  }
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,99 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_MAP_ITERATOR_H_
+#define GBASE_STORAGE_MAP_ITERATOR_H_
+
+#include <map>
+#include <string>
+
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+
+// StorageInterface::Iterator for storages backed by std::map.
+// The map must not be modified while the iterator is alive.
+class MapIterator : public StorageInterface::Iterator {
+ public:
+  explicit MapIterator(const std::map<string, string> *map)
+      : map_(map), it_(map->end()) {}
+
+  virtual bool Valid() const {
+    return it_ != map_->end();
+  }
+
+  virtual void SeekToFirst() {
+    it_ = map_->begin();
+  }
+
+  virtual void SeekToLast() {
+    it_ = map_->end();
+    if (!map_->empty()) {
+      --it_;
+    }
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    it_ = map_->lower_bound(target.as_string());
+  }
+
+  virtual void Next() {
+    ++it_;
+  }
+
+  virtual void Prev() {
+    if (it_ == map_->begin()) {
+      it_ = map_->end();
+    } else {
+      --it_;
+    }
+  }
+
+  virtual StringPiece key() const {
+    return it_->first;
+  }
+
+  virtual StringPiece value() const {
+    return it_->second;
+  }
+
+ private:
+  const std::map<string, string> *map_;
+  std::map<string, string>::const_iterator it_;
+
+  DISALLOW_COPY_AND_ASSIGN(MapIterator);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_MAP_ITERATOR_H_
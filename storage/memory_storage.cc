@@ -29,10 +29,25 @@
 
 #include "storage/memory_storage.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
+#include "base/arena.h"
+#include "base/coding.h"
+#include "base/hash.h"
 #include "base/logging.h"
+#include "base/mutex.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/map_iterator.h"
+#include "storage/memtable.h"
+#include "storage/write_batch.h"
 
 namespace gbase {
 namespace storage {
@@ -83,6 +98,10 @@ class MemoryStorageImpl : public storage::StorageInterface {
     return data_.size();
   }
 
+  virtual Iterator *NewIterator() const {
+    return new MapIterator(&data_);
+  }
+
   MemoryStorageImpl() {}
   virtual ~MemoryStorageImpl() {}
 
@@ -90,11 +109,684 @@ class MemoryStorageImpl : public storage::StorageInterface {
   std::map<string, string> data_;
 };
 
+const size_t kDefaultNumShards = 16;
+// Must be a power of 2.
+const size_t kMinShardCapacity = 16;
+// The arena is compacted when the garbage exceeds both the live data and
+// this size.
+const size_t kMinArenaGarbageSize = 64 * 1024;
+
+// Open-addressing hash table with linear probing.
+// Format of an entry in the arena:
+// |key_size(varint32)|key|value_size(varint32)|value|
+class HashShard {
+ public:
+  HashShard() {
+    Reset(kMinShardCapacity);
+  }
+
+  ReaderWriterMutex *mutex() const {
+    return &mutex_;
+  }
+
+  // The following methods require the reader lock.
+  bool Lookup(const StringPiece &key, uint32 hash, string *value) const {
+    const size_t i = FindSlot(key, hash);
+    if (i == kNotFound) {
+      return false;
+    }
+    const StringPiece v = GetValue(slots_[i].entry);
+    value->assign(v.data(), v.size());
+    return true;
+  }
+
+  void CopyTo(std::map<string, string> *output) const {
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      if (IsLive(slots_[i])) {
+        (*output)[GetKey(slots_[i].entry).as_string()] =
+            GetValue(slots_[i].entry).as_string();
+      }
+    }
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // The following methods require the writer lock.
+  void Insert(const StringPiece &key, const StringPiece &value,
+              uint32 hash) {
+    const size_t i = FindSlot(key, hash);
+    if (i != kNotFound) {
+      live_bytes_ -= GetEntrySize(slots_[i].entry);
+      slots_[i].entry = NewEntry(key, value);
+      MaybeCompactArena();
+      return;
+    }
+    if ((size_ + num_deleted_ + 1) * 4 > slots_.size() * 3) {
+      Rehash();
+    }
+    size_t j = hash & (slots_.size() - 1);
+    while (IsLive(slots_[j])) {
+      j = (j + 1) & (slots_.size() - 1);
+    }
+    if (slots_[j].entry == DeletedEntry()) {
+      --num_deleted_;
+    }
+    slots_[j].hash = hash;
+    slots_[j].entry = NewEntry(key, value);
+    ++size_;
+  }
+
+  bool Erase(const StringPiece &key, uint32 hash) {
+    const size_t i = FindSlot(key, hash);
+    if (i == kNotFound) {
+      return false;
+    }
+    live_bytes_ -= GetEntrySize(slots_[i].entry);
+    slots_[i].entry = DeletedEntry();
+    --size_;
+    ++num_deleted_;
+    return true;
+  }
+
+  void Clear() {
+    Reset(kMinShardCapacity);
+  }
+
+ private:
+  struct Slot {
+    uint32 hash;
+    // NULL if the slot is empty, or DeletedEntry() if erased.
+    const char *entry;
+  };
+
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  static const char *DeletedEntry() {
+    static const char kDeleted = '\0';
+    return &kDeleted;
+  }
+
+  static bool IsLive(const Slot &slot) {
+    return slot.entry != NULL && slot.entry != DeletedEntry();
+  }
+
+  static StringPiece GetKey(const char *entry) {
+    uint32 size = 0;
+    const char *p = GetVarint32Ptr(entry, entry + 5, &size);
+    return StringPiece(p, size);
+  }
+
+  static StringPiece GetValue(const char *entry) {
+    const StringPiece key = GetKey(entry);
+    const char *p = key.data() + key.size();
+    uint32 size = 0;
+    p = GetVarint32Ptr(p, p + 5, &size);
+    return StringPiece(p, size);
+  }
+
+  static size_t GetEntrySize(const char *entry) {
+    const StringPiece value = GetValue(entry);
+    return value.data() + value.size() - entry;
+  }
+
+  size_t FindSlot(const StringPiece &key, uint32 hash) const {
+    for (size_t i = hash & (slots_.size() - 1); slots_[i].entry != NULL;
+         i = (i + 1) & (slots_.size() - 1)) {
+      if (IsLive(slots_[i]) && slots_[i].hash == hash &&
+          GetKey(slots_[i].entry) == key) {
+        return i;
+      }
+    }
+    return kNotFound;
+  }
+
+  const char *NewEntry(const StringPiece &key, const StringPiece &value) {
+    const size_t size = VarintLength(key.size()) + key.size() +
+        VarintLength(value.size()) + value.size();
+    char *entry = arena_->Allocate(size);
+    char *p = EncodeVarint32(entry, key.size());
+    memcpy(p, key.data(), key.size());
+    p = EncodeVarint32(p + key.size(), value.size());
+    memcpy(p, value.data(), value.size());
+    live_bytes_ += size;
+    return entry;
+  }
+
+  void Reset(size_t capacity) {
+    arena_.reset(new Arena);
+    slots_.assign(capacity, Slot());
+    size_ = 0;
+    num_deleted_ = 0;
+    live_bytes_ = 0;
+  }
+
+  // Rebuilds the table with the capacity for the current entries, which
+  // also drops the erased slots and the garbage in the arena.
+  void Rehash() {
+    size_t capacity = kMinShardCapacity;
+    while (capacity < (size_ + 1) * 2) {
+      capacity *= 2;
+    }
+    std::vector<Slot> slots;
+    slots.swap(slots_);
+    std::unique_ptr<Arena> arena(arena_.release());
+    Reset(capacity);
+    for (size_t i = 0; i < slots.size(); ++i) {
+      if (!IsLive(slots[i])) {
+        continue;
+      }
+      size_t j = slots[i].hash & (slots_.size() - 1);
+      while (slots_[j].entry != NULL) {
+        j = (j + 1) & (slots_.size() - 1);
+      }
+      slots_[j].hash = slots[i].hash;
+      slots_[j].entry = NewEntry(GetKey(slots[i].entry),
+                                 GetValue(slots[i].entry));
+      ++size_;
+    }
+  }
+
+  void MaybeCompactArena() {
+    const size_t garbage_size = arena_->MemoryUsage() - live_bytes_;
+    if (garbage_size > live_bytes_ && garbage_size > kMinArenaGarbageSize) {
+      Rehash();
+    }
+  }
+
+  mutable ReaderWriterMutex mutex_;
+  std::unique_ptr<Arena> arena_;
+  std::vector<Slot> slots_;
+  size_t size_;
+  size_t num_deleted_;
+  // Bytes of the live entries in |arena_|.
+  size_t live_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(HashShard);
+};
+
+// Owns a sorted copy of the data.
+class SortedCopyIterator : public MapIterator {
+ public:
+  // Takes the ownership of |map|.
+  explicit SortedCopyIterator(std::map<string, string> *map)
+      : MapIterator(map), map_(map) {}
+
+ private:
+  std::unique_ptr<std::map<string, string> > map_;
+};
+
+class ConcurrentMemoryStorageImpl : public StorageInterface {
+ public:
+  explicit ConcurrentMemoryStorageImpl(size_t num_shards)
+      : shards_(num_shards) {
+    DCHECK_GT(num_shards, 0);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      shards_[i].reset(new HashShard);
+    }
+  }
+
+  virtual ~ConcurrentMemoryStorageImpl() {}
+
+  virtual bool Open(const string &filename) {
+    return Clear();
+  }
+
+  virtual bool Sync() {
+    return true;
+  }
+
+  virtual bool Lookup(const string &key, string *value) const {
+    CHECK(value);
+    const uint64 fp = Hash::Fingerprint(key);
+    const HashShard *shard = GetShard(fp);
+    scoped_reader_lock l(shard->mutex());
+    return shard->Lookup(key, GetSlotHash(fp), value);
+  }
+
+  virtual bool Insert(const string &key, const string &value) {
+    const uint64 fp = Hash::Fingerprint(key);
+    HashShard *shard = GetShard(fp);
+    scoped_writer_lock l(shard->mutex());
+    shard->Insert(key, value, GetSlotHash(fp));
+    return true;
+  }
+
+  virtual bool Erase(const string &key) {
+    const uint64 fp = Hash::Fingerprint(key);
+    HashShard *shard = GetShard(fp);
+    scoped_writer_lock l(shard->mutex());
+    return shard->Erase(key, GetSlotHash(fp));
+  }
+
+  // Locks all the shards updated by |batch| in the order of the index, so
+  // that the batch is visible at once.
+  virtual bool Write(const WriteBatch &batch) {
+    ShardCollector collector(this);
+    if (!batch.Iterate(&collector)) {
+      return false;
+    }
+    const std::vector<bool> &used = collector.used();
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (used[i]) {
+        shards_[i]->mutex()->WriterLock();
+      }
+    }
+    Updater updater(this);
+    batch.Iterate(&updater);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (used[i]) {
+        shards_[i]->mutex()->WriterUnlock();
+      }
+    }
+    return true;
+  }
+
+  virtual bool Clear() {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      scoped_writer_lock l(shards_[i]->mutex());
+      shards_[i]->Clear();
+    }
+    return true;
+  }
+
+  virtual size_t Size() const {
+    size_t size = 0;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      scoped_reader_lock l(shards_[i]->mutex());
+      size += shards_[i]->size();
+    }
+    return size;
+  }
+
+  virtual Iterator *NewIterator() const {
+    std::map<string, string> *map = new std::map<string, string>;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      scoped_reader_lock l(shards_[i]->mutex());
+      shards_[i]->CopyTo(map);
+    }
+    return new SortedCopyIterator(map);
+  }
+
+ private:
+  class ShardCollector : public WriteBatch::Handler {
+   public:
+    explicit ShardCollector(const ConcurrentMemoryStorageImpl *storage)
+        : storage_(storage), used_(storage->shards_.size(), false) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      used_[storage_->GetShardIndex(Hash::Fingerprint(key))] = true;
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      used_[storage_->GetShardIndex(Hash::Fingerprint(key))] = true;
+    }
+
+    const std::vector<bool> &used() const {
+      return used_;
+    }
+
+   private:
+    const ConcurrentMemoryStorageImpl *storage_;
+    std::vector<bool> used_;
+  };
+
+  // Updates the shards locked by the caller.
+  class Updater : public WriteBatch::Handler {
+   public:
+    explicit Updater(ConcurrentMemoryStorageImpl *storage)
+        : storage_(storage) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      const uint64 fp = Hash::Fingerprint(key);
+      storage_->GetShard(fp)->Insert(key, value, GetSlotHash(fp));
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      const uint64 fp = Hash::Fingerprint(key);
+      storage_->GetShard(fp)->Erase(key, GetSlotHash(fp));
+    }
+
+   private:
+    ConcurrentMemoryStorageImpl *storage_;
+  };
+
+  // The upper bits select the shard and the lower bits select the slot.
+  size_t GetShardIndex(uint64 fp) const {
+    return static_cast<size_t>((fp >> 32) % shards_.size());
+  }
+
+  static uint32 GetSlotHash(uint64 fp) {
+    return static_cast<uint32>(fp);
+  }
+
+  HashShard *GetShard(uint64 fp) const {
+    return shards_[GetShardIndex(fp)].get();
+  }
+
+  std::vector<std::unique_ptr<HashShard> > shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentMemoryStorageImpl);
+};
+
+// Old versions are dropped when the entries of the memtable exceed
+// 2 * max(live keys, entries left by the last rebuild) + this number, so
+// that the rebuilds stay amortized O(1) per write even while a snapshot
+// pins many old versions.
+const size_t kMinGarbageEntries = 1024;
+
+// Wraps the iterator of a memtable to skip the deleted keys.
+class MultiVersionIterator : public StorageInterface::Iterator {
+ public:
+  MultiVersionIterator(const std::shared_ptr<const MemTable> &mem,
+                       uint64 snapshot)
+      : mem_(mem), iter_(mem->NewIterator(snapshot)) {}
+
+  virtual bool Valid() const {
+    return iter_->Valid();
+  }
+
+  virtual void SeekToFirst() {
+    iter_->SeekToFirst();
+    SkipDeletions();
+  }
+
+  virtual void SeekToLast() {
+    iter_->SeekToLast();
+    SkipDeletionsBackward();
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    iter_->Seek(target);
+    SkipDeletions();
+  }
+
+  virtual void Next() {
+    iter_->Next();
+    SkipDeletions();
+  }
+
+  virtual void Prev() {
+    iter_->Prev();
+    SkipDeletionsBackward();
+  }
+
+  virtual StringPiece key() const {
+    return iter_->key();
+  }
+
+  virtual StringPiece value() const {
+    return iter_->value();
+  }
+
+ private:
+  void SkipDeletions() {
+    while (iter_->Valid() && iter_->type() == kTypeDeletion) {
+      iter_->Next();
+    }
+  }
+
+  void SkipDeletionsBackward() {
+    while (iter_->Valid() && iter_->type() == kTypeDeletion) {
+      iter_->Prev();
+    }
+  }
+
+  // Keeps the memtable alive.
+  std::shared_ptr<const MemTable> mem_;
+  std::unique_ptr<EntryIterator> iter_;
+};
+
+class MultiVersionStorageImpl : public MultiVersionStorage {
+ public:
+  MultiVersionStorageImpl()
+      : mem_(new MemTable), last_sequence_(0), size_(0), num_entries_(0),
+        num_rebuilt_entries_(0) {}
+
+  virtual ~MultiVersionStorageImpl() {}
+
+  virtual bool Open(const string &filename) {
+    return Clear();
+  }
+
+  virtual bool Sync() {
+    return true;
+  }
+
+  virtual bool Lookup(const string &key, string *value) const {
+    CHECK(value);
+    // |mem_| is loaded before the sequence, since a newer memtable doesn't
+    // have the versions for the older sequences.
+    const std::shared_ptr<const MemTable> mem = std::atomic_load(&mem_);
+    return Get(*mem, last_sequence_.load(), key, value);
+  }
+
+  virtual bool LookupAt(uint64 snapshot, const string &key,
+                        string *value) const {
+    CHECK(value);
+    return Get(*std::atomic_load(&mem_), snapshot, key, value);
+  }
+
+  virtual bool Insert(const string &key, const string &value) {
+    scoped_lock l(&write_mutex_);
+    uint64 sequence = last_sequence_.load();
+    AddEntry(&sequence, kTypeValue, key, value);
+    last_sequence_.store(sequence);
+    MaybeDropOldVersions();
+    return true;
+  }
+
+  virtual bool Erase(const string &key) {
+    scoped_lock l(&write_mutex_);
+    uint64 sequence = last_sequence_.load();
+    if (!AddEntry(&sequence, kTypeDeletion, key, StringPiece())) {
+      return false;
+    }
+    last_sequence_.store(sequence);
+    MaybeDropOldVersions();
+    return true;
+  }
+
+  // The updates are published at once by advancing the sequence after all
+  // of them are added.
+  virtual bool Write(const WriteBatch &batch) {
+    scoped_lock l(&write_mutex_);
+    MemTableInserter inserter(this, last_sequence_.load());
+    const bool result = batch.Iterate(&inserter);
+    // The applied part of a broken batch is published too, so that the
+    // sequences are not reused.
+    last_sequence_.store(inserter.sequence());
+    MaybeDropOldVersions();
+    return result;
+  }
+
+  // Erases all the keys at one sequence, so that the snapshots still see
+  // the data.
+  virtual bool Clear() {
+    scoped_lock l(&write_mutex_);
+    std::vector<string> keys;
+    MultiVersionIterator iter(mem_, last_sequence_.load());
+    for (iter.SeekToFirst(); iter.Valid(); iter.Next()) {
+      keys.push_back(iter.key().as_string());
+    }
+    if (keys.empty()) {
+      return true;
+    }
+    const uint64 sequence = last_sequence_.load() + 1;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      mem_->Add(sequence, kTypeDeletion, keys[i], StringPiece());
+    }
+    num_entries_ += keys.size();
+    size_ = 0;
+    last_sequence_.store(sequence);
+    MaybeDropOldVersions();
+    return true;
+  }
+
+  virtual size_t Size() const {
+    scoped_lock l(&write_mutex_);
+    return size_;
+  }
+
+  virtual Iterator *NewIterator() const {
+    const std::shared_ptr<const MemTable> mem = std::atomic_load(&mem_);
+    return new MultiVersionIterator(mem, last_sequence_.load());
+  }
+
+  virtual Iterator *NewIteratorAt(uint64 snapshot) const {
+    return new MultiVersionIterator(std::atomic_load(&mem_), snapshot);
+  }
+
+  virtual uint64 GetSnapshot() {
+    scoped_lock l(&snapshot_mutex_);
+    const uint64 snapshot = last_sequence_.load();
+    snapshots_.insert(snapshot);
+    return snapshot;
+  }
+
+  virtual void ReleaseSnapshot(uint64 snapshot) {
+    scoped_lock l(&snapshot_mutex_);
+    std::multiset<uint64>::iterator it = snapshots_.find(snapshot);
+    if (it == snapshots_.end()) {
+      LOG(ERROR) << "unknown snapshot: " << snapshot;
+      return;
+    }
+    snapshots_.erase(it);
+  }
+
+ private:
+  class MemTableInserter : public WriteBatch::Handler {
+   public:
+    MemTableInserter(MultiVersionStorageImpl *storage, uint64 sequence)
+        : storage_(storage), sequence_(sequence) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      storage_->AddEntry(&sequence_, kTypeValue, key, value);
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      storage_->AddEntry(&sequence_, kTypeDeletion, key, StringPiece());
+    }
+
+    uint64 sequence() const {
+      return sequence_;
+    }
+
+   private:
+    MultiVersionStorageImpl *storage_;
+    uint64 sequence_;
+  };
+
+  static bool Get(const MemTable &mem, uint64 snapshot, const string &key,
+                  string *value) {
+    StringPiece data;
+    ValueType type = kTypeValue;
+    if (!mem.Get(key, snapshot, &data, &type) || type != kTypeValue) {
+      return false;
+    }
+    value->assign(data.data(), data.size());
+    return true;
+  }
+
+  // Adds the entry with the next sequence, which is not published yet.
+  // Returns false if the key to erase is not found. Requires
+  // |write_mutex_|.
+  bool AddEntry(uint64 *sequence, ValueType type, const StringPiece &key,
+                const StringPiece &value) {
+    StringPiece data;
+    ValueType current_type = kTypeValue;
+    const bool exists = mem_->Get(key, *sequence, &data, &current_type) &&
+        current_type == kTypeValue;
+    if (type == kTypeDeletion && !exists) {
+      return false;
+    }
+    mem_->Add(++*sequence, type, key, value);
+    ++num_entries_;
+    if (type == kTypeValue && !exists) {
+      ++size_;
+    } else if (type == kTypeDeletion) {
+      --size_;
+    }
+    return true;
+  }
+
+  // Rebuilds the memtable with the versions visible from the snapshots and
+  // the latest sequence. The version visible from each snapshot is tagged
+  // with the snapshot itself. Readers keep reading the old memtable, while
+  // the writers wait. Requires |write_mutex_|.
+  void MaybeDropOldVersions() {
+    if (num_entries_ <=
+        std::max(size_, num_rebuilt_entries_) * 2 + kMinGarbageEntries) {
+      return;
+    }
+    std::vector<uint64> sequences;
+    {
+      scoped_lock l(&snapshot_mutex_);
+      sequences.assign(snapshots_.begin(), snapshots_.end());
+    }
+    sequences.push_back(last_sequence_.load());
+
+    std::shared_ptr<MemTable> mem(new MemTable);
+    size_t num_entries = 0;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+      if (i > 0 && sequences[i] == sequences[i - 1]) {
+        continue;
+      }
+      std::unique_ptr<EntryIterator> iter(mem_->NewIterator(sequences[i]));
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        // Skips the version which is already visible from the older
+        // snapshot.
+        StringPiece data;
+        ValueType type = kTypeValue;
+        const bool found = mem->Get(iter->key(), sequences[i], &data, &type);
+        if (found ? (type == iter->type() && data == iter->value())
+                  : iter->type() == kTypeDeletion) {
+          continue;
+        }
+        mem->Add(sequences[i], iter->type(), iter->key(), iter->value());
+        ++num_entries;
+      }
+    }
+    std::atomic_store(&mem_, mem);
+    num_entries_ = num_entries;
+    num_rebuilt_entries_ = num_entries;
+  }
+
+  // Written only with |write_mutex_|, and read with std::atomic_load().
+  std::shared_ptr<MemTable> mem_;
+  std::atomic<uint64> last_sequence_;
+  mutable Mutex write_mutex_;
+  // The following members are guarded by |write_mutex_|.
+  size_t size_;
+  // Number of the entries in |mem_|.
+  size_t num_entries_;
+  // Number of the entries left in |mem_| by the last rebuild.
+  size_t num_rebuilt_entries_;
+
+  Mutex snapshot_mutex_;
+  std::multiset<uint64> snapshots_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiVersionStorageImpl);
+};
+
 }  // namespace
 
 StorageInterface *MemoryStorage::New() {
   return new MemoryStorageImpl;
 }
 
+StorageInterface *MemoryStorage::NewConcurrent() {
+  return NewConcurrent(kDefaultNumShards);
+}
+
+StorageInterface *MemoryStorage::NewConcurrent(size_t num_shards) {
+  return new ConcurrentMemoryStorageImpl(num_shards);
+}
+
+MultiVersionStorage *MemoryStorage::NewMultiVersion() {
+  return new MultiVersionStorageImpl;
+}
+
 }  // namespace storage
 }  // namespace gbase
@@ -30,21 +30,59 @@
 #ifndef GBASE_STORAGE_MEMORY_STORAGE_H_
 #define GBASE_STORAGE_MEMORY_STORAGE_H_
 
+#include <cstddef>
+
+#include "base/port.h"
 #include "storage/storage_interface.h"
 
 namespace gbase {
 namespace storage {
 
+class MultiVersionStorage;
+
 // On memory storage for dependency injection.
 // This class might be useful for other test cases.
 class MemoryStorage {
  public:
   static StorageInterface *New();
 
+  // Thread-safe storage. Keys are distributed over |num_shards|
+  // open-addressing hash tables, each guarded by a reader/writer lock,
+  // and the keys and values are stored in the arena of each shard.
+  // NewIterator() iterates a sorted copy of the data.
+  static StorageInterface *NewConcurrent();
+  static StorageInterface *NewConcurrent(size_t num_shards);
+
+  // Storage built on a skip list of sequence-tagged keys. The versions
+  // which are not visible from any snapshot are dropped when the entries
+  // outnumber both the live keys and the entries left by the last drop.
+  static MultiVersionStorage *NewMultiVersion();
+
  private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(MemoryStorage);
 };
 
+// In-memory storage which keeps multiple versions of each key, so that
+// readers can see a consistent view while the writers proceed.
+// All methods are thread-safe. Readers never wait on the writers, and
+// NewIterator() iterates the data at its creation, so the storage can be
+// modified while iterating.
+class MultiVersionStorage : public StorageInterface {
+ public:
+  // Returns the sequence number of the latest update. LookupAt() and
+  // NewIteratorAt() with the returned snapshot see the data at that point.
+  // The versions visible from the snapshot are kept until the snapshot is
+  // passed to ReleaseSnapshot().
+  virtual uint64 GetSnapshot() = 0;
+  virtual void ReleaseSnapshot(uint64 snapshot) = 0;
+
+  // REQUIRES: |snapshot| has been returned by GetSnapshot() and has not been
+  // released.
+  virtual bool LookupAt(uint64 snapshot, const string &key,
+                        string *value) const = 0;
+  virtual Iterator *NewIteratorAt(uint64 snapshot) const = 0;
+};
+
 }  // namespace storage
 }  // namespace gbase
 
@@ -32,8 +32,13 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "base/number_util.h"
 #include "base/port.h"
+#include "base/thread.h"
+#include "storage/storage_interface.h"
+#include "storage/write_batch.h"
 #include "gtest/gtest.h"
 
 namespace gbase {
@@ -51,6 +56,57 @@ void CreateKeyValue(std::map<string, string> *output, int size) {
   }
 }
 
+class InsertThread : public Thread {
+ public:
+  InsertThread(StorageInterface *storage, int id, int size)
+      : storage_(storage), id_(id), size_(size) {}
+
+  virtual void Run() {
+    for (int i = 0; i < size_; ++i) {
+      char key[64];
+      snprintf(key, sizeof(key), "key%d_%d", id_, i);
+      storage_->Insert(key, key);
+      string value;
+      if (!storage_->Lookup(key, &value) || value != key) {
+        ++num_errors_;
+      }
+      if (i % 2 == 0) {
+        storage_->Erase(key);
+      }
+    }
+  }
+
+  int num_errors() const {
+    return num_errors_;
+  }
+
+ private:
+  StorageInterface *storage_;
+  const int id_;
+  const int size_;
+  int num_errors_ = 0;
+};
+
+// Moves "1" to the next key by a batch.
+class MoveThread : public Thread {
+ public:
+  MoveThread(StorageInterface *storage, int num_keys)
+      : storage_(storage), num_keys_(num_keys) {}
+
+  virtual void Run() {
+    for (int i = 0; i < 10000; ++i) {
+      WriteBatch batch;
+      batch.Insert("key" + NumberUtil::SimpleItoa(i % num_keys_), "0");
+      batch.Insert("key" + NumberUtil::SimpleItoa((i + 1) % num_keys_), "1");
+      storage_->Write(batch);
+    }
+  }
+
+ private:
+  StorageInterface *storage_;
+  const int num_keys_;
+};
+
 }  // namespace
 
 TEST(MemoryStorageTest, SimpleTest) {
@@ -108,5 +164,248 @@ TEST(MemoryStorageTest, SimpleTest) {
   }
 }
 
+TEST(MemoryStorageTest, IteratorTest) {
+  std::unique_ptr<StorageInterface> storage(MemoryStorage::New());
+  EXPECT_TRUE(storage->Insert("a", "1"));
+  EXPECT_TRUE(storage->Insert("ab", "2"));
+  EXPECT_TRUE(storage->Insert("abc", "3"));
+  EXPECT_TRUE(storage->Insert("b", "4"));
+  EXPECT_TRUE(storage->Insert("b\xff", "5"));
+  EXPECT_TRUE(storage->Insert("c", "6"));
+
+  std::unique_ptr<StorageInterface::Iterator> iter(storage->NewIterator());
+  ASSERT_TRUE(iter.get() != NULL);
+  string keys;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    keys += iter->key().as_string() + ",";
+  }
+  EXPECT_EQ("a,ab,abc,b,b\xff,c,", keys);
+  string values;
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    values += iter->value().as_string();
+  }
+  EXPECT_EQ("654321", values);
+  iter->Seek("abd");
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("b", iter->key().as_string());
+  iter->Prev();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("abc", iter->key().as_string());
+  iter->Seek("d");
+  EXPECT_FALSE(iter->Valid());
+
+  iter.reset(storage->NewPrefixIterator("ab"));
+  keys.clear();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    keys += iter->key().as_string() + ",";
+  }
+  EXPECT_EQ("ab,abc,", keys);
+  iter->SeekToLast();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("abc", iter->key().as_string());
+  iter->Prev();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("ab", iter->key().as_string());
+  iter->Prev();
+  EXPECT_FALSE(iter->Valid());
+  iter->Seek("a");
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("ab", iter->key().as_string());
+
+  // The successor of "b\xff" is "c".
+  iter.reset(storage->NewPrefixIterator("b\xff"));
+  iter->SeekToLast();
+  ASSERT_TRUE(iter->Valid());
+  EXPECT_EQ("b\xff", iter->key().as_string());
+
+  iter.reset(storage->NewPrefixIterator("x"));
+  iter->SeekToFirst();
+  EXPECT_FALSE(iter->Valid());
+  iter->SeekToLast();
+  EXPECT_FALSE(iter->Valid());
+}
+
+TEST(MemoryStorageTest, ConcurrentTest) {
+  std::unique_ptr<StorageInterface> storage(MemoryStorage::NewConcurrent(4));
+  std::map<string, string> target;
+  CreateKeyValue(&target, 10000);
+  for (std::map<string, string>::const_iterator it = target.begin();
+       it != target.end(); ++it) {
+    EXPECT_TRUE(storage->Insert(it->first, it->second));
+  }
+  EXPECT_EQ(target.size(), storage->Size());
+
+  // Overwrite and erase the half.
+  int id = 0;
+  for (std::map<string, string>::iterator it = target.begin();
+       it != target.end(); ++id) {
+    if (id % 2 == 0) {
+      EXPECT_TRUE(storage->Erase(it->first));
+      EXPECT_FALSE(storage->Erase(it->first));
+      target.erase(it++);
+    } else {
+      it->second += ".new";
+      EXPECT_TRUE(storage->Insert(it->first, it->second));
+      ++it;
+    }
+  }
+  EXPECT_EQ(target.size(), storage->Size());
+  for (std::map<string, string>::const_iterator it = target.begin();
+       it != target.end(); ++it) {
+    string value;
+    EXPECT_TRUE(storage->Lookup(it->first, &value));
+    EXPECT_EQ(it->second, value);
+  }
+  string value;
+  EXPECT_FALSE(storage->Lookup("key0", &value));
+
+  WriteBatch batch;
+  batch.Insert("key0", "value0");
+  batch.Erase("key1");
+  batch.Insert("key1", "value1.batch");
+  batch.Erase("key3");
+  EXPECT_TRUE(storage->Write(batch));
+  EXPECT_TRUE(storage->Lookup("key0", &value));
+  EXPECT_EQ("value0", value);
+  EXPECT_TRUE(storage->Lookup("key1", &value));
+  EXPECT_EQ("value1.batch", value);
+  EXPECT_FALSE(storage->Lookup("key3", &value));
+  target["key0"] = "value0";
+  target["key1"] = "value1.batch";
+  target.erase("key3");
+
+  std::unique_ptr<StorageInterface::Iterator> iter(storage->NewIterator());
+  std::map<string, string>::const_iterator it = target.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != target.end());
+    EXPECT_EQ(it->first, iter->key().as_string());
+    EXPECT_EQ(it->second, iter->value().as_string());
+  }
+  EXPECT_TRUE(it == target.end());
+
+  EXPECT_TRUE(storage->Clear());
+  EXPECT_EQ(0, storage->Size());
+  EXPECT_FALSE(storage->Lookup("key1", &value));
+}
+
+TEST(MemoryStorageTest, ConcurrentThreadTest) {
+  const int kNumThreads = 8;
+  const int kSize = 5000;
+  std::unique_ptr<StorageInterface> storage(MemoryStorage::NewConcurrent());
+  std::vector<std::unique_ptr<InsertThread> > threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back(new InsertThread(storage.get(), i, kSize));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("InsertThread");
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+    EXPECT_EQ(0, threads[i]->num_errors());
+  }
+  EXPECT_EQ(kNumThreads * kSize / 2, storage->Size());
+  for (int i = 0; i < kNumThreads; ++i) {
+    for (int j = 0; j < kSize; ++j) {
+      char key[64];
+      snprintf(key, sizeof(key), "key%d_%d", i, j);
+      string value;
+      EXPECT_EQ(j % 2 != 0, storage->Lookup(key, &value));
+    }
+  }
+}
+
+TEST(MemoryStorageTest, MultiVersionTest) {
+  std::unique_ptr<MultiVersionStorage> storage(
+      MemoryStorage::NewMultiVersion());
+  EXPECT_TRUE(storage->Insert("key1", "value1"));
+  EXPECT_TRUE(storage->Insert("key2", "value2"));
+  const uint64 snapshot1 = storage->GetSnapshot();
+  std::unique_ptr<StorageInterface::Iterator> iter(storage->NewIterator());
+
+  EXPECT_TRUE(storage->Insert("key1", "value1.new"));
+  EXPECT_TRUE(storage->Erase("key2"));
+  EXPECT_FALSE(storage->Erase("key2"));
+  EXPECT_TRUE(storage->Insert("key3", "value3"));
+  EXPECT_EQ(2, storage->Size());
+
+  string value;
+  EXPECT_TRUE(storage->Lookup("key1", &value));
+  EXPECT_EQ("value1.new", value);
+  EXPECT_FALSE(storage->Lookup("key2", &value));
+  EXPECT_TRUE(storage->LookupAt(snapshot1, "key1", &value));
+  EXPECT_EQ("value1", value);
+  EXPECT_TRUE(storage->LookupAt(snapshot1, "key2", &value));
+  EXPECT_EQ("value2", value);
+  EXPECT_FALSE(storage->LookupAt(snapshot1, "key3", &value));
+
+  // The iterator sees the data at its creation.
+  string contents;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    contents += iter->key().as_string() + "=" + iter->value().as_string() +
+        ",";
+  }
+  EXPECT_EQ("key1=value1,key2=value2,", contents);
+
+  const uint64 snapshot2 = storage->GetSnapshot();
+  WriteBatch batch;
+  batch.Erase("key1");
+  batch.Insert("key4", "value4");
+  EXPECT_TRUE(storage->Write(batch));
+  EXPECT_TRUE(storage->Clear());
+  EXPECT_EQ(0, storage->Size());
+  iter.reset(storage->NewIterator());
+  iter->SeekToFirst();
+  EXPECT_FALSE(iter->Valid());
+
+  iter.reset(storage->NewIteratorAt(snapshot2));
+  contents.clear();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    contents += iter->key().as_string() + ",";
+  }
+  EXPECT_EQ("key3,key1,", contents);
+
+  // Old versions are dropped, but the snapshots still see them.
+  for (int i = 0; i < 10000; ++i) {
+    EXPECT_TRUE(storage->Insert("key", "value" + NumberUtil::SimpleItoa(i)));
+  }
+  EXPECT_TRUE(storage->LookupAt(snapshot1, "key2", &value));
+  EXPECT_EQ("value2", value);
+  EXPECT_TRUE(storage->LookupAt(snapshot2, "key1", &value));
+  EXPECT_EQ("value1.new", value);
+  EXPECT_FALSE(storage->LookupAt(snapshot2, "key2", &value));
+  EXPECT_FALSE(storage->LookupAt(snapshot2, "key", &value));
+  EXPECT_TRUE(storage->Lookup("key", &value));
+  EXPECT_EQ("value9999", value);
+  EXPECT_EQ(1, storage->Size());
+  storage->ReleaseSnapshot(snapshot1);
+  storage->ReleaseSnapshot(snapshot2);
+}
+
+TEST(MemoryStorageTest, MultiVersionScanTest) {
+  // A scan sees a consistent view while a writer moves a value between the
+  // keys.
+  const int kNumKeys = 100;
+  std::unique_ptr<MultiVersionStorage> storage(
+      MemoryStorage::NewMultiVersion());
+  for (int i = 0; i < kNumKeys; ++i) {
+    EXPECT_TRUE(storage->Insert("key" + NumberUtil::SimpleItoa(i),
+                                i == 0 ? "1" : "0"));
+  }
+  MoveThread thread(storage.get(), kNumKeys);
+  thread.SetJoinable(true);
+  thread.Start("MoveThread");
+  for (int i = 0; i < 200; ++i) {
+    const uint64 snapshot = storage->GetSnapshot();
+    std::unique_ptr<StorageInterface::Iterator> iter(
+        storage->NewIteratorAt(snapshot));
+    int total = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      total += NumberUtil::SimpleAtoi(iter->value());
+    }
+    EXPECT_EQ(1, total);
+    storage->ReleaseSnapshot(snapshot);
+  }
+  thread.Join();
+}
+
 }  // namespace storage
 }  // namespace gbase
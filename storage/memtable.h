@@ -0,0 +1,315 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_MEMTABLE_H_
+#define GBASE_STORAGE_MEMTABLE_H_
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include "base/concurrent_arena.h"
+#include "base/coding.h"
+#include "base/logging.h"
+#include "base/port.h"
+#include "base/skiplist.h"
+#include "base/string_piece.h"
+
+namespace gbase {
+namespace storage {
+
+const uint64 kMaxSequenceNumber = (1ULL << 56) - 1;
+
+enum ValueType {
+  kTypeDeletion = 0,
+  kTypeValue = 1,
+};
+
+// Iterates entries in the order of the key. Each key appears only once.
+// The iterator is not positioned when it is created.
+class EntryIterator {
+ public:
+  EntryIterator() {}
+  virtual ~EntryIterator() {}
+  virtual bool Valid() const = 0;
+  virtual void SeekToFirst() = 0;
+  virtual void SeekToLast() = 0;
+  // Positions at the first entry whose key >= |target|.
+  virtual void Seek(const StringPiece &target) = 0;
+  virtual void Next() = 0;
+  virtual void Prev() = 0;
+  virtual StringPiece key() const = 0;
+  virtual StringPiece value() const = 0;
+  virtual ValueType type() const = 0;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(EntryIterator);
+};
+
+// In-memory table of the versioned entries. Each update is tagged with a
+// sequence number, and a reader with a snapshot sees only the entries which
+// are not newer than the snapshot. Add() requires external synchronization,
+// but readers can run concurrently with Add() without any lock.
+// AddConcurrently() can be called from many writers at once without any
+// lock, but must not be mixed with concurrent Add() calls.
+//
+// Format of a memtable entry:
+// |internal_key_size(varint32)|key|tag(fixed64 sequence << 8 | type)|
+// |value_size(varint32)|value|
+// Entries are sorted by the key, and the newer one comes first.
+class MemTable {
+ public:
+  MemTable() : table_(KeyComparator(), &arena_), num_entries_(0) {}
+  explicit MemTable(const ArenaOptions &arena_options)
+      : arena_(arena_options),
+        table_(KeyComparator(), &arena_),
+        num_entries_(0) {}
+
+  void Add(uint64 sequence, ValueType type,
+           const StringPiece &key, const StringPiece &value) {
+    const size_t encoded_size = EncodedSize(key, value);
+    char *buf = arena_.Allocate(encoded_size);
+    EncodeEntry(sequence, type, key, value, buf, encoded_size);
+    table_.Insert(buf);
+    num_entries_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Same as Add(), but safe to call from many threads at once.
+  // REQUIRES: |sequence| is unique among the concurrent writers.
+  void AddConcurrently(uint64 sequence, ValueType type,
+                       const StringPiece &key, const StringPiece &value) {
+    const size_t encoded_size = EncodedSize(key, value);
+    char *buf = arena_.Allocate(encoded_size);
+    EncodeEntry(sequence, type, key, value, buf, encoded_size);
+    table_.InsertConcurrently(buf);
+    num_entries_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns true if the memtable has an entry of |key| whose sequence is
+  // not newer than |snapshot|. |value| points to the arena.
+  bool Get(const StringPiece &key, uint64 snapshot,
+           StringPiece *value, ValueType *type) const {
+    string lookup_key;
+    EncodeLookupKey(key, snapshot, &lookup_key);
+    Table::Iterator it(&table_);
+    it.Seek(lookup_key.data());
+    if (!it.Valid() || GetKey(it.key()) != key) {
+      return false;
+    }
+    *type = GetType(it.key());
+    *value = GetValue(it.key());
+    return true;
+  }
+
+  size_t ApproximateMemoryUsage() const {
+    return arena_.MemoryUsage();
+  }
+
+  bool empty() const {
+    return num_entries_.load(std::memory_order_relaxed) == 0;
+  }
+
+  // Entries newer than |snapshot| are skipped.
+  EntryIterator *NewIterator(uint64 snapshot) const {
+    return new MemTableIterator(&table_, snapshot);
+  }
+
+ private:
+  static size_t EncodedSize(const StringPiece &key, const StringPiece &value) {
+    const size_t internal_key_size = key.size() + 8;
+    return VarintLength(internal_key_size) + internal_key_size +
+        VarintLength(value.size()) + value.size();
+  }
+
+  static void EncodeEntry(uint64 sequence, ValueType type,
+                          const StringPiece &key, const StringPiece &value,
+                          char *buf, size_t encoded_size) {
+    char *p = EncodeVarint32(buf, key.size() + 8);
+    memcpy(p, key.data(), key.size());
+    p += key.size();
+    EncodeFixed64(p, (sequence << 8) | type);
+    p += 8;
+    p = EncodeVarint32(p, value.size());
+    memcpy(p, value.data(), value.size());
+    DCHECK_EQ(p + value.size(), buf + encoded_size);
+  }
+
+  // Makes the key to seek the newest entry of |key| whose sequence is not
+  // newer than |sequence|.
+  static void EncodeLookupKey(const StringPiece &key, uint64 sequence,
+                              string *lookup_key) {
+    lookup_key->clear();
+    PutVarint32(lookup_key, key.size() + 8);
+    lookup_key->append(key.data(), key.size());
+    PutFixed64(lookup_key, (sequence << 8) | kTypeValue);
+  }
+
+  static StringPiece GetInternalKey(const char *entry) {
+    uint32 size = 0;
+    const char *p = GetVarint32Ptr(entry, entry + 5, &size);
+    return StringPiece(p, size);
+  }
+
+  static StringPiece GetKey(const char *entry) {
+    const StringPiece internal_key = GetInternalKey(entry);
+    return StringPiece(internal_key.data(), internal_key.size() - 8);
+  }
+
+  static uint64 GetTag(const char *entry) {
+    const StringPiece internal_key = GetInternalKey(entry);
+    return DecodeFixed64(internal_key.data() + internal_key.size() - 8);
+  }
+
+  static ValueType GetType(const char *entry) {
+    return static_cast<ValueType>(GetTag(entry) & 0xff);
+  }
+
+  static StringPiece GetValue(const char *entry) {
+    const StringPiece internal_key = GetInternalKey(entry);
+    const char *p = internal_key.data() + internal_key.size();
+    uint32 size = 0;
+    p = GetVarint32Ptr(p, p + 5, &size);
+    return StringPiece(p, size);
+  }
+
+  struct KeyComparator {
+    int operator()(const char *a, const char *b) const {
+      const int result = GetKey(a).compare(GetKey(b));
+      if (result != 0) {
+        return result;
+      }
+      // The newer entry comes first.
+      const uint64 a_tag = GetTag(a);
+      const uint64 b_tag = GetTag(b);
+      if (a_tag > b_tag) {
+        return -1;
+      } else if (a_tag < b_tag) {
+        return 1;
+      }
+      return 0;
+    }
+  };
+
+  typedef SkipList<const char *, KeyComparator> Table;
+
+  // Positions at the newest visible entry of each key, and skips the
+  // older entries of the same key.
+  class MemTableIterator : public EntryIterator {
+   public:
+    MemTableIterator(const Table *table, uint64 snapshot)
+        : it_(table), snapshot_(snapshot) {}
+
+    virtual bool Valid() const {
+      return it_.Valid();
+    }
+
+    virtual void SeekToFirst() {
+      it_.SeekToFirst();
+      SkipInvisibleEntries();
+    }
+
+    virtual void SeekToLast() {
+      it_.SeekToLast();
+      FindPrevVisibleEntry();
+    }
+
+    virtual void Seek(const StringPiece &target) {
+      EncodeLookupKey(target, snapshot_, &lookup_key_);
+      it_.Seek(lookup_key_.data());
+      SkipInvisibleEntries();
+    }
+
+    virtual void Next() {
+      const StringPiece current = GetKey(it_.key());
+      do {
+        it_.Next();
+      } while (it_.Valid() && GetKey(it_.key()) == current);
+      SkipInvisibleEntries();
+    }
+
+    virtual void Prev() {
+      // Moves to the oldest entry of the previous key.
+      EncodeLookupKey(GetKey(it_.key()), kMaxSequenceNumber, &lookup_key_);
+      it_.Seek(lookup_key_.data());
+      DCHECK(it_.Valid());
+      it_.Prev();
+      FindPrevVisibleEntry();
+    }
+
+    virtual StringPiece key() const {
+      return GetKey(it_.key());
+    }
+
+    virtual StringPiece value() const {
+      return GetValue(it_.key());
+    }
+
+    virtual ValueType type() const {
+      return GetType(it_.key());
+    }
+
+   private:
+    bool IsVisible() const {
+      return (GetTag(it_.key()) >> 8) <= snapshot_;
+    }
+
+    void SkipInvisibleEntries() {
+      while (it_.Valid() && !IsVisible()) {
+        it_.Next();
+      }
+    }
+
+    // Moves backward to a visible entry, and then to the newest visible
+    // entry of its key.
+    void FindPrevVisibleEntry() {
+      while (it_.Valid() && !IsVisible()) {
+        it_.Prev();
+      }
+      if (it_.Valid()) {
+        EncodeLookupKey(GetKey(it_.key()), snapshot_, &lookup_key_);
+        it_.Seek(lookup_key_.data());
+      }
+    }
+
+    Table::Iterator it_;
+    const uint64 snapshot_;
+    string lookup_key_;
+  };
+
+  ConcurrentArena arena_;
+  Table table_;
+  std::atomic<size_t> num_entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemTable);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_MEMTABLE_H_
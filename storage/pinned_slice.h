@@ -0,0 +1,106 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_PINNED_SLICE_H_
+#define GBASE_STORAGE_PINNED_SLICE_H_
+
+#include <string>
+
+#include "base/port.h"
+#include "base/string_piece.h"
+
+namespace gbase {
+namespace storage {
+
+// PinnedSlice holds a value returned by StorageInterface::LookupPinned().
+// The value points to the memory of the storage without copy if
+// possible, and the memory is kept alive until the PinnedSlice is reset
+// or destroyed.
+class PinnedSlice {
+ public:
+  typedef void (*ReleaseFunction)(void *arg);
+
+  PinnedSlice() : release_(NULL), arg_(NULL) {}
+
+  ~PinnedSlice() {
+    Reset();
+  }
+
+  // Points to |data|. |release|(|arg|) is called when |data| is no longer
+  // used. |release| can be NULL.
+  void Pin(const StringPiece &data, ReleaseFunction release, void *arg) {
+    Reset();
+    data_ = data;
+    release_ = release;
+    arg_ = arg;
+  }
+
+  // Takes the contents of |data| as the value. |data| is left unspecified.
+  void PinSelf(string *data) {
+    Reset();
+    buf_.swap(*data);
+    data_ = buf_;
+  }
+
+  void Reset() {
+    if (release_ != NULL) {
+      release_(arg_);
+    }
+    release_ = NULL;
+    arg_ = NULL;
+    data_.clear();
+    buf_.clear();
+  }
+
+  StringPiece data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return data_.size();
+  }
+
+  string ToString() const {
+    return data_.as_string();
+  }
+
+ private:
+  StringPiece data_;
+  // Owns the value if it is not pinned in the storage.
+  string buf_;
+  ReleaseFunction release_;
+  void *arg_;
+
+  DISALLOW_COPY_AND_ASSIGN(PinnedSlice);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_PINNED_SLICE_H_
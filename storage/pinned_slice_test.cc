@@ -0,0 +1,99 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/pinned_slice.h"
+
+#include <memory>
+#include <string>
+
+#include "base/port.h"
+#include "storage/memory_storage.h"
+#include "storage/storage_interface.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+void IncrementCounter(void *arg) {
+  ++*reinterpret_cast<int *>(arg);
+}
+
+}  // namespace
+
+TEST(PinnedSliceTest, PinTest) {
+  const string data = "value";
+  int released = 0;
+  {
+    PinnedSlice slice;
+    EXPECT_EQ(0, slice.size());
+    slice.Pin(data, &IncrementCounter, &released);
+    EXPECT_EQ(data.data(), slice.data().data());
+    EXPECT_EQ("value", slice.ToString());
+    EXPECT_EQ(0, released);
+
+    // Pinning another value releases the previous one.
+    slice.Pin(data, &IncrementCounter, &released);
+    EXPECT_EQ(1, released);
+    slice.Reset();
+    EXPECT_EQ(2, released);
+    EXPECT_EQ(0, slice.size());
+
+    slice.Pin(data, &IncrementCounter, &released);
+  }
+  EXPECT_EQ(3, released);
+}
+
+TEST(PinnedSliceTest, PinSelfTest) {
+  int released = 0;
+  PinnedSlice slice;
+  slice.Pin("dummy", &IncrementCounter, &released);
+  string data = "value";
+  slice.PinSelf(&data);
+  EXPECT_EQ(1, released);
+  EXPECT_EQ("value", slice.ToString());
+  slice.Reset();
+  EXPECT_EQ(1, released);
+}
+
+TEST(PinnedSliceTest, DefaultLookupPinnedTest) {
+  std::unique_ptr<StorageInterface> storage(MemoryStorage::New());
+  EXPECT_TRUE(storage->Insert("key", "value"));
+  PinnedSlice value;
+  EXPECT_TRUE(storage->LookupPinned("key", &value));
+  EXPECT_EQ("value", value.ToString());
+  EXPECT_TRUE(storage->Erase("key"));
+  // The default implementation holds a copy.
+  EXPECT_EQ("value", value.ToString());
+  EXPECT_FALSE(storage->LookupPinned("key", &value));
+  EXPECT_EQ(0, value.size());
+}
+
+}  // namespace storage
+}  // namespace gbase
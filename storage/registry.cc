@@ -29,15 +29,18 @@
 
 #include "storage/registry.h"
 
+#include <map>
 #include <memory>
 #include <string>
 
 #include "base/file_util.h"
 #include "base/logging.h"
 #include "base/mutex.h"
+#include "base/scheduler.h"
 #include "base/singleton.h"
 #include "storage/storage_interface.h"
 #include "storage/tiny_storage.h"
+#include "storage/write_batch.h"
 
 namespace gbase {
 namespace storage {
@@ -49,15 +52,33 @@ const char kRegistryFileName[] = "registry.db";
 #else
 const char kRegistryFileName[] = ".registry.db";   // hidden file
 #endif
+const char kSyncJobName[] = "RegistrySync";
+// The interval of the sync job grows up to this factor on failures.
+const uint32 kMaxSyncBackoffFactor = 16;
+
+// Immutable copy of the key/value pairs in the storage. Writers build a new
+// snapshot under |g_mutex| and publish it atomically, while readers hold a
+// reference to the snapshot they loaded, so that Lookup() never waits on
+// the writers.
+typedef std::map<string, string> Snapshot;
 
 class StorageInitializer {
  public:
   StorageInitializer() :
-      default_storage_(TinyStorage::New()), current_storage_(NULL) {
+      default_storage_(TinyStorage::New()), current_storage_(NULL),
+      write_behind_(false), max_dirty_count_(0) {
     if (!default_storage_->Open(FileUtil::JoinPath(
             ".", kRegistryFileName))) {
       LOG(ERROR) << "cannot open registry";
     }
+    ResetSnapshot();
+  }
+
+  // Writes the pending updates of the write-behind mode, when the
+  // singleton is finalized.
+  ~StorageInitializer() {
+    scoped_lock l(&g_mutex);
+    FlushDelta();
   }
 
   StorageInterface *GetStorage() const {
@@ -68,30 +89,219 @@ class StorageInitializer {
     }
   }
 
+  // Requires |g_mutex|.
   void SetStorage(StorageInterface *storage) {
+    FlushDelta();
     current_storage_ = storage;
+    ResetSnapshot();
+  }
+
+  // The following methods for the write-behind mode require |g_mutex|.
+  bool write_behind() const {
+    return write_behind_;
+  }
+
+  void EnableWriteBehind(size_t max_dirty_count) {
+    write_behind_ = true;
+    max_dirty_count_ = max_dirty_count;
+  }
+
+  bool DisableWriteBehind() {
+    const bool result = FlushDelta();
+    write_behind_ = false;
+    return result;
+  }
+
+  // Looks up |delta_| and then the storage.
+  bool Lookup(const string &key, string *value) const {
+    Delta::const_iterator it = delta_.find(key);
+    if (it == delta_.end()) {
+      return GetStorage()->Lookup(key, value);
+    }
+    if (it->second == NULL) {
+      return false;
+    }
+    value->assign(*it->second);
+    return true;
+  }
+
+  // Records the update of |key| in |delta_|, overwriting the previous
+  // update of the same key. |value| is NULL for erasure.
+  bool AddDelta(const string &key, const string *value) {
+    delta_[key].reset(value == NULL ? NULL : new string(*value));
+    if (delta_.size() >= max_dirty_count_) {
+      return FlushDelta();
+    }
+    return true;
+  }
+
+  void ClearDelta() {
+    delta_.clear();
+  }
+
+  // Writes |delta_| to the storage as one batch and syncs it.
+  bool FlushDelta() {
+    if (delta_.empty()) {
+      return true;
+    }
+    WriteBatch batch;
+    for (Delta::const_iterator it = delta_.begin(); it != delta_.end(); ++it) {
+      if (it->second == NULL) {
+        batch.Erase(it->first);
+      } else {
+        batch.Insert(it->first, *it->second);
+      }
+    }
+    bool result = true;
+    if (!GetStorage()->Write(batch)) {
+      LOG(WARNING) << "cannot write " << delta_.size()
+                   << " pending updates at once";
+      result = WriteDeltaOneByOne();
+    }
+    delta_.clear();
+    return GetStorage()->Sync() && result;
+  }
+
+  // Writes |delta_| to the storage one update at a time, so that an update
+  // rejected by the storage, e.g. a too long value, does not block the
+  // others. The rejected updates are dropped, and returns false if any.
+  bool WriteDeltaOneByOne() {
+    bool result = true;
+    for (Delta::const_iterator it = delta_.begin(); it != delta_.end(); ++it) {
+      string value;
+      const bool written = (it->second == NULL) ?
+          (GetStorage()->Erase(it->first) ||
+           !GetStorage()->Lookup(it->first, &value)) :
+          GetStorage()->Insert(it->first, *it->second);
+      if (!written) {
+        LOG(ERROR) << "cannot write the pending update of " << it->first;
+        // Stops serving the dropped update.
+        const bool found = GetStorage()->Lookup(it->first, &value);
+        UpdateSnapshot(it->first, found ? &value : NULL);
+        result = false;
+      }
+    }
+    return result;
+  }
+
+  // Returns NULL if the storage cannot provide a snapshot.
+  std::shared_ptr<const Snapshot> GetSnapshot() const {
+    return std::atomic_load(&snapshot_);
+  }
+
+  // Rebuilds the snapshot from the storage. Requires |g_mutex|.
+  void ResetSnapshot() {
+    std::shared_ptr<Snapshot> snapshot;
+    std::unique_ptr<StorageInterface::Iterator> iter(
+        GetStorage()->NewIterator());
+    if (iter.get() != NULL) {
+      snapshot.reset(new Snapshot);
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        (*snapshot)[iter->key().as_string()] = iter->value().as_string();
+      }
+    }
+    std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(snapshot));
+  }
+
+  // Publishes a copy of the current snapshot with |key| updated. |value|
+  // is NULL for erasure. Requires |g_mutex|.
+  void UpdateSnapshot(const string &key, const string *value) {
+    const std::shared_ptr<const Snapshot> current = GetSnapshot();
+    if (current == NULL) {
+      return;
+    }
+    std::shared_ptr<Snapshot> snapshot(new Snapshot(*current));
+    if (value == NULL) {
+      snapshot->erase(key);
+    } else {
+      (*snapshot)[key] = *value;
+    }
+    std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(snapshot));
   }
 
  private:
+  // Pending updates in the write-behind mode. NULL value means erasure.
+  typedef std::map<string, std::unique_ptr<string> > Delta;
+
   std::unique_ptr<StorageInterface> default_storage_;
   StorageInterface *current_storage_;
+  bool write_behind_;
+  // |delta_| is flushed when it has this number of keys.
+  size_t max_dirty_count_;
+  Delta delta_;
+  // Accessed only with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const Snapshot> snapshot_;
 };
+
+bool SyncJob(void *data) {
+  return Registry::Flush();
+}
 }  // namespace
 
 bool Registry::Erase(const string &key) {
   scoped_lock l(&g_mutex);
-  return Singleton<StorageInitializer>::get()->GetStorage()->Erase(key);
+  StorageInitializer *initializer = Singleton<StorageInitializer>::get();
+  if (initializer->write_behind()) {
+    string value;
+    if (!initializer->Lookup(key, &value)) {
+      return false;
+    }
+    initializer->UpdateSnapshot(key, NULL);
+    return initializer->AddDelta(key, NULL);
+  }
+  if (!initializer->GetStorage()->Erase(key)) {
+    return false;
+  }
+  initializer->UpdateSnapshot(key, NULL);
+  return true;
 }
 
 bool Registry::Sync() {
   scoped_lock l(&g_mutex);
-  return Singleton<StorageInitializer>::get()->GetStorage()->Sync();
+  StorageInitializer *initializer = Singleton<StorageInitializer>::get();
+  if (initializer->write_behind()) {
+    // Coalesced into the next sync job.
+    return true;
+  }
+  return initializer->GetStorage()->Sync();
+}
+
+bool Registry::Flush() {
+  scoped_lock l(&g_mutex);
+  return Singleton<StorageInitializer>::get()->FlushDelta();
 }
 
 // clear internal keys and values
 bool Registry::Clear() {
   scoped_lock l(&g_mutex);
-  return Singleton<StorageInitializer>::get()->GetStorage()->Clear();
+  StorageInitializer *initializer = Singleton<StorageInitializer>::get();
+  initializer->ClearDelta();
+  const bool result = initializer->GetStorage()->Clear();
+  initializer->ResetSnapshot();
+  return result;
+}
+
+bool Registry::EnableWriteBehind(uint32 sync_interval_msec,
+                                 size_t max_dirty_count) {
+  DCHECK_GT(sync_interval_msec, 0);
+  DCHECK_GT(max_dirty_count, 0);
+  // The job is removed without |g_mutex| since the removal waits for the
+  // running job, which takes |g_mutex|.
+  Scheduler::RemoveJob(kSyncJobName);
+  {
+    scoped_lock l(&g_mutex);
+    Singleton<StorageInitializer>::get()->EnableWriteBehind(max_dirty_count);
+  }
+  return Scheduler::AddJob(Scheduler::JobSetting(
+      kSyncJobName, sync_interval_msec,
+      sync_interval_msec * kMaxSyncBackoffFactor, sync_interval_msec, 0,
+      &SyncJob, NULL));
+}
+
+bool Registry::DisableWriteBehind() {
+  Scheduler::RemoveJob(kSyncJobName);
+  scoped_lock l(&g_mutex);
+  return Singleton<StorageInitializer>::get()->DisableWriteBehind();
 }
 
 void Registry::SetStorage(StorageInterface *handler) {
@@ -101,13 +311,34 @@ void Registry::SetStorage(StorageInterface *handler) {
 }
 
 bool Registry::LookupInternal(const string &key, string *value) {
-  scoped_lock l(&g_mutex);   // just for safe
-  return Singleton<StorageInitializer>::get()->GetStorage()->Lookup(key, value);
+  StorageInitializer *initializer = Singleton<StorageInitializer>::get();
+  const std::shared_ptr<const Snapshot> snapshot =
+      initializer->GetSnapshot();
+  if (snapshot == NULL) {
+    // The storage does not support iteration.
+    scoped_lock l(&g_mutex);
+    return initializer->Lookup(key, value);
+  }
+  Snapshot::const_iterator it = snapshot->find(key);
+  if (it == snapshot->end()) {
+    return false;
+  }
+  value->assign(it->second);
+  return true;
 }
 
 bool Registry::InsertInternal(const string &key, const string &value) {
   scoped_lock l(&g_mutex);
-  return Singleton<StorageInitializer>::get()->GetStorage()->Insert(key, value);
+  StorageInitializer *initializer = Singleton<StorageInitializer>::get();
+  if (initializer->write_behind()) {
+    initializer->UpdateSnapshot(key, &value);
+    return initializer->AddDelta(key, &value);
+  }
+  if (!initializer->GetStorage()->Insert(key, value)) {
+    return false;
+  }
+  initializer->UpdateSnapshot(key, &value);
+  return true;
 }
 }  // namespace storage
 }  // namespace gbase
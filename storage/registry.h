@@ -44,8 +44,9 @@ class StorageInterface;
 // The idea of Registry module is the same as Windows Registry.
 // You can use it for saving small data like timestamp, auth_token.
 // DO NOT USE it to save big data or data which are frequently updated.
-// Lookup() and Insert() do process-wide global lock and it may be slow.
-// All methods are thread-safe.
+// Insert() and Erase() do process-wide global lock and copy all the data
+// into a new snapshot, so they may be slow. Lookup() reads the latest
+// snapshot without the lock. All methods are thread-safe.
 //
 // TODO(taku): Currently, Registry won't guarantee that two processes
 // can con-currently share the same data. We will replace the backend
@@ -107,8 +108,26 @@ class Registry {
   }
 
   // Syncing the data into disk
+  // In the write-behind mode, the sync is left to the scheduled job.
   static bool Sync();
 
+  // Enables the write-behind mode. Insert() and Erase() only record the
+  // update in memory, and the pending updates are written to the storage
+  // as one batch and synced by a Scheduler job every |sync_interval_msec|,
+  // or immediately when |max_dirty_count| keys are pending. Note that
+  // Insert() cannot detect the failure of the storage in this mode.
+  // The pending updates are written by SingletonFinalizer::Finalize(),
+  // but not at the normal process exit, so call Flush() or
+  // DisableWriteBehind() before exiting without the finalizer.
+  static bool EnableWriteBehind(uint32 sync_interval_msec,
+                                size_t max_dirty_count);
+
+  // Flushes the pending updates and goes back to the write-through mode.
+  static bool DisableWriteBehind();
+
+  // Writes and syncs the pending updates of the write-behind mode now.
+  static bool Flush();
+
   // Erase key
   static bool Erase(const string &key);
 
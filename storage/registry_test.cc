@@ -27,16 +27,63 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <memory>
 #include <string>
 
 #include "storage/registry.h"
 #include "base/flags.h"
+#include "base/number_util.h"
+#include "base/scheduler.h"
+#include "base/scheduler_stub.h"
+#include "base/singleton.h"
+#include "base/thread.h"
+#include "storage/counting_storage.h"
+#include "storage/memory_storage.h"
+#include "storage/storage_interface.h"
+#include "storage/write_batch.h"
 #include "gtest/gtest.h"
 
 DEFINE_string(test_tmpdir, ".", "tmp file");
 
 namespace gbase {
 namespace storage {
+namespace {
+
+class LookupThread : public Thread {
+ public:
+  explicit LookupThread(int size) : size_(size), num_errors_(0) {}
+
+  virtual void Run() {
+    // Every key which has been seen once must be seen again.
+    int max_found = -1;
+    while (max_found < size_ - 1) {
+      for (int i = 0; i < size_; ++i) {
+        string value;
+        const bool found = Registry::Lookup(
+            "key" + NumberUtil::SimpleItoa(i), &value);
+        if (found && value != NumberUtil::SimpleItoa(i)) {
+          ++num_errors_;
+        }
+        if (!found && i <= max_found) {
+          ++num_errors_;
+        }
+        if (found && i > max_found) {
+          max_found = i;
+        }
+      }
+    }
+  }
+
+  int num_errors() const {
+    return num_errors_;
+  }
+
+ private:
+  const int size_;
+  int num_errors_;
+};
+
+}  // namespace
 
 TEST(RegistryTest, TinyStorageTest) {
 
@@ -89,5 +136,138 @@ TEST(RegistryTest, TinyStorageTest) {
     EXPECT_EQ(expected, value);
   }
 }
+
+TEST(RegistryTest, ConcurrentLookupTest) {
+  const int kSize = 200;
+  std::unique_ptr<StorageInterface> storage(MemoryStorage::New());
+  EXPECT_TRUE(storage->Insert("key0", "0"));
+  Registry::SetStorage(storage.get());
+  string value;
+  EXPECT_TRUE(Registry::Lookup("key0", &value));
+  EXPECT_EQ("0", value);
+
+  LookupThread thread(kSize);
+  thread.SetJoinable(true);
+  thread.Start("LookupThread");
+  for (int i = 1; i < kSize; ++i) {
+    EXPECT_TRUE(Registry::Insert("key" + NumberUtil::SimpleItoa(i),
+                                 NumberUtil::SimpleItoa(i)));
+  }
+  thread.Join();
+  EXPECT_EQ(0, thread.num_errors());
+
+  EXPECT_TRUE(Registry::Erase("key0"));
+  EXPECT_FALSE(Registry::Lookup("key0", &value));
+  EXPECT_TRUE(Registry::Clear());
+  EXPECT_FALSE(Registry::Lookup("key1", &value));
+  EXPECT_EQ(0, storage->Size());
+  Registry::SetStorage(NULL);
+}
+
+TEST(RegistryTest, WriteBehindTest) {
+  SchedulerStub scheduler_stub;
+  Scheduler::SetSchedulerHandler(&scheduler_stub);
+  CountingStorage storage;
+  Registry::SetStorage(&storage);
+  EXPECT_TRUE(Registry::Insert("erased", string("value")));
+  EXPECT_EQ(1, storage.num_writes());
+
+  EXPECT_TRUE(Registry::EnableWriteBehind(1000, 100));
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_TRUE(Registry::Insert("key", NumberUtil::SimpleItoa(i)));
+    EXPECT_TRUE(Registry::Sync());
+  }
+  EXPECT_TRUE(Registry::Erase("erased"));
+  EXPECT_FALSE(Registry::Erase("erased"));
+  EXPECT_FALSE(Registry::Erase("not_exist"));
+  string value;
+  EXPECT_TRUE(Registry::Lookup("key", &value));
+  EXPECT_EQ("49", value);
+  EXPECT_FALSE(Registry::Lookup("erased", &value));
+  // Nothing has been written yet.
+  EXPECT_EQ(1, storage.num_writes());
+  EXPECT_EQ(0, storage.num_syncs());
+  EXPECT_TRUE(storage.Lookup("erased", &value));
+
+  // The updates are written at once.
+  scheduler_stub.PutClockForward(1000);
+  EXPECT_EQ(2, storage.num_writes());
+  EXPECT_EQ(1, storage.num_syncs());
+  EXPECT_TRUE(storage.Lookup("key", &value));
+  EXPECT_EQ("49", value);
+  EXPECT_FALSE(storage.Lookup("erased", &value));
+
+  // No sync without updates.
+  scheduler_stub.PutClockForward(1000);
+  EXPECT_EQ(1, storage.num_syncs());
+
+  // Flushed when the number of dirty keys reaches the threshold.
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(Registry::Insert("key" + NumberUtil::SimpleItoa(i),
+                                 NumberUtil::SimpleItoa(i)));
+  }
+  EXPECT_EQ(3, storage.num_writes());
+  EXPECT_EQ(2, storage.num_syncs());
+  EXPECT_EQ(101, storage.Size());
+
+  EXPECT_TRUE(Registry::Insert("last", string("value")));
+  EXPECT_TRUE(Registry::DisableWriteBehind());
+  EXPECT_FALSE(scheduler_stub.HasJob("RegistrySync"));
+  EXPECT_TRUE(storage.Lookup("last", &value));
+  EXPECT_TRUE(Registry::Insert("direct", string("value")));
+  EXPECT_TRUE(storage.Lookup("direct", &value));
+
+  EXPECT_TRUE(Registry::Clear());
+  Registry::SetStorage(NULL);
+  Scheduler::SetSchedulerHandler(NULL);
+}
+
+TEST(RegistryTest, WriteBehindRejectedUpdateTest) {
+  SchedulerStub scheduler_stub;
+  Scheduler::SetSchedulerHandler(&scheduler_stub);
+  // The default TinyStorage rejects too long values.
+  Registry::SetStorage(NULL);
+  EXPECT_TRUE(Registry::Clear());
+  EXPECT_TRUE(Registry::EnableWriteBehind(1000, 100));
+  EXPECT_TRUE(Registry::Insert("valid", string("value")));
+  EXPECT_TRUE(Registry::Insert("too_long", string(10000, 'x')));
+
+  // The rejected update is dropped, and the others are written.
+  EXPECT_FALSE(Registry::Flush());
+  string value;
+  EXPECT_TRUE(Registry::Lookup("valid", &value));
+  EXPECT_FALSE(Registry::Lookup("too_long", &value));
+
+  // The following updates are not blocked.
+  EXPECT_TRUE(Registry::Insert("later", string("value")));
+  EXPECT_TRUE(Registry::Flush());
+  EXPECT_TRUE(Registry::DisableWriteBehind());
+
+  // Rebuilds the snapshot from the storage.
+  Registry::SetStorage(NULL);
+  EXPECT_TRUE(Registry::Lookup("valid", &value));
+  EXPECT_TRUE(Registry::Lookup("later", &value));
+  EXPECT_FALSE(Registry::Lookup("too_long", &value));
+
+  EXPECT_TRUE(Registry::Clear());
+  Scheduler::SetSchedulerHandler(NULL);
+}
+
+TEST(RegistryTest, WriteBehindFinalizeTest) {
+  SchedulerStub scheduler_stub;
+  Scheduler::SetSchedulerHandler(&scheduler_stub);
+  CountingStorage storage;
+  Registry::SetStorage(&storage);
+  EXPECT_TRUE(Registry::EnableWriteBehind(1000, 100));
+  EXPECT_TRUE(Registry::Insert("key", string("value")));
+  string value;
+  EXPECT_FALSE(storage.Lookup("key", &value));
+
+  // The pending update is written when the singleton is finalized.
+  SingletonFinalizer::Finalize();
+  EXPECT_TRUE(storage.Lookup("key", &value));
+  EXPECT_EQ("value", value);
+  Scheduler::SetSchedulerHandler(NULL);
+}
 }  // namespace storage
 }  // namespace gbase
@@ -31,19 +31,48 @@
 #define GBASE_STORAGE_SIMPLE_LRU_CACHE_H_
 
 #include <cstring>
-#include <map>
+#include <functional>
+#include <memory>
 #include <string>
+#include <utility>
 
+#include "base/hash.h"
 #include "base/logging.h"
+#include "base/mutex.h"
 #include "base/port.h"
+#include "base/string_piece.h"
 
 namespace gbase {
 namespace storage {
 
+// Default hash function of SimpleLRUCache.
+template<typename Key>
+struct SimpleLRUCacheHash {
+  size_t operator()(const Key &key) const {
+    return std::hash<Key>()(key);
+  }
+};
+
+// String keys can be looked up by StringPiece without constructing a
+// string.
+template<>
+struct SimpleLRUCacheHash<string> {
+  size_t operator()(const StringPiece &key) const {
+    return static_cast<size_t>(Hash::Fingerprint(key));
+  }
+};
+
 // Note: this class keeps some resources inside of the Key/Value, even if
 // such a entry is erased. Be careful to use for such classes.
+//
+// Elements are indexed by an open-addressing hash table with linear
+// probing, whose slots point to the elements in the blocks, so that no
+// allocation happens per insertion.
+// The methods taking |LookupKey| accept any type which |Hasher| and
+// operator== with Key accept, e.g. StringPiece for string keys.
 // TODO(yukawa): Make this class final once we stop supporting GCC 4.6.
-template<typename Key, typename Value>
+template<typename Key, typename Value,
+         typename Hasher = SimpleLRUCacheHash<Key> >
 class SimpleLRUCache {
  public:
   // Constructs a new LRUCache that can hold at most max_elements
@@ -58,14 +87,32 @@ class SimpleLRUCache {
   struct Element {
     Element* next;
     Element* prev;
+    // Hash value of |key|, which is kept to skip the key comparisons and
+    // the rehash.
+    size_t hash;
     Key key;
     Value value;
   };
 
+  // Called with the key and the value of an entry which leaves the cache by
+  // the eviction, Erase(), Clear() or the overwrite by Insert(). The
+  // callback may move the value out, e.g. to recycle a buffer, but must not
+  // call the methods of the cache.
+  typedef std::function<void(const Key &key, Value *value)> EvictionCallback;
+
   // Adds the specified key/value pair into the cache, putting it at the head
   // of the LRU list.
   void Insert(const Key &key, const Value& value);
 
+  // Same as above, but moves |value| into the cache. Value can be a
+  // move-only type if the copying Insert() is not used.
+  void Insert(const Key &key, Value &&value);
+
+  // Constructs the value from |args| and moves it into the cache. Returns
+  // the cached value.
+  template<typename... Args>
+  Value *Emplace(const Key &key, Args&&... args);
+
   // Adds the specified key and return the Element added to the cache.
   // Caller needs to set the value
   Element* Insert(const Key &key);
@@ -75,18 +122,23 @@ class SimpleLRUCache {
   // ownership of the returned value.  The reference returned by Lookup() could
   // be invalidated by a call to Insert(), so the caller must take care to not
   // access the value if Insert() could have been called after Lookup().
-  const Value* Lookup(const Key &key);
+  template<typename LookupKey>
+  const Value* Lookup(const LookupKey &key);
 
   // return non-const Value
-  Value *MutableLookup(const Key &key);
+  template<typename LookupKey>
+  Value *MutableLookup(const LookupKey &key);
 
   // Lookup/MutableLookup don't change the LRU order.
-  const Value *LookupWithoutInsert(const Key &key) const;
-  Value *MutableLookupWithoutInsert(const Key &key) const;
+  template<typename LookupKey>
+  const Value *LookupWithoutInsert(const LookupKey &key) const;
+  template<typename LookupKey>
+  Value *MutableLookupWithoutInsert(const LookupKey &key) const;
 
   // Removes the cache entry specified by key.  Returns true if the entry was
   // in the cache, otherwise returns false.
-  bool Erase(const Key &key);
+  template<typename LookupKey>
+  bool Erase(const LookupKey &key);
 
   // Removes all entries from the cache.  Note that this does not release the
   // memory associates with the blocks, but just pushes all the elements onto
@@ -96,7 +148,12 @@ class SimpleLRUCache {
   // Returns the number of entries currently in the cache.
   size_t Size() const;
 
-  bool HasKey(const Key &key) const;
+  template<typename LookupKey>
+  bool HasKey(const LookupKey &key) const;
+
+  void set_eviction_callback(const EvictionCallback &callback) {
+    eviction_callback_ = callback;
+  }
 
   // Returns the head of LRU list
   const Element *Head() const { return lru_head_; }
@@ -124,7 +181,18 @@ class SimpleLRUCache {
 
   // Returns the Element* associated with key, or NULL if no element with this
   // key is found.
-  Element* LookupInternal(const Key &key) const;
+  template<typename LookupKey>
+  Element* LookupInternal(const LookupKey &key) const;
+
+  // Adds |element| whose hash is set to the hash table.
+  void AddToTable(Element* element);
+
+  // Removes |element| from the hash table.
+  void RemoveFromTable(Element* element);
+
+  // Resizes the hash table to have at least twice as many slots as
+  // block_capacity_.
+  void ResizeTable();
 
   // Removes the specified element from the LRU list.
   void RemoveFromLRU(Element* element);
@@ -137,9 +205,10 @@ class SimpleLRUCache {
   // lookup is not necessary.
   bool Evict(Element* element);
 
-  typedef std::map<Key, Element*> Table;
-
-  Table* table_;
+  Element** table_;        // slots of the hash table, NULL if empty
+  size_t table_mask_;      // number of slots - 1
+  size_t size_;            // number of elements in the hash table
+  Hasher hasher_;
   Element* free_list_;     // singly linked list of Element
   Element* lru_head_;      // head of doubly linked list of Element
   Element* lru_tail_;      // tail of doubly linked list of Element
@@ -155,13 +224,14 @@ class SimpleLRUCache {
   size_t block_capacity_;   // how many Elements can be stored in current blocks
   size_t next_block_size_;  // size of the next block to allocate
   size_t max_elements_;     // maximum elements to hold
+  EvictionCallback eviction_callback_;
 
   DISALLOW_COPY_AND_ASSIGN(SimpleLRUCache);
 };
 
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::AddBlock() {
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::AddBlock() {
   const size_t max_blocks = sizeof(blocks_) / sizeof(blocks_[0]);
   if (block_count_ < max_blocks && block_capacity_ < max_elements_) {
     blocks_[block_count_] = new Element[next_block_size_];
@@ -174,6 +244,7 @@ void SimpleLRUCache<Key, Value>::AddBlock() {
       free_list_ = e;
     }
     block_count_++;
+    ResizeTable();
     size_t blocks_remaining = max_blocks - block_count_;
     if (blocks_remaining > 0) {
       next_block_size_ = (next_block_size_ << 1);
@@ -188,16 +259,16 @@ void SimpleLRUCache<Key, Value>::AddBlock() {
   }
 }
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::PushFreeList(Element* element) {
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::PushFreeList(Element* element) {
   element->prev = NULL;
   element->next = free_list_;
   free_list_ = element;
 }
 
-template<typename Key, typename Value>
-typename SimpleLRUCache<Key, Value>::Element*
-SimpleLRUCache<Key, Value>::PopFreeList() {
+template<typename Key, typename Value, typename Hasher>
+typename SimpleLRUCache<Key, Value, Hasher>::Element*
+SimpleLRUCache<Key, Value, Hasher>::PopFreeList() {
   Element* r = free_list_;
   if (r != NULL) {
     CHECK(r->prev == NULL);
@@ -210,9 +281,9 @@ SimpleLRUCache<Key, Value>::PopFreeList() {
   return r;
 }
 
-template<typename Key, typename Value>
-typename SimpleLRUCache<Key, Value>::Element*
-SimpleLRUCache<Key, Value>::NextFreeElement() {
+template<typename Key, typename Value, typename Hasher>
+typename SimpleLRUCache<Key, Value, Hasher>::Element*
+SimpleLRUCache<Key, Value, Hasher>::NextFreeElement() {
   Element* r = PopFreeList();
   if (r == NULL) {
     AddBlock();
@@ -221,18 +292,79 @@ SimpleLRUCache<Key, Value>::NextFreeElement() {
   return r;
 }
 
-template<typename Key, typename Value>
-typename SimpleLRUCache<Key, Value>::Element*
-SimpleLRUCache<Key, Value>::LookupInternal(const Key &key) const {
-  typename Table::iterator iter = table_->find(key);
-  if (iter != table_->end()) {
-    return iter->second;
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+typename SimpleLRUCache<Key, Value, Hasher>::Element*
+SimpleLRUCache<Key, Value, Hasher>::LookupInternal(
+    const LookupKey &key) const {
+  if (table_ == NULL) {
+    return NULL;
+  }
+  const size_t hash = hasher_(key);
+  for (size_t i = hash & table_mask_; table_[i] != NULL;
+       i = (i + 1) & table_mask_) {
+    if (table_[i]->hash == hash && table_[i]->key == key) {
+      return table_[i];
+    }
   }
   return NULL;
 }
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::RemoveFromLRU(Element* element) {
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::AddToTable(Element* element) {
+  size_t i = element->hash & table_mask_;
+  while (table_[i] != NULL) {
+    i = (i + 1) & table_mask_;
+  }
+  table_[i] = element;
+  ++size_;
+}
+
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::RemoveFromTable(Element* element) {
+  size_t i = element->hash & table_mask_;
+  while (table_[i] != element) {
+    CHECK(table_[i] != NULL);
+    i = (i + 1) & table_mask_;
+  }
+  // Shifts the following elements of the probe sequence backward instead
+  // of leaving a tombstone.
+  table_[i] = NULL;
+  for (size_t j = (i + 1) & table_mask_; table_[j] != NULL;
+       j = (j + 1) & table_mask_) {
+    // The element at |j| can move to |i| unless its home slot is in the
+    // cyclic range (i, j].
+    const size_t home = table_[j]->hash & table_mask_;
+    if (((j - home) & table_mask_) >= ((j - i) & table_mask_)) {
+      table_[i] = table_[j];
+      table_[j] = NULL;
+      i = j;
+    }
+  }
+  --size_;
+}
+
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::ResizeTable() {
+  size_t num_slots = 16;
+  while (num_slots < block_capacity_ * 2) {
+    num_slots <<= 1;
+  }
+  if (table_ != NULL && num_slots == table_mask_ + 1) {
+    return;
+  }
+  delete [] table_;
+  table_ = new Element*[num_slots];
+  ::memset(table_, 0, sizeof(table_[0]) * num_slots);
+  table_mask_ = num_slots - 1;
+  size_ = 0;
+  for (Element* e = lru_head_; e != NULL; e = e->next) {
+    AddToTable(e);
+  }
+}
+
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::RemoveFromLRU(Element* element) {
   if (lru_head_ == element) {
     lru_head_ = element->next;
   }
@@ -249,8 +381,8 @@ void SimpleLRUCache<Key, Value>::RemoveFromLRU(Element* element) {
   element->next = NULL;
 }
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::PushLRUHead(Element* element) {
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::PushLRUHead(Element* element) {
   if (lru_head_ == element) {
     // element is already at head, so do nothing.
     return;
@@ -266,11 +398,13 @@ void SimpleLRUCache<Key, Value>::PushLRUHead(Element* element) {
   }
 }
 
-template<typename Key, typename Value>
-bool SimpleLRUCache<Key, Value>::Evict(Element* e) {
+template<typename Key, typename Value, typename Hasher>
+bool SimpleLRUCache<Key, Value, Hasher>::Evict(Element* e) {
   if (e != NULL) {
-    int erased = table_->erase(e->key);
-    CHECK_EQ(erased, 1);
+    if (eviction_callback_) {
+      eviction_callback_(e->key, &e->value);
+    }
+    RemoveFromTable(e);
     RemoveFromLRU(e);
     PushFreeList(e);
     return true;
@@ -278,17 +412,18 @@ bool SimpleLRUCache<Key, Value>::Evict(Element* e) {
   return false;
 }
 
-template<typename Key, typename Value>
-SimpleLRUCache<Key, Value>::SimpleLRUCache(size_t max_elements)
-  : free_list_(NULL),
+template<typename Key, typename Value, typename Hasher>
+SimpleLRUCache<Key, Value, Hasher>::SimpleLRUCache(size_t max_elements)
+  : table_(NULL),
+    table_mask_(0),
+    size_(0),
+    free_list_(NULL),
     lru_head_(NULL),
     lru_tail_(NULL),
     block_count_(0),
     block_capacity_(0),
     max_elements_(max_elements) {
   ::memset(blocks_, 0, sizeof(blocks_));
-  table_ = new Table;
-  CHECK(table_);
   if (max_elements_ <= 128) {
     next_block_size_ = max_elements_;
   } else {
@@ -305,18 +440,18 @@ SimpleLRUCache<Key, Value>::SimpleLRUCache(size_t max_elements)
   }
 }
 
-template<typename Key, typename Value>
-SimpleLRUCache<Key, Value>::~SimpleLRUCache() {
+template<typename Key, typename Value, typename Hasher>
+SimpleLRUCache<Key, Value, Hasher>::~SimpleLRUCache() {
   // To free all the memory that I have allocated I need to delete table_ and
   // any used entries in blocks_.
-  delete table_;
+  delete [] table_;
   for (size_t i = 0; i < block_count_; ++i) {
     delete [] blocks_[i];
   }
 }
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::Insert(const Key& key,
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::Insert(const Key& key,
                                   const Value& value) {
   Element *e = Insert(key);
   if (e != NULL) {
@@ -324,9 +459,30 @@ void SimpleLRUCache<Key, Value>::Insert(const Key& key,
   }
 }
 
-template<typename Key, typename Value>
-typename SimpleLRUCache<Key, Value>::Element *
-SimpleLRUCache<Key, Value>::Insert(const Key& key) {
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::Insert(const Key& key,
+                                                Value&& value) {
+  Element *e = Insert(key);
+  if (e != NULL) {
+    e->value = std::move(value);
+  }
+}
+
+template<typename Key, typename Value, typename Hasher>
+template<typename... Args>
+Value* SimpleLRUCache<Key, Value, Hasher>::Emplace(const Key& key,
+                                                   Args&&... args) {
+  Element *e = Insert(key);
+  if (e == NULL) {
+    return NULL;
+  }
+  e->value = Value(std::forward<Args>(args)...);
+  return &(e->value);
+}
+
+template<typename Key, typename Value, typename Hasher>
+typename SimpleLRUCache<Key, Value, Hasher>::Element *
+SimpleLRUCache<Key, Value, Hasher>::Insert(const Key& key) {
   bool erased = false;
   Element* e = LookupInternal(key);
   if (e != NULL) {
@@ -344,14 +500,17 @@ SimpleLRUCache<Key, Value>::Insert(const Key& key) {
     CHECK(e != NULL);
   }
   e->key = key;
-  (*table_)[key] = e;
+  e->hash = hasher_(e->key);
+  AddToTable(e);
   PushLRUHead(e);
 
   return e;
 }
 
-template<typename Key, typename Value>
-Value* SimpleLRUCache<Key, Value>::MutableLookup(const Key& key) {
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+Value* SimpleLRUCache<Key, Value, Hasher>::MutableLookup(
+    const LookupKey& key) {
   Element* e = LookupInternal(key);
   if (e != NULL) {
     PushLRUHead(e);
@@ -360,13 +519,16 @@ Value* SimpleLRUCache<Key, Value>::MutableLookup(const Key& key) {
   return NULL;
 }
 
-template<typename Key, typename Value>
-const Value* SimpleLRUCache<Key, Value>::Lookup(const Key& key) {
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+const Value* SimpleLRUCache<Key, Value, Hasher>::Lookup(const LookupKey& key) {
   return MutableLookup(key);
 }
 
-template<typename Key, typename Value>
-Value* SimpleLRUCache<Key, Value>::MutableLookupWithoutInsert(const Key& key) const {
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+Value* SimpleLRUCache<Key, Value, Hasher>::MutableLookupWithoutInsert(
+    const LookupKey& key) const {
   Element *e = LookupInternal(key);
   if (e != NULL) {
     return &(e->value);
@@ -374,37 +536,221 @@ Value* SimpleLRUCache<Key, Value>::MutableLookupWithoutInsert(const Key& key) co
   return NULL;
 }
 
-template<typename Key, typename Value>
-const Value* SimpleLRUCache<Key, Value>::LookupWithoutInsert(const Key& key) const {
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+const Value* SimpleLRUCache<Key, Value, Hasher>::LookupWithoutInsert(
+    const LookupKey& key) const {
   return MutableLookupWithoutInsert(key);
 }
 
-template<typename Key, typename Value>
-bool SimpleLRUCache<Key, Value>::Erase(const Key& key) {
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+bool SimpleLRUCache<Key, Value, Hasher>::Erase(const LookupKey& key) {
   Element* e = LookupInternal(key);
   return Evict(e);
 }
 
-template<typename Key, typename Value>
-void SimpleLRUCache<Key, Value>::Clear() {
-  table_->clear();
+template<typename Key, typename Value, typename Hasher>
+void SimpleLRUCache<Key, Value, Hasher>::Clear() {
+  if (table_ != NULL) {
+    ::memset(table_, 0, sizeof(table_[0]) * (table_mask_ + 1));
+  }
+  size_ = 0;
   Element* e = lru_head_;
   while (e != NULL) {
     Element* next = e->next;
+    if (eviction_callback_) {
+      eviction_callback_(e->key, &e->value);
+    }
     PushFreeList(e);
     e = next;
   }
   lru_head_ = lru_tail_ = NULL;
 }
 
-template<typename Key, typename Value>
-bool SimpleLRUCache<Key, Value>::HasKey(const Key& key) const {
-  return (table_->find(key) != table_->end());
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+bool SimpleLRUCache<Key, Value, Hasher>::HasKey(const LookupKey& key) const {
+  return (LookupInternal(key) != NULL);
+}
+
+template<typename Key, typename Value, typename Hasher>
+size_t SimpleLRUCache<Key, Value, Hasher>::Size() const {
+  return size_;
 }
 
-template<typename Key, typename Value>
-size_t SimpleLRUCache<Key, Value>::Size() const {
-  return table_->size();
+// Thread-safe variant of SimpleLRUCache.
+// The keys are distributed over |num_stripes| SimpleLRUCaches, each guarded
+// by its own mutex, so the LRU order is kept per stripe. The values are
+// held by shared_ptr, and the value returned by Lookup() stays valid even
+// if the entry is erased or evicted meanwhile.
+template<typename Key, typename Value,
+         typename Hasher = SimpleLRUCacheHash<Key> >
+class ConcurrentSimpleLRUCache {
+ public:
+  // Holds at most max_elements, rounded up to a multiple of num_stripes.
+  explicit ConcurrentSimpleLRUCache(size_t max_elements);
+  ConcurrentSimpleLRUCache(size_t max_elements, size_t num_stripes);
+
+  void Insert(const Key &key, const Value &value);
+  void Insert(const Key &key, Value &&value);
+
+  // Returns NULL if the cache does not contain an entry for the key.
+  template<typename LookupKey>
+  std::shared_ptr<const Value> Lookup(const LookupKey &key);
+
+  // Doesn't change the LRU order.
+  template<typename LookupKey>
+  std::shared_ptr<const Value> LookupWithoutInsert(const LookupKey &key) const;
+
+  template<typename LookupKey>
+  bool Erase(const LookupKey &key);
+
+  template<typename LookupKey>
+  bool HasKey(const LookupKey &key) const;
+
+  void Clear();
+
+  size_t Size() const;
+
+ private:
+  typedef SimpleLRUCache<Key, std::shared_ptr<const Value>, Hasher> Cache;
+
+  struct Stripe {
+    Mutex mutex;
+    std::unique_ptr<Cache> cache;
+  };
+
+  static const size_t kDefaultNumStripes = 16;
+
+  void Init(size_t max_elements);
+
+  // The hash is remixed since the low bits of the hash select the slot in
+  // the stripe.
+  template<typename LookupKey>
+  Stripe *GetStripe(const LookupKey &key) const {
+    return &stripes_[Hash::Fingerprint(
+        static_cast<uint64>(hasher_(key))) % num_stripes_];
+  }
+
+  const size_t num_stripes_;
+  Hasher hasher_;
+  std::unique_ptr<Stripe[]> stripes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentSimpleLRUCache);
+};
+
+template<typename Key, typename Value, typename Hasher>
+ConcurrentSimpleLRUCache<Key, Value, Hasher>::ConcurrentSimpleLRUCache(
+    size_t max_elements)
+    : num_stripes_(kDefaultNumStripes) {
+  Init(max_elements);
+}
+
+template<typename Key, typename Value, typename Hasher>
+ConcurrentSimpleLRUCache<Key, Value, Hasher>::ConcurrentSimpleLRUCache(
+    size_t max_elements, size_t num_stripes)
+    : num_stripes_(num_stripes) {
+  Init(max_elements);
+}
+
+template<typename Key, typename Value, typename Hasher>
+void ConcurrentSimpleLRUCache<Key, Value, Hasher>::Init(size_t max_elements) {
+  CHECK_GT(num_stripes_, 0);
+  const size_t stripe_size = (max_elements + num_stripes_ - 1) / num_stripes_;
+  stripes_.reset(new Stripe[num_stripes_]);
+  for (size_t i = 0; i < num_stripes_; ++i) {
+    stripes_[i].cache.reset(new Cache(stripe_size));
+  }
+}
+
+template<typename Key, typename Value, typename Hasher>
+void ConcurrentSimpleLRUCache<Key, Value, Hasher>::Insert(
+    const Key &key, const Value &value) {
+  // The value is constructed out of the lock.
+  std::shared_ptr<const Value> shared(new Value(value));
+  Stripe *stripe = GetStripe(key);
+  scoped_lock l(&stripe->mutex);
+  stripe->cache->Insert(key, std::move(shared));
+}
+
+template<typename Key, typename Value, typename Hasher>
+void ConcurrentSimpleLRUCache<Key, Value, Hasher>::Insert(
+    const Key &key, Value &&value) {
+  std::shared_ptr<const Value> shared(new Value(std::move(value)));
+  Stripe *stripe = GetStripe(key);
+  scoped_lock l(&stripe->mutex);
+  stripe->cache->Insert(key, std::move(shared));
+}
+
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+std::shared_ptr<const Value>
+ConcurrentSimpleLRUCache<Key, Value, Hasher>::Lookup(const LookupKey &key) {
+  Stripe *stripe = GetStripe(key);
+  scoped_lock l(&stripe->mutex);
+  const std::shared_ptr<const Value> *value = stripe->cache->Lookup(key);
+  return value == NULL ? std::shared_ptr<const Value>() : *value;
+}
+
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+std::shared_ptr<const Value>
+ConcurrentSimpleLRUCache<Key, Value, Hasher>::LookupWithoutInsert(
+    const LookupKey &key) const {
+  Stripe *stripe = GetStripe(key);
+  scoped_lock l(&stripe->mutex);
+  const std::shared_ptr<const Value> *value =
+      stripe->cache->LookupWithoutInsert(key);
+  return value == NULL ? std::shared_ptr<const Value>() : *value;
+}
+
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+bool ConcurrentSimpleLRUCache<Key, Value, Hasher>::Erase(const LookupKey &key) {
+  Stripe *stripe = GetStripe(key);
+  // The value is released after the lock unless it is still referred.
+  std::shared_ptr<const Value> erased;
+  scoped_lock l(&stripe->mutex);
+  std::shared_ptr<const Value> *value =
+      stripe->cache->MutableLookupWithoutInsert(key);
+  if (value == NULL) {
+    return false;
+  }
+  erased.swap(*value);
+  return stripe->cache->Erase(key);
+}
+
+template<typename Key, typename Value, typename Hasher>
+template<typename LookupKey>
+bool ConcurrentSimpleLRUCache<Key, Value, Hasher>::HasKey(
+    const LookupKey &key) const {
+  Stripe *stripe = GetStripe(key);
+  scoped_lock l(&stripe->mutex);
+  return stripe->cache->HasKey(key);
+}
+
+template<typename Key, typename Value, typename Hasher>
+void ConcurrentSimpleLRUCache<Key, Value, Hasher>::Clear() {
+  for (size_t i = 0; i < num_stripes_; ++i) {
+    scoped_lock l(&stripes_[i].mutex);
+    // SimpleLRUCache keeps the values of the free elements.
+    for (typename Cache::Element *e = stripes_[i].cache->MutableHead();
+         e != NULL; e = e->next) {
+      e->value.reset();
+    }
+    stripes_[i].cache->Clear();
+  }
+}
+
+template<typename Key, typename Value, typename Hasher>
+size_t ConcurrentSimpleLRUCache<Key, Value, Hasher>::Size() const {
+  size_t size = 0;
+  for (size_t i = 0; i < num_stripes_; ++i) {
+    scoped_lock l(&stripes_[i].mutex);
+    size += stripes_[i].cache->Size();
+  }
+  return size;
 }
 
 }  // namespace storage
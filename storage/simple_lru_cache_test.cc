@@ -0,0 +1,251 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/simple_lru_cache.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/number_util.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "base/thread.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+class CacheThread : public Thread {
+ public:
+  explicit CacheThread(ConcurrentSimpleLRUCache<string, string> *cache)
+      : cache_(cache), num_errors_(0) {}
+
+  virtual void Run() {
+    for (int i = 0; i < 10000; ++i) {
+      const string key = NumberUtil::SimpleItoa(i % 300);
+      const std::shared_ptr<const string> value = cache_->Lookup(key);
+      if (value == NULL) {
+        cache_->Insert(key, key);
+      } else if (*value != key) {
+        ++num_errors_;
+      }
+      if (i % 7 == 0) {
+        cache_->Erase(key);
+      }
+    }
+  }
+
+  int num_errors() const {
+    return num_errors_;
+  }
+
+ private:
+  ConcurrentSimpleLRUCache<string, string> *cache_;
+  int num_errors_;
+};
+
+}  // namespace
+
+TEST(SimpleLRUCacheTest, BasicTest) {
+  SimpleLRUCache<int, int> cache(3);
+  EXPECT_EQ(0, cache.Size());
+  EXPECT_TRUE(cache.Lookup(1) == NULL);
+  cache.Insert(1, 10);
+  cache.Insert(2, 20);
+  cache.Insert(3, 30);
+  EXPECT_EQ(3, cache.Size());
+  ASSERT_TRUE(cache.Lookup(1) != NULL);
+  EXPECT_EQ(10, *cache.Lookup(1));
+
+  // 2 is the least recently used.
+  cache.Insert(4, 40);
+  EXPECT_EQ(3, cache.Size());
+  EXPECT_FALSE(cache.HasKey(2));
+  EXPECT_TRUE(cache.HasKey(1));
+  EXPECT_EQ(4, cache.Head()->key);
+  EXPECT_EQ(3, cache.Tail()->key);
+
+  // LookupWithoutInsert doesn't change the order.
+  ASSERT_TRUE(cache.LookupWithoutInsert(3) != NULL);
+  EXPECT_EQ(3, cache.Tail()->key);
+
+  // Overwrite.
+  cache.Insert(3, 31);
+  EXPECT_EQ(31, *cache.Lookup(3));
+  EXPECT_EQ(3, cache.Size());
+
+  EXPECT_TRUE(cache.Erase(3));
+  EXPECT_FALSE(cache.Erase(3));
+  EXPECT_EQ(2, cache.Size());
+  cache.Clear();
+  EXPECT_EQ(0, cache.Size());
+  EXPECT_TRUE(cache.Lookup(1) == NULL);
+  cache.Insert(5, 50);
+  EXPECT_EQ(50, *cache.Lookup(5));
+}
+
+TEST(SimpleLRUCacheTest, StringPieceLookupTest) {
+  SimpleLRUCache<string, int> cache(10);
+  cache.Insert("abc", 1);
+  const string buf = "xabcx";
+  const StringPiece key(buf.data() + 1, 3);
+  ASSERT_TRUE(cache.Lookup(key) != NULL);
+  EXPECT_EQ(1, *cache.Lookup(key));
+  EXPECT_TRUE(cache.HasKey("abc"));
+  EXPECT_FALSE(cache.HasKey(StringPiece(buf.data(), 3)));
+  EXPECT_TRUE(cache.Erase(key));
+  EXPECT_FALSE(cache.HasKey("abc"));
+}
+
+TEST(SimpleLRUCacheTest, RandomTest) {
+  // Compares with the model of the LRU order, so that the erasure from
+  // the hash table is tested with the long probe sequences.
+  const int kCapacity = 1000;
+  SimpleLRUCache<string, int> cache(kCapacity);
+  std::map<string, int> last_access;
+  std::map<int, string> order;
+  for (int i = 0; i < 100000; ++i) {
+    const string key = NumberUtil::SimpleItoa((i * 7919) % 3000);
+    if (i % 5 == 0) {
+      cache.Erase(key);
+      if (last_access.count(key) > 0) {
+        order.erase(last_access[key]);
+        last_access.erase(key);
+      }
+    } else {
+      cache.Insert(key, i);
+      if (last_access.count(key) > 0) {
+        order.erase(last_access[key]);
+      }
+      last_access[key] = i;
+      order[i] = key;
+      if (order.size() > kCapacity) {
+        last_access.erase(order.begin()->second);
+        order.erase(order.begin());
+      }
+    }
+    ASSERT_EQ(order.size(), cache.Size());
+  }
+  for (std::map<string, int>::const_iterator it = last_access.begin();
+       it != last_access.end(); ++it) {
+    const int *value = cache.LookupWithoutInsert(it->first);
+    ASSERT_TRUE(value != NULL);
+    EXPECT_EQ(it->second, *value);
+  }
+}
+
+TEST(SimpleLRUCacheTest, MoveOnlyValueTest) {
+  SimpleLRUCache<int, std::unique_ptr<string> > cache(2);
+  std::vector<std::unique_ptr<string> > pool;
+  std::vector<int> evicted_keys;
+  cache.set_eviction_callback(
+      [&pool, &evicted_keys](const int &key, std::unique_ptr<string> *value) {
+        evicted_keys.push_back(key);
+        pool.push_back(std::move(*value));
+      });
+
+  std::unique_ptr<string> buffer(new string("buffer1"));
+  const string *buffer_ptr = buffer.get();
+  cache.Insert(1, std::move(buffer));
+  std::unique_ptr<string> *value = cache.Emplace(2, new string("buffer2"));
+  ASSERT_TRUE(value != NULL);
+  EXPECT_EQ("buffer2", **value);
+  ASSERT_TRUE(cache.Lookup(1) != NULL);
+  EXPECT_EQ(buffer_ptr, cache.Lookup(1)->get());
+  EXPECT_TRUE(evicted_keys.empty());
+
+  // 2 is evicted and its buffer is recycled.
+  cache.Emplace(3, new string("buffer3"));
+  ASSERT_EQ(1, evicted_keys.size());
+  EXPECT_EQ(2, evicted_keys[0]);
+  ASSERT_EQ(1, pool.size());
+  EXPECT_EQ("buffer2", *pool[0]);
+
+  // Overwrite, Erase and Clear.
+  cache.Emplace(3, new string("buffer3.new"));
+  EXPECT_TRUE(cache.Erase(1));
+  cache.Clear();
+  ASSERT_EQ(4, evicted_keys.size());
+  EXPECT_EQ(3, evicted_keys[1]);
+  EXPECT_EQ("buffer3", *pool[1]);
+  EXPECT_EQ(1, evicted_keys[2]);
+  EXPECT_EQ(buffer_ptr, pool[2].get());
+  EXPECT_EQ(3, evicted_keys[3]);
+  EXPECT_EQ("buffer3.new", *pool[3]);
+}
+
+TEST(ConcurrentSimpleLRUCacheTest, BasicTest) {
+  ConcurrentSimpleLRUCache<string, string> cache(4, 2);
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  cache.Insert("a", "1");
+  std::shared_ptr<const string> value = cache.Lookup("a");
+  ASSERT_TRUE(value != NULL);
+  EXPECT_EQ("1", *value);
+  EXPECT_TRUE(cache.HasKey(StringPiece("a")));
+  EXPECT_EQ(1, cache.Size());
+
+  // The value is valid after the entry is erased.
+  EXPECT_TRUE(cache.Erase("a"));
+  EXPECT_FALSE(cache.Erase("a"));
+  EXPECT_EQ("1", *value);
+  EXPECT_TRUE(cache.LookupWithoutInsert("a") == NULL);
+
+  for (int i = 0; i < 100; ++i) {
+    cache.Insert(NumberUtil::SimpleItoa(i), NumberUtil::SimpleItoa(i));
+  }
+  EXPECT_GE(4, cache.Size());
+  value = cache.Lookup("99");
+  ASSERT_TRUE(value != NULL);
+  EXPECT_EQ("99", *value);
+  cache.Clear();
+  EXPECT_EQ(0, cache.Size());
+  EXPECT_EQ("99", *value);
+}
+
+TEST(ConcurrentSimpleLRUCacheTest, ThreadTest) {
+  const int kNumThreads = 8;
+  ConcurrentSimpleLRUCache<string, string> cache(100);
+  std::vector<std::unique_ptr<CacheThread> > threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back(new CacheThread(&cache));
+    threads.back()->SetJoinable(true);
+    threads.back()->Start("CacheThread");
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads[i]->Join();
+    EXPECT_EQ(0, threads[i]->num_errors());
+  }
+  EXPECT_GE(112, cache.Size());
+}
+
+}  // namespace storage
+}  // namespace gbase
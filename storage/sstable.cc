@@ -0,0 +1,866 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/sstable.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/bloom_filter.h"
+#include "base/coding.h"
+#include "base/file_stream.h"
+#include "base/file_util.h"
+#include "base/logging.h"
+#include "base/mmap.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "encoding/crc32c.h"
+#include "storage/lru_cache.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+const uint64 kSSTableMagicNumber = 0xdb4775248b80fb57ULL;  // random seed
+const size_t kFooterSize = 40;
+// Masked crc32c after each block.
+const size_t kBlockTrailerSize = 4;
+const size_t kDefaultBlockSize = 4096;
+const int kDefaultBlockRestartInterval = 16;
+
+class BlockBuilder {
+ public:
+  explicit BlockBuilder(int restart_interval)
+      : restart_interval_(restart_interval), counter_(0) {
+    restarts_.push_back(0);
+  }
+
+  void Reset() {
+    buffer_.clear();
+    restarts_.clear();
+    restarts_.push_back(0);
+    counter_ = 0;
+    last_key_.clear();
+  }
+
+  void Add(const StringPiece &key, const StringPiece &value) {
+    size_t shared = 0;
+    if (counter_ < restart_interval_) {
+      const size_t min_length = std::min(last_key_.size(), key.size());
+      while (shared < min_length && last_key_[shared] == key[shared]) {
+        ++shared;
+      }
+    } else {
+      restarts_.push_back(static_cast<uint32>(buffer_.size()));
+      counter_ = 0;
+    }
+    const size_t non_shared = key.size() - shared;
+    PutVarint32(&buffer_, shared);
+    PutVarint32(&buffer_, non_shared);
+    PutVarint32(&buffer_, value.size());
+    buffer_.append(key.data() + shared, non_shared);
+    buffer_.append(value.data(), value.size());
+    last_key_.assign(key.data(), key.size());
+    ++counter_;
+  }
+
+  // Appends the restart points and returns the contents of the block.
+  // Reset() must be called before the next Add().
+  const string &Finish() {
+    for (size_t i = 0; i < restarts_.size(); ++i) {
+      PutFixed32(&buffer_, restarts_[i]);
+    }
+    PutFixed32(&buffer_, static_cast<uint32>(restarts_.size()));
+    return buffer_;
+  }
+
+  size_t CurrentSizeEstimate() const {
+    return buffer_.size() + (restarts_.size() + 1) * sizeof(uint32);
+  }
+
+  bool empty() const {
+    return buffer_.empty();
+  }
+
+  const string &last_key() const {
+    return last_key_;
+  }
+
+ private:
+  const int restart_interval_;
+  string buffer_;
+  std::vector<uint32> restarts_;
+  int counter_;
+  string last_key_;
+
+  DISALLOW_COPY_AND_ASSIGN(BlockBuilder);
+};
+
+// Decodes the header of an entry. Returns NULL if the entry is broken.
+const char *DecodeEntry(const char *p, const char *limit,
+                        uint32 *shared, uint32 *non_shared,
+                        uint32 *value_size) {
+  if ((p = GetVarint32Ptr(p, limit, shared)) == NULL ||
+      (p = GetVarint32Ptr(p, limit, non_shared)) == NULL ||
+      (p = GetVarint32Ptr(p, limit, value_size)) == NULL) {
+    return NULL;
+  }
+  if (static_cast<size_t>(limit - p) <
+      static_cast<size_t>(*non_shared) + *value_size) {
+    return NULL;
+  }
+  return p;
+}
+
+}  // namespace
+
+class SSTable::Block {
+ public:
+  // |contents| is not copied.
+  explicit Block(const StringPiece &contents)
+      : data_(contents), restart_offset_(0), num_restarts_(0) {}
+
+  bool Init() {
+    if (data_.size() < sizeof(uint32)) {
+      return false;
+    }
+    num_restarts_ = DecodeFixed32(data_.data() + data_.size() - 4);
+    if (num_restarts_ == 0 || num_restarts_ > (data_.size() - 4) / 4) {
+      return false;
+    }
+    restart_offset_ = data_.size() - (num_restarts_ + 1) * 4;
+    return true;
+  }
+
+  class Iter {
+   public:
+    explicit Iter(const Block *block)
+        : block_(block), current_(block->restart_offset_),
+          next_(block->restart_offset_), restart_index_(0),
+          valid_(false), ok_(true) {}
+
+    bool Valid() const {
+      return valid_;
+    }
+
+    bool ok() const {
+      return ok_;
+    }
+
+    StringPiece key() const {
+      return key_;
+    }
+
+    StringPiece value() const {
+      return value_;
+    }
+
+    void SeekToFirst() {
+      SeekToRestartPoint(0);
+      ParseNextEntry();
+    }
+
+    void SeekToLast() {
+      SeekToRestartPoint(block_->num_restarts_ - 1);
+      while (ParseNextEntry() && next_ < block_->restart_offset_) {
+      }
+    }
+
+    void Next() {
+      ParseNextEntry();
+    }
+
+    void Prev() {
+      // Scans from the last restart point before the current entry.
+      const size_t original = current_;
+      while (GetRestartPoint(restart_index_) >= original) {
+        if (restart_index_ == 0) {
+          valid_ = false;
+          current_ = next_ = block_->restart_offset_;
+          return;
+        }
+        --restart_index_;
+      }
+      SeekToRestartPoint(restart_index_);
+      while (ParseNextEntry() && next_ < original) {
+      }
+    }
+
+    void Seek(const StringPiece &target) {
+      // Finds the last restart point whose key < |target| by binary search,
+      // and then scans linearly.
+      uint32 left = 0;
+      uint32 right = block_->num_restarts_ - 1;
+      while (left < right) {
+        const uint32 mid = (left + right + 1) / 2;
+        StringPiece mid_key;
+        if (!GetRestartKey(mid, &mid_key)) {
+          Corrupt();
+          return;
+        }
+        if (mid_key.compare(target) < 0) {
+          left = mid;
+        } else {
+          right = mid - 1;
+        }
+      }
+      SeekToRestartPoint(left);
+      while (ParseNextEntry() && StringPiece(key_).compare(target) < 0) {
+      }
+    }
+
+   private:
+    uint32 GetRestartPoint(uint32 i) const {
+      return DecodeFixed32(block_->data_.data() + block_->restart_offset_ +
+                           i * sizeof(uint32));
+    }
+
+    void SeekToRestartPoint(uint32 i) {
+      key_.clear();
+      valid_ = false;
+      restart_index_ = i;
+      next_ = GetRestartPoint(i);
+    }
+
+    bool GetRestartKey(uint32 i, StringPiece *key) const {
+      const char *limit = block_->data_.data() + block_->restart_offset_;
+      const char *p = block_->data_.data() + GetRestartPoint(i);
+      uint32 shared = 0, non_shared = 0, value_size = 0;
+      if (p >= limit ||
+          (p = DecodeEntry(p, limit, &shared, &non_shared, &value_size)) ==
+          NULL || shared != 0) {
+        return false;
+      }
+      *key = StringPiece(p, non_shared);
+      return true;
+    }
+
+    bool ParseNextEntry() {
+      valid_ = false;
+      const char *data = block_->data_.data();
+      const char *limit = data + block_->restart_offset_;
+      current_ = next_;
+      const char *p = data + current_;
+      if (p >= limit) {
+        return false;
+      }
+      uint32 shared = 0, non_shared = 0, value_size = 0;
+      p = DecodeEntry(p, limit, &shared, &non_shared, &value_size);
+      if (p == NULL || key_.size() < shared) {
+        Corrupt();
+        return false;
+      }
+      key_.resize(shared);
+      key_.append(p, non_shared);
+      value_ = StringPiece(p + non_shared, value_size);
+      next_ = (p + non_shared + value_size) - data;
+      while (restart_index_ + 1 < block_->num_restarts_ &&
+             GetRestartPoint(restart_index_ + 1) < current_) {
+        ++restart_index_;
+      }
+      valid_ = true;
+      return true;
+    }
+
+    void Corrupt() {
+      LOG(ERROR) << "block is broken";
+      valid_ = false;
+      ok_ = false;
+      current_ = next_ = block_->restart_offset_;
+    }
+
+    const Block *block_;
+    // Offsets of the current and the next entries.
+    size_t current_;
+    size_t next_;
+    // Index of the restart point before the current entry.
+    uint32 restart_index_;
+    string key_;
+    StringPiece value_;
+    bool valid_;
+    bool ok_;
+
+    DISALLOW_COPY_AND_ASSIGN(Iter);
+  };
+
+ private:
+  const StringPiece data_;
+  size_t restart_offset_;
+  uint32 num_restarts_;
+
+  DISALLOW_COPY_AND_ASSIGN(Block);
+};
+
+class SSTableBuilder::Rep {
+ public:
+  Rep(const Options &options, const string &filename)
+      : options_(options), filename_(filename),
+        ofs_(filename.c_str(), ios::binary | ios::out),
+        offset_(0), num_entries_(0), ok_(true), finished_(false),
+        data_block_(options.block_restart_interval),
+        index_block_(1) {
+    if (!ofs_) {
+      LOG(ERROR) << "cannot open " << filename_;
+      ok_ = false;
+    }
+  }
+
+  ~Rep() {
+    if (!finished_) {
+      ofs_.close();
+      FileUtil::Unlink(filename_);
+    }
+  }
+
+  void Add(const StringPiece &key, const StringPiece &value) {
+    DCHECK(!finished_);
+    DCHECK(num_entries_ == 0 || StringPiece(last_key_) < key);
+    if (!ok_) {
+      return;
+    }
+    data_block_.Add(key, value);
+    if (options_.filter_policy != NULL) {
+      block_keys_.push_back(key.as_string());
+    }
+    last_key_.assign(key.data(), key.size());
+    ++num_entries_;
+    if (data_block_.CurrentSizeEstimate() >= options_.block_size) {
+      FlushDataBlock();
+    }
+  }
+
+  bool Finish() {
+    DCHECK(!finished_);
+    FlushDataBlock();
+
+    uint64 filter_offset = 0;
+    uint64 filter_size = 0;
+    if (options_.filter_policy != NULL) {
+      for (size_t i = 0; i < filter_offsets_.size(); ++i) {
+        PutFixed32(&filters_, filter_offsets_[i]);
+      }
+      PutFixed32(&filters_, static_cast<uint32>(filter_offsets_.size()));
+      filter_offset = offset_;
+      filter_size = filters_.size();
+      WriteBlock(filters_);
+    }
+
+    const uint64 index_offset = offset_;
+    const string &index = index_block_.Finish();
+    WriteBlock(index);
+
+    string footer;
+    PutFixed64(&footer, filter_offset);
+    PutFixed64(&footer, filter_size);
+    PutFixed64(&footer, index_offset);
+    PutFixed64(&footer, index.size());
+    PutFixed64(&footer, kSSTableMagicNumber);
+    DCHECK_EQ(kFooterSize, footer.size());
+    ofs_.write(footer.data(), footer.size());
+    offset_ += footer.size();
+
+    ofs_.close();
+    if (ofs_.fail()) {
+      LOG(ERROR) << "cannot write " << filename_;
+      ok_ = false;
+    }
+    if (!ok_) {
+      FileUtil::Unlink(filename_);
+    }
+    finished_ = true;
+    return ok_;
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+  uint64 num_entries() const {
+    return num_entries_;
+  }
+
+  uint64 file_size() const {
+    return offset_;
+  }
+
+ private:
+  void FlushDataBlock() {
+    if (data_block_.empty()) {
+      return;
+    }
+    const uint64 block_offset = offset_;
+    const string &contents = data_block_.Finish();
+    const uint64 block_size = contents.size();
+    WriteBlock(contents);
+
+    string handle;
+    PutVarint64(&handle, block_offset);
+    PutVarint64(&handle, block_size);
+    index_block_.Add(data_block_.last_key(), handle);
+
+    if (options_.filter_policy != NULL) {
+      filter_offsets_.push_back(static_cast<uint32>(filters_.size()));
+      std::vector<StringPiece> keys(block_keys_.begin(), block_keys_.end());
+      options_.filter_policy->CreateFilter(&keys[0],
+                                           static_cast<int>(keys.size()),
+                                           &filters_);
+      block_keys_.clear();
+    }
+    data_block_.Reset();
+  }
+
+  void WriteBlock(const string &contents) {
+    char trailer[kBlockTrailerSize];
+    EncodeFixed32(trailer, crc32c::Mask(crc32c::Value(contents.data(),
+                                                      contents.size())));
+    ofs_.write(contents.data(), contents.size());
+    ofs_.write(trailer, sizeof(trailer));
+    offset_ += contents.size() + sizeof(trailer);
+    if (ofs_.fail()) {
+      ok_ = false;
+    }
+  }
+
+  const Options options_;
+  const string filename_;
+  OutputFileStream ofs_;
+  uint64 offset_;
+  uint64 num_entries_;
+  bool ok_;
+  bool finished_;
+  string last_key_;
+  BlockBuilder data_block_;
+  BlockBuilder index_block_;
+  // Keys of the current data block for the filter.
+  std::vector<string> block_keys_;
+  string filters_;
+  std::vector<uint32> filter_offsets_;
+
+  DISALLOW_COPY_AND_ASSIGN(Rep);
+};
+
+SSTableBuilder::Options::Options()
+    : block_size(kDefaultBlockSize),
+      block_restart_interval(kDefaultBlockRestartInterval),
+      filter_policy(NULL) {}
+
+SSTableBuilder::SSTableBuilder(const Options &options, const string &filename)
+    : rep_(new Rep(options, filename)) {}
+
+SSTableBuilder::~SSTableBuilder() {}
+
+bool SSTableBuilder::ok() const {
+  return rep_->ok();
+}
+
+void SSTableBuilder::Add(const StringPiece &key, const StringPiece &value) {
+  rep_->Add(key, value);
+}
+
+bool SSTableBuilder::Finish() {
+  return rep_->Finish();
+}
+
+uint64 SSTableBuilder::num_entries() const {
+  return rep_->num_entries();
+}
+
+uint64 SSTableBuilder::file_size() const {
+  return rep_->file_size();
+}
+
+class SSTable::TableIterator : public SSTable::Iterator {
+ public:
+  explicit TableIterator(const SSTable *table)
+      : table_(table), block_index_(table->index_.size()),
+        block_(NULL), handle_(NULL), ok_(true) {}
+
+  virtual ~TableIterator() {
+    ReleaseBlock();
+  }
+
+  virtual bool Valid() const {
+    return iter_.get() != NULL && iter_->Valid();
+  }
+
+  virtual void SeekToFirst() {
+    ok_ = true;
+    InitBlock(0);
+    if (iter_.get() != NULL) {
+      iter_->SeekToFirst();
+    }
+    SkipEmptyBlocks();
+  }
+
+  virtual void SeekToLast() {
+    ok_ = true;
+    if (table_->index_.empty()) {
+      ReleaseBlock();
+      return;
+    }
+    InitBlock(table_->index_.size() - 1);
+    if (iter_.get() != NULL) {
+      iter_->SeekToLast();
+    }
+    SkipEmptyBlocksBackward();
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    ok_ = true;
+    InitBlock(table_->FindDataBlock(target));
+    if (iter_.get() != NULL) {
+      iter_->Seek(target);
+    }
+    SkipEmptyBlocks();
+  }
+
+  virtual void Next() {
+    DCHECK(Valid());
+    iter_->Next();
+    SkipEmptyBlocks();
+  }
+
+  virtual void Prev() {
+    DCHECK(Valid());
+    iter_->Prev();
+    SkipEmptyBlocksBackward();
+  }
+
+  virtual bool ok() const {
+    return ok_;
+  }
+
+  virtual StringPiece key() const {
+    return iter_->key();
+  }
+
+  virtual StringPiece value() const {
+    return iter_->value();
+  }
+
+ private:
+  void InitBlock(size_t i) {
+    ReleaseBlock();
+    block_index_ = i;
+    if (block_index_ >= table_->index_.size()) {
+      return;
+    }
+    block_ = table_->ReadDataBlock(block_index_, &handle_);
+    if (block_ == NULL) {
+      ok_ = false;
+      return;
+    }
+    iter_.reset(new Block::Iter(block_));
+  }
+
+  void ReleaseBlock() {
+    iter_.reset();
+    if (block_ != NULL) {
+      table_->ReleaseDataBlock(block_, handle_);
+    }
+    block_ = NULL;
+    handle_ = NULL;
+  }
+
+  // Moves to the first entry of the next non-empty block if the current
+  // block has no more entries.
+  void SkipEmptyBlocks() {
+    while (ok_ && !Valid()) {
+      if (iter_.get() != NULL && !iter_->ok()) {
+        ok_ = false;
+        break;
+      }
+      if (block_index_ + 1 >= table_->index_.size()) {
+        ReleaseBlock();
+        break;
+      }
+      InitBlock(block_index_ + 1);
+      if (iter_.get() != NULL) {
+        iter_->SeekToFirst();
+      }
+    }
+  }
+
+  // Moves to the last entry of the previous non-empty block if the
+  // current block has no more entries.
+  void SkipEmptyBlocksBackward() {
+    while (ok_ && !Valid()) {
+      if (iter_.get() != NULL && !iter_->ok()) {
+        ok_ = false;
+        break;
+      }
+      if (block_index_ == 0) {
+        ReleaseBlock();
+        break;
+      }
+      InitBlock(block_index_ - 1);
+      if (iter_.get() != NULL) {
+        iter_->SeekToLast();
+      }
+    }
+  }
+
+  const SSTable *table_;
+  size_t block_index_;
+  Block *block_;
+  void *handle_;
+  std::unique_ptr<Block::Iter> iter_;
+  bool ok_;
+
+  DISALLOW_COPY_AND_ASSIGN(TableIterator);
+};
+
+SSTable::Options::Options()
+    : filter_policy(NULL), block_cache(NULL), verify_checksums(true) {}
+
+SSTable::SSTable(const Options &options, const string &filename)
+    : options_(options), filename_(filename), cache_id_(0) {}
+
+SSTable::~SSTable() {}
+
+SSTable *SSTable::Open(const Options &options, const string &filename) {
+  std::unique_ptr<SSTable> table(new SSTable(options, filename));
+  if (!table->Open()) {
+    return NULL;
+  }
+  return table.release();
+}
+
+bool SSTable::Open() {
+  if (!mmap_.Open(filename_.c_str(), "r")) {
+    LOG(ERROR) << "cannot open " << filename_;
+    return false;
+  }
+  if (mmap_.size() < kFooterSize) {
+    LOG(ERROR) << "file is too small: " << filename_;
+    return false;
+  }
+
+  const char *footer = mmap_.end() - kFooterSize;
+  const uint64 filter_offset = DecodeFixed64(footer);
+  const uint64 filter_size = DecodeFixed64(footer + 8);
+  const uint64 index_offset = DecodeFixed64(footer + 16);
+  const uint64 index_size = DecodeFixed64(footer + 24);
+  if (DecodeFixed64(footer + 32) != kSSTableMagicNumber) {
+    LOG(ERROR) << "magic is broken: " << filename_;
+    return false;
+  }
+
+  // The index and filter blocks are always verified.
+  StringPiece index_contents;
+  if (!ReadBlockContents(index_offset, index_size, true, &index_contents)) {
+    LOG(ERROR) << "index block is broken: " << filename_;
+    return false;
+  }
+  if (filter_size > 0 &&
+      !ReadBlockContents(filter_offset, filter_size, true, &filter_block_)) {
+    LOG(ERROR) << "filter block is broken: " << filename_;
+    return false;
+  }
+
+  Block index_block(index_contents);
+  if (!index_block.Init()) {
+    LOG(ERROR) << "index block is broken: " << filename_;
+    return false;
+  }
+  Block::Iter it(&index_block);
+  for (it.SeekToFirst(); it.Valid(); it.Next()) {
+    StringPiece handle = it.value();
+    IndexEntry entry;
+    uint64_t offset = 0, size = 0;
+    if (!GetVarint64(&handle, &offset) || !GetVarint64(&handle, &size)) {
+      LOG(ERROR) << "index block is broken: " << filename_;
+      return false;
+    }
+    entry.last_key = it.key().as_string();
+    entry.offset = offset;
+    entry.size = size;
+    index_.push_back(entry);
+  }
+  if (!it.ok()) {
+    LOG(ERROR) << "index block is broken: " << filename_;
+    return false;
+  }
+
+  if (options_.block_cache != NULL) {
+    cache_id_ = options_.block_cache->NewId();
+  }
+  return true;
+}
+
+bool SSTable::ReadBlockContents(uint64 offset, uint64 size,
+                                bool verify_checksum,
+                                StringPiece *contents) const {
+  const uint64 limit = mmap_.size() - kFooterSize;
+  // Written not to overflow with a broken |size|.
+  if (offset > limit || limit - offset < kBlockTrailerSize ||
+      size > limit - offset - kBlockTrailerSize) {
+    return false;
+  }
+  const char *data = mmap_.begin() + offset;
+  if (verify_checksum &&
+      crc32c::Unmask(DecodeFixed32(data + size)) !=
+      crc32c::Value(data, size)) {
+    LOG(ERROR) << "checksum mismatch: " << filename_;
+    return false;
+  }
+  *contents = StringPiece(data, size);
+  return true;
+}
+
+size_t SSTable::FindDataBlock(const StringPiece &key) const {
+  size_t left = 0;
+  size_t right = index_.size();
+  while (left < right) {
+    const size_t mid = (left + right) / 2;
+    if (StringPiece(index_[mid].last_key).compare(key) < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return left;
+}
+
+bool SSTable::KeyMayMatch(size_t i, const StringPiece &key) const {
+  if (options_.filter_policy == NULL || filter_block_.size() < 4) {
+    return true;
+  }
+  const char *data = filter_block_.data();
+  const size_t num_filters = DecodeFixed32(data + filter_block_.size() - 4);
+  if (i >= num_filters ||
+      (num_filters + 1) * 4 > filter_block_.size()) {
+    return true;
+  }
+  const size_t array_offset = filter_block_.size() - (num_filters + 1) * 4;
+  const size_t begin = DecodeFixed32(data + array_offset + i * 4);
+  const size_t end = (i + 1 < num_filters) ?
+      DecodeFixed32(data + array_offset + (i + 1) * 4) : array_offset;
+  if (begin > end || end > array_offset) {
+    return true;
+  }
+  return options_.filter_policy->KeyMayMatch(
+      key, StringPiece(data + begin, end - begin));
+}
+
+void SSTable::DeleteCachedBlock(const StringPiece &key, void *value) {
+  delete reinterpret_cast<Block *>(value);
+}
+
+SSTable::Block *SSTable::ReadDataBlock(size_t i, void **handle) const {
+  *handle = NULL;
+  const IndexEntry &entry = index_[i];
+  Cache *cache = options_.block_cache;
+  char cache_key[16];
+  if (cache != NULL) {
+    EncodeFixed64(cache_key, cache_id_);
+    EncodeFixed64(cache_key + 8, entry.offset);
+    Cache::Handle *h = cache->Lookup(StringPiece(cache_key, sizeof(cache_key)));
+    if (h != NULL) {
+      *handle = h;
+      return reinterpret_cast<Block *>(cache->Value(h));
+    }
+  }
+
+  StringPiece contents;
+  if (!ReadBlockContents(entry.offset, entry.size,
+                         options_.verify_checksums, &contents)) {
+    LOG(ERROR) << "data block is broken: " << filename_;
+    return NULL;
+  }
+  std::unique_ptr<Block> block(new Block(contents));
+  if (!block->Init()) {
+    LOG(ERROR) << "data block is broken: " << filename_;
+    return NULL;
+  }
+  if (cache != NULL) {
+    // The block refers to the mapped file. It is never looked up after
+    // this table is closed, as |cache_id_| is unique to this table.
+    // Only the memory of the entry is charged, as the contents stay in
+    // the mapped file.
+    *handle = cache->Insert(StringPiece(cache_key, sizeof(cache_key)),
+                            block.get(), sizeof(Block) + sizeof(cache_key),
+                            &DeleteCachedBlock);
+  }
+  return block.release();
+}
+
+void SSTable::ReleaseDataBlock(Block *block, void *handle) const {
+  if (handle != NULL) {
+    options_.block_cache->Release(reinterpret_cast<Cache::Handle *>(handle));
+  } else {
+    delete block;
+  }
+}
+
+bool SSTable::Get(const StringPiece &key, string *value) const {
+  StringPiece v;
+  if (!Get(key, &v)) {
+    return false;
+  }
+  value->assign(v.data(), v.size());
+  return true;
+}
+
+bool SSTable::Get(const StringPiece &key, StringPiece *value) const {
+  const size_t i = FindDataBlock(key);
+  if (i >= index_.size() || !KeyMayMatch(i, key)) {
+    return false;
+  }
+  void *handle = NULL;
+  Block *block = ReadDataBlock(i, &handle);
+  if (block == NULL) {
+    return false;
+  }
+  bool found = false;
+  {
+    Block::Iter it(block);
+    it.Seek(key);
+    if (it.Valid() && it.key() == key) {
+      // The block refers to the mapped file.
+      *value = it.value();
+      found = true;
+    }
+  }
+  ReleaseDataBlock(block, handle);
+  return found;
+}
+
+SSTable::Iterator *SSTable::NewIterator() const {
+  return new TableIterator(this);
+}
+
+size_t SSTable::file_size() const {
+  return mmap_.size();
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,201 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_SSTABLE_H_
+#define GBASE_STORAGE_SSTABLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/mmap.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+
+namespace gbase {
+
+class Cache;
+class FilterPolicy;
+
+namespace storage {
+
+// Sorted string table (SSTable): an immutable file of key/value pairs
+// sorted by key.
+//
+// Format of the file:
+// |data block|...|data block|filter block|index block|footer|
+// Each block is followed by the masked crc32c(fixed32) of the block.
+//
+// data block:  |entry|...|entry|restart(fixed32)|...|num_restarts(fixed32)|
+//   entry:     |shared(varint32)|non_shared(varint32)|value_size(varint32)|
+//              |key[shared..]|value|
+//   The key is prefix-compressed against the previous key, except at the
+//   restart points which allow binary search in the block.
+// filter block: |filter|...|filter|offset(fixed32)|...|num_filters(fixed32)|
+//   The i-th filter is created from the keys of the i-th data block.
+// index block: a data block whose key is the last key of each data block
+//   and value is |offset(varint64)|size(varint64)| of the data block.
+// footer:      |filter offset(fixed64)|filter size(fixed64)|
+//              |index offset(fixed64)|index size(fixed64)|magic(fixed64)|
+class SSTableBuilder {
+ public:
+  struct Options {
+    Options();
+
+    // Approximate size of the data block.
+    size_t block_size;
+
+    // Number of keys between restart points.
+    int block_restart_interval;
+
+    // If not NULL, a filter block is created. Not owned.
+    const FilterPolicy *filter_policy;
+  };
+
+  SSTableBuilder(const Options &options, const string &filename);
+  // Removes the file if Finish() has not been called.
+  ~SSTableBuilder();
+
+  // Returns false if any error has occurred.
+  bool ok() const;
+
+  // REQUIRES: |key| is after any previously added key.
+  void Add(const StringPiece &key, const StringPiece &value);
+
+  // Writes the remaining blocks and the footer.
+  bool Finish();
+
+  uint64 num_entries() const;
+  uint64 file_size() const;
+
+ private:
+  class Rep;
+  std::unique_ptr<Rep> rep_;
+
+  DISALLOW_COPY_AND_ASSIGN(SSTableBuilder);
+};
+
+class SSTable {
+ public:
+  struct Options {
+    Options();
+
+    // Must be the same policy as the one used by the builder, or NULL.
+    // Not owned.
+    const FilterPolicy *filter_policy;
+
+    // If not NULL, the verified data blocks are cached. The blocks refer to
+    // the mapped file, so each of them is charged only for the memory of
+    // its cache entry. Not owned.
+    Cache *block_cache;
+
+    // Verifies the checksum of the data block on every read which is not
+    // served from the cache.
+    bool verify_checksums;
+  };
+
+  class Iterator {
+   public:
+    Iterator() {}
+    virtual ~Iterator() {}
+
+    virtual bool Valid() const = 0;
+    virtual void SeekToFirst() = 0;
+    virtual void SeekToLast() = 0;
+    // Moves to the first entry whose key >= |target|.
+    virtual void Seek(const StringPiece &target) = 0;
+    virtual void Next() = 0;
+    virtual void Prev() = 0;
+    // Returns false if a broken block was found.
+    virtual bool ok() const = 0;
+
+    // REQUIRES: Valid()
+    virtual StringPiece key() const = 0;
+    virtual StringPiece value() const = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Iterator);
+  };
+
+  ~SSTable();
+
+  // Returns NULL if the file is broken or cannot be opened.
+  static SSTable *Open(const Options &options, const string &filename);
+
+  // Looks up |key| and returns the value.
+  bool Get(const StringPiece &key, string *value) const;
+
+  // Same as above, but |value| points to the mapped file without copy,
+  // which is valid while this table is alive.
+  bool Get(const StringPiece &key, StringPiece *value) const;
+
+  // Returns a new iterator which is not positioned yet.
+  // The table must outlive the iterator.
+  Iterator *NewIterator() const;
+
+  size_t file_size() const;
+
+ private:
+  class Block;
+  class TableIterator;
+
+  struct IndexEntry {
+    string last_key;
+    uint64 offset;
+    uint64 size;
+  };
+
+  SSTable(const Options &options, const string &filename);
+  static void DeleteCachedBlock(const StringPiece &key, void *value);
+
+  bool Open();
+  bool ReadBlockContents(uint64 offset, uint64 size, bool verify_checksum,
+                         StringPiece *contents) const;
+  // Returns the index of the first data block whose last key >= |key|.
+  size_t FindDataBlock(const StringPiece &key) const;
+  // Reads the |i|-th data block. |*handle| is set when it is cached.
+  Block *ReadDataBlock(size_t i, void **handle) const;
+  void ReleaseDataBlock(Block *block, void *handle) const;
+  bool KeyMayMatch(size_t i, const StringPiece &key) const;
+
+  const Options options_;
+  const string filename_;
+  Mmap mmap_;
+  uint64 cache_id_;
+  // Decoded index block.
+  std::vector<IndexEntry> index_;
+  StringPiece filter_block_;
+
+  DISALLOW_COPY_AND_ASSIGN(SSTable);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_SSTABLE_H_
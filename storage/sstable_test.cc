@@ -0,0 +1,270 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/sstable.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "base/bloom_filter.h"
+#include "base/file_stream.h"
+#include "base/file_util.h"
+#include "base/flags.h"
+#include "base/port.h"
+#include "base/util.h"
+#include "storage/lru_cache.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+DEFINE_string(test_tmpdir, "/tmp/", "tmp file");
+
+}  // namespace
+
+class SSTableTest : public testing::Test {
+ protected:
+  SSTableTest() {}
+
+  virtual void SetUp() {
+    FileUtil::Unlink(GetTemporaryFilePath());
+  }
+
+  virtual void TearDown() {
+    FileUtil::Unlink(GetTemporaryFilePath());
+  }
+
+  // Builds a table from |target| and returns the file size.
+  static uint64 BuildTable(const SSTableBuilder::Options &options,
+                           const std::map<string, string> &target) {
+    SSTableBuilder builder(options, GetTemporaryFilePath());
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      builder.Add(it->first, it->second);
+    }
+    EXPECT_TRUE(builder.Finish());
+    EXPECT_EQ(target.size(), builder.num_entries());
+    return builder.file_size();
+  }
+
+  static void MakeTarget(int size, std::map<string, string> *target) {
+    for (int i = 0; i < size; ++i) {
+      (*target)[Util::StringPrintf("key%05d", i * 2)] =
+          Util::StringPrintf("value%d", i);
+    }
+  }
+
+  static void CheckTable(const SSTable &table,
+                         const std::map<string, string> &target) {
+    string value;
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      EXPECT_TRUE(table.Get(it->first, &value));
+      EXPECT_EQ(it->second, value);
+      // Odd keys are not in the table.
+      EXPECT_FALSE(table.Get(it->first + "x", &value));
+    }
+    EXPECT_FALSE(table.Get("", &value));
+    EXPECT_FALSE(table.Get("zzz", &value));
+
+    std::unique_ptr<SSTable::Iterator> iter(table.NewIterator());
+    std::map<string, string>::const_iterator expected = target.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != target.end());
+      EXPECT_EQ(expected->first, iter->key().as_string());
+      EXPECT_EQ(expected->second, iter->value().as_string());
+    }
+    EXPECT_TRUE(expected == target.end());
+    EXPECT_TRUE(iter->ok());
+
+    std::map<string, string>::const_reverse_iterator rexpected =
+        target.rbegin();
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rexpected) {
+      ASSERT_TRUE(rexpected != target.rend());
+      EXPECT_EQ(rexpected->first, iter->key().as_string());
+      EXPECT_EQ(rexpected->second, iter->value().as_string());
+    }
+    EXPECT_TRUE(rexpected == target.rend());
+    EXPECT_TRUE(iter->ok());
+
+    iter->Seek("key00101");
+    ASSERT_TRUE(iter->Valid());
+    EXPECT_EQ("key00102", iter->key().as_string());
+    iter->Seek("key00102");
+    ASSERT_TRUE(iter->Valid());
+    EXPECT_EQ("key00102", iter->key().as_string());
+    iter->Prev();
+    ASSERT_TRUE(iter->Valid());
+    EXPECT_EQ("key00100", iter->key().as_string());
+    iter->Next();
+    ASSERT_TRUE(iter->Valid());
+    EXPECT_EQ("key00102", iter->key().as_string());
+    iter->Seek("");
+    ASSERT_TRUE(iter->Valid());
+    EXPECT_EQ(target.begin()->first, iter->key().as_string());
+    iter->Seek("zzz");
+    EXPECT_FALSE(iter->Valid());
+  }
+
+  static string GetTemporaryFilePath() {
+    // This name should be unique to each test.
+    return FileUtil::JoinPath(FLAGS_test_tmpdir, "SSTableTest_test.sst");
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SSTableTest);
+};
+
+TEST_F(SSTableTest, SSTableTest) {
+  const int kSize[] = {0, 1, 10, 1000};
+  const int kBlockSize[] = {16, 256, 4096};
+  const int kRestartInterval[] = {1, 16};
+  for (size_t i = 0; i < arraysize(kSize); ++i) {
+    std::map<string, string> target;
+    MakeTarget(kSize[i], &target);
+    for (size_t j = 0; j < arraysize(kBlockSize); ++j) {
+      for (size_t k = 0; k < arraysize(kRestartInterval); ++k) {
+        SSTableBuilder::Options builder_options;
+        builder_options.block_size = kBlockSize[j];
+        builder_options.block_restart_interval = kRestartInterval[k];
+        const uint64 file_size = BuildTable(builder_options, target);
+
+        std::unique_ptr<SSTable> table(
+            SSTable::Open(SSTable::Options(), GetTemporaryFilePath()));
+        ASSERT_TRUE(table.get() != NULL);
+        EXPECT_EQ(file_size, table->file_size());
+        if (kSize[i] == 1000) {
+          CheckTable(*table, target);
+        } else {
+          string value;
+          EXPECT_FALSE(table->Get("key", &value));
+          std::unique_ptr<SSTable::Iterator> iter(table->NewIterator());
+          int num_entries = 0;
+          for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            ++num_entries;
+          }
+          EXPECT_EQ(kSize[i], num_entries);
+          for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+            --num_entries;
+          }
+          EXPECT_EQ(0, num_entries);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(SSTableTest, FilterAndCacheTest) {
+  std::unique_ptr<const FilterPolicy> policy(NewBloomFilterPolicy(10));
+  std::unique_ptr<Cache> cache(NewLRUCache(1 << 20));
+  std::map<string, string> target;
+  MakeTarget(1000, &target);
+
+  SSTableBuilder::Options builder_options;
+  builder_options.block_size = 256;
+  builder_options.filter_policy = policy.get();
+  BuildTable(builder_options, target);
+
+  SSTable::Options options;
+  options.filter_policy = policy.get();
+  options.block_cache = cache.get();
+  std::unique_ptr<SSTable> table(
+      SSTable::Open(options, GetTemporaryFilePath()));
+  ASSERT_TRUE(table.get() != NULL);
+  CheckTable(*table, target);
+  EXPECT_LT(0, cache->TotalCharge());
+  // The contents of the blocks are in the mapped file.
+  EXPECT_GT(table->file_size(), cache->TotalCharge());
+  // Served from the cache.
+  CheckTable(*table, target);
+
+  // A table opened without the policy ignores the filter block.
+  std::unique_ptr<SSTable> no_filter_table(
+      SSTable::Open(SSTable::Options(), GetTemporaryFilePath()));
+  ASSERT_TRUE(no_filter_table.get() != NULL);
+  CheckTable(*no_filter_table, target);
+}
+
+TEST_F(SSTableTest, CorruptionTest) {
+  const string filename = GetTemporaryFilePath();
+  std::map<string, string> target;
+  MakeTarget(1000, &target);
+  SSTableBuilder::Options builder_options;
+  builder_options.block_size = 256;
+  BuildTable(builder_options, target);
+
+  string contents;
+  {
+    std::unique_ptr<SSTable> table(SSTable::Open(SSTable::Options(), filename));
+    ASSERT_TRUE(table.get() != NULL);
+    InputFileStream ifs(filename.c_str(), ios::binary);
+    contents.resize(table->file_size());
+    ifs.read(&contents[0], contents.size());
+  }
+
+  // Breaks the first data block.
+  contents[10] ^= 0x5a;
+  {
+    OutputFileStream ofs(filename.c_str(), ios::binary | ios::out);
+    ofs.write(contents.data(), contents.size());
+  }
+
+  {
+    std::unique_ptr<SSTable> table(SSTable::Open(SSTable::Options(), filename));
+    ASSERT_TRUE(table.get() != NULL);
+    string value;
+    EXPECT_FALSE(table->Get(target.begin()->first, &value));
+    EXPECT_TRUE(table->Get(target.rbegin()->first, &value));
+    std::unique_ptr<SSTable::Iterator> iter(table->NewIterator());
+    iter->SeekToFirst();
+    EXPECT_FALSE(iter->Valid());
+    EXPECT_FALSE(iter->ok());
+  }
+
+  // Breaks the footer.
+  contents[contents.size() - 1] ^= 0x5a;
+  {
+    OutputFileStream ofs(filename.c_str(), ios::binary | ios::out);
+    ofs.write(contents.data(), contents.size());
+  }
+  EXPECT_TRUE(SSTable::Open(SSTable::Options(), filename) == NULL);
+}
+
+TEST_F(SSTableTest, AbandonTest) {
+  {
+    SSTableBuilder builder(SSTableBuilder::Options(), GetTemporaryFilePath());
+    builder.Add("key", "value");
+  }
+  EXPECT_FALSE(FileUtil::FileExists(GetTemporaryFilePath()));
+}
+
+}  // namespace storage
+}  // namespace gbase
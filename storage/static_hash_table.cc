@@ -0,0 +1,340 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/static_hash_table.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/coding.h"
+#include "base/file_stream.h"
+#include "base/file_util.h"
+#include "base/hash.h"
+#include "base/logging.h"
+#include "base/mmap.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/pinned_slice.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+const uint64 kStaticHashTableMagicNumber = 0x8e5d3c0f1a7b6429ULL;
+const size_t kFooterSize = 32;
+const size_t kSlotSize = 12;
+const uint64 kEmptyOffset = ~static_cast<uint64>(0);
+
+uint32 GetSlotHash(uint64 fp) {
+  return static_cast<uint32>(fp);
+}
+
+uint64 GetFirstSlot(uint64 fp, uint64 num_slots) {
+  return (fp >> 32) & (num_slots - 1);
+}
+
+}  // namespace
+
+StaticHashTableBuilder::StaticHashTableBuilder(const string &filename)
+    : filename_(filename), ofs_(filename.c_str(), ios::binary | ios::out),
+      offset_(0), ok_(true), finished_(false) {
+  if (!ofs_) {
+    LOG(ERROR) << "cannot open " << filename_;
+    ok_ = false;
+  }
+}
+
+StaticHashTableBuilder::~StaticHashTableBuilder() {
+  if (!finished_) {
+    ofs_.close();
+    FileUtil::Unlink(filename_);
+  }
+}
+
+bool StaticHashTableBuilder::ok() const {
+  return ok_;
+}
+
+uint64 StaticHashTableBuilder::num_entries() const {
+  return entries_.size();
+}
+
+void StaticHashTableBuilder::Add(const StringPiece &key,
+                                 const StringPiece &value) {
+  DCHECK(!finished_);
+  if (!ok_) {
+    return;
+  }
+  Entry entry;
+  entry.fp = Hash::Fingerprint(key);
+  entry.offset = offset_;
+  entries_.push_back(entry);
+
+  string header;
+  PutVarint32(&header, static_cast<uint32>(key.size()));
+  ofs_.write(header.data(), header.size());
+  ofs_.write(key.data(), key.size());
+  offset_ += header.size() + key.size();
+  header.clear();
+  PutVarint32(&header, static_cast<uint32>(value.size()));
+  ofs_.write(header.data(), header.size());
+  ofs_.write(value.data(), value.size());
+  offset_ += header.size() + value.size();
+  if (ofs_.fail()) {
+    ok_ = false;
+  }
+}
+
+bool StaticHashTableBuilder::Finish() {
+  DCHECK(!finished_);
+  // The load factor is kept <= 0.5 to make the probe sequences short.
+  uint64 num_slots = 1;
+  while (num_slots < entries_.size() * 2) {
+    num_slots *= 2;
+  }
+  string slots(num_slots * kSlotSize, '\0');
+  for (uint64 i = 0; i < num_slots; ++i) {
+    EncodeFixed64(&slots[i * kSlotSize + 4], kEmptyOffset);
+  }
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    uint64 slot = GetFirstSlot(entries_[i].fp, num_slots);
+    while (DecodeFixed64(&slots[slot * kSlotSize + 4]) != kEmptyOffset) {
+      slot = (slot + 1) & (num_slots - 1);
+    }
+    EncodeFixed32(&slots[slot * kSlotSize], GetSlotHash(entries_[i].fp));
+    EncodeFixed64(&slots[slot * kSlotSize + 4], entries_[i].offset);
+  }
+
+  string footer;
+  PutFixed64(&footer, offset_);
+  PutFixed64(&footer, num_slots);
+  PutFixed64(&footer, entries_.size());
+  PutFixed64(&footer, kStaticHashTableMagicNumber);
+  DCHECK_EQ(kFooterSize, footer.size());
+  ofs_.write(slots.data(), slots.size());
+  ofs_.write(footer.data(), footer.size());
+
+  ofs_.close();
+  if (ofs_.fail()) {
+    LOG(ERROR) << "cannot write " << filename_;
+    ok_ = false;
+  }
+  if (!ok_) {
+    FileUtil::Unlink(filename_);
+  }
+  finished_ = true;
+  return ok_;
+}
+
+StaticHashTable::StaticHashTable()
+    : slots_(NULL), num_slots_(0), num_entries_(0) {}
+
+StaticHashTable::~StaticHashTable() {}
+
+StaticHashTable *StaticHashTable::Open(const string &filename) {
+  std::unique_ptr<StaticHashTable> table(new StaticHashTable);
+  Mmap *mmap = &table->mmap_;
+  if (!mmap->Open(filename.c_str(), "r")) {
+    LOG(ERROR) << "cannot open " << filename;
+    return NULL;
+  }
+  if (mmap->size() < kFooterSize) {
+    LOG(ERROR) << "file is too small: " << filename;
+    return NULL;
+  }
+  const char *footer = mmap->end() - kFooterSize;
+  const uint64 slots_offset = DecodeFixed64(footer);
+  const uint64 num_slots = DecodeFixed64(footer + 8);
+  const uint64 num_entries = DecodeFixed64(footer + 16);
+  if (DecodeFixed64(footer + 24) != kStaticHashTableMagicNumber) {
+    LOG(ERROR) << "magic is broken: " << filename;
+    return NULL;
+  }
+  if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0 ||
+      num_entries > num_slots ||
+      slots_offset > mmap->size() - kFooterSize ||
+      num_slots > (mmap->size() - kFooterSize - slots_offset) / kSlotSize) {
+    LOG(ERROR) << "footer is broken: " << filename;
+    return NULL;
+  }
+  table->slots_ = mmap->begin() + slots_offset;
+  table->num_slots_ = num_slots;
+  table->num_entries_ = num_entries;
+  return table.release();
+}
+
+bool StaticHashTable::Lookup(const StringPiece &key,
+                             StringPiece *value) const {
+  const uint64 fp = Hash::Fingerprint(key);
+  const uint32 hash = GetSlotHash(fp);
+  // Entries are before the slots.
+  const char *limit = slots_;
+  for (uint64 i = GetFirstSlot(fp, num_slots_), n = 0; n < num_slots_;
+       i = (i + 1) & (num_slots_ - 1), ++n) {
+    const char *slot = slots_ + i * kSlotSize;
+    const uint64 offset = DecodeFixed64(slot + 4);
+    if (offset == kEmptyOffset) {
+      return false;
+    }
+    if (DecodeFixed32(slot) != hash) {
+      continue;
+    }
+    const char *p = mmap_.begin() + offset;
+    uint32 key_size = 0;
+    p = GetVarint32Ptr(p, limit, &key_size);
+    if (p == NULL || key_size > static_cast<size_t>(limit - p)) {
+      LOG(ERROR) << "entry is broken";
+      return false;
+    }
+    if (StringPiece(p, key_size) != key) {
+      continue;
+    }
+    p += key_size;
+    uint32 value_size = 0;
+    p = GetVarint32Ptr(p, limit, &value_size);
+    if (p == NULL || value_size > static_cast<size_t>(limit - p)) {
+      LOG(ERROR) << "entry is broken";
+      return false;
+    }
+    *value = StringPiece(p, value_size);
+    return true;
+  }
+  return false;
+}
+
+uint64 StaticHashTable::size() const {
+  return num_entries_;
+}
+
+namespace {
+
+void DeleteTable(void *arg) {
+  delete reinterpret_cast<std::shared_ptr<const StaticHashTable> *>(arg);
+}
+
+class StaticHashStorageImpl : public StorageInterface {
+ public:
+  StaticHashStorageImpl() {}
+  virtual ~StaticHashStorageImpl() {}
+
+  virtual bool Open(const string &filename) {
+    table_.reset(StaticHashTable::Open(filename));
+    return table_ != NULL;
+  }
+
+  virtual bool Sync() {
+    return true;
+  }
+
+  virtual bool Lookup(const string &key, string *value) const {
+    CHECK(value);
+    StringPiece data;
+    if (table_ == NULL || !table_->Lookup(key, &data)) {
+      return false;
+    }
+    value->assign(data.data(), data.size());
+    return true;
+  }
+
+  // The pinned value keeps the table mapped even after Open() is called
+  // again.
+  virtual bool LookupPinned(const StringPiece &key, PinnedSlice *value) const {
+    CHECK(value);
+    StringPiece data;
+    if (table_ == NULL || !table_->Lookup(key, &data)) {
+      return false;
+    }
+    value->Pin(data, &DeleteTable,
+               new std::shared_ptr<const StaticHashTable>(table_));
+    return true;
+  }
+
+  virtual bool Insert(const string &key, const string &value) {
+    LOG(ERROR) << "storage is read-only";
+    return false;
+  }
+
+  virtual bool Erase(const string &key) {
+    LOG(ERROR) << "storage is read-only";
+    return false;
+  }
+
+  virtual bool Write(const WriteBatch &batch) {
+    LOG(ERROR) << "storage is read-only";
+    return false;
+  }
+
+  virtual bool Clear() {
+    LOG(ERROR) << "storage is read-only";
+    return false;
+  }
+
+  virtual size_t Size() const {
+    return table_ == NULL ? 0 : static_cast<size_t>(table_->size());
+  }
+
+ private:
+  std::shared_ptr<const StaticHashTable> table_;
+
+  DISALLOW_COPY_AND_ASSIGN(StaticHashStorageImpl);
+};
+
+}  // namespace
+
+StorageInterface *StaticHashStorage::New() {
+  return new StaticHashStorageImpl;
+}
+
+StorageInterface *StaticHashStorage::Create(const char *filename) {
+  std::unique_ptr<StorageInterface> storage(New());
+  if (!storage->Open(filename)) {
+    LOG(ERROR) << "cannot open " << filename;
+    return NULL;
+  }
+  return storage.release();
+}
+
+bool StaticHashStorage::Build(const StorageInterface &storage,
+                              const string &filename) {
+  std::unique_ptr<StorageInterface::Iterator> iter(storage.NewIterator());
+  if (iter.get() == NULL) {
+    LOG(ERROR) << "storage does not support iteration";
+    return false;
+  }
+  StaticHashTableBuilder builder(filename);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    builder.Add(iter->key(), iter->value());
+  }
+  return builder.Finish();
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,140 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_STATIC_HASH_TABLE_H_
+#define GBASE_STORAGE_STATIC_HASH_TABLE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/file_stream.h"
+#include "base/mmap.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/storage_interface.h"
+
+namespace gbase {
+namespace storage {
+
+// Immutable hash table file for large static dictionaries. The reader maps
+// the file and looks up keys without parsing or loading it, so the startup
+// is instant and the pages are shared by the processes.
+//
+// Format of the file:
+// |entry|...|entry|slot|...|slot|footer|
+// entry:  |key_size(varint32)|key|value_size(varint32)|value|
+// slot:   |hash(fixed32)|entry offset(fixed64)|
+//   Open addressing with linear probing over a power of 2 number of slots.
+//   The upper 32 bits of the fingerprint of the key select the first slot,
+//   and the lower 32 bits are stored as |hash|. Empty slot has offset ~0.
+// footer: |slots offset(fixed64)|num_slots(fixed64)|num_entries(fixed64)|
+//         |magic(fixed64)|
+class StaticHashTableBuilder {
+ public:
+  explicit StaticHashTableBuilder(const string &filename);
+  // Removes the file if Finish() has not been called.
+  ~StaticHashTableBuilder();
+
+  // Returns false if any error has occurred.
+  bool ok() const;
+
+  // REQUIRES: |key| has not been added.
+  // The entry is written to the file immediately, and only the fingerprint
+  // and the offset are kept in memory.
+  void Add(const StringPiece &key, const StringPiece &value);
+
+  // Writes the slots and the footer.
+  bool Finish();
+
+  uint64 num_entries() const;
+
+ private:
+  struct Entry {
+    uint64 fp;
+    uint64 offset;
+  };
+
+  const string filename_;
+  OutputFileStream ofs_;
+  uint64 offset_;
+  bool ok_;
+  bool finished_;
+  std::vector<Entry> entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(StaticHashTableBuilder);
+};
+
+class StaticHashTable {
+ public:
+  ~StaticHashTable();
+
+  // Returns NULL if the file is broken or cannot be opened.
+  static StaticHashTable *Open(const string &filename);
+
+  // Looks up |key|. |value| points to the mapped file without copy, which
+  // is valid while this table is alive.
+  bool Lookup(const StringPiece &key, StringPiece *value) const;
+
+  uint64 size() const;
+
+ private:
+  StaticHashTable();
+
+  Mmap mmap_;
+  const char *slots_;
+  uint64 num_slots_;
+  uint64 num_entries_;
+
+  DISALLOW_COPY_AND_ASSIGN(StaticHashTable);
+};
+
+// Read-only StorageInterface over StaticHashTable. Open() maps the file
+// created by StaticHashTableBuilder. Insert/Erase/Write/Clear fail, and
+// NewIterator() is not supported. LookupPinned() doesn't copy the value.
+class StaticHashStorage {
+ public:
+  // Caller must take ownership of the returned object.
+  static StorageInterface *New();
+
+  // Returns NULL if fails.
+  static StorageInterface *Create(const char *filename);
+
+  // Writes all the key-value pairs of |storage| into |filename|.
+  // REQUIRES: |storage| supports NewIterator().
+  static bool Build(const StorageInterface &storage, const string &filename);
+
+ private:
+  DISALLOW_IMPLICIT_CONSTRUCTORS(StaticHashStorage);
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_STATIC_HASH_TABLE_H_
@@ -0,0 +1,156 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/static_hash_table.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "base/file_stream.h"
+#include "base/file_util.h"
+#include "base/flags.h"
+#include "base/port.h"
+#include "base/util.h"
+#include "storage/memory_storage.h"
+#include "storage/pinned_slice.h"
+#include "storage/storage_interface.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+DEFINE_string(test_tmpdir, "/tmp/", "tmp file");
+
+}  // namespace
+
+class StaticHashTableTest : public testing::Test {
+ protected:
+  StaticHashTableTest() {}
+
+  virtual void SetUp() {
+    FileUtil::Unlink(GetTemporaryFilePath());
+  }
+
+  virtual void TearDown() {
+    FileUtil::Unlink(GetTemporaryFilePath());
+  }
+
+  static void BuildTable(const std::map<string, string> &target) {
+    StaticHashTableBuilder builder(GetTemporaryFilePath());
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      builder.Add(it->first, it->second);
+    }
+    EXPECT_TRUE(builder.Finish());
+    EXPECT_EQ(target.size(), builder.num_entries());
+  }
+
+  static void MakeTarget(int size, std::map<string, string> *target) {
+    for (int i = 0; i < size; ++i) {
+      (*target)[Util::StringPrintf("key%d", i * 2)] =
+          Util::StringPrintf("value%d", i);
+    }
+  }
+
+  static string GetTemporaryFilePath() {
+    // This name should be unique to each test.
+    return FileUtil::JoinPath(FLAGS_test_tmpdir, "StaticHashTableTest.db");
+  }
+};
+
+TEST_F(StaticHashTableTest, LookupTest) {
+  static const int kSize[] = {0, 1, 10, 1000, 10000};
+  for (size_t i = 0; i < arraysize(kSize); ++i) {
+    std::map<string, string> target;
+    MakeTarget(kSize[i], &target);
+    target[""] = "empty key";
+    target["empty value"] = "";
+    BuildTable(target);
+
+    std::unique_ptr<StaticHashTable> table(
+        StaticHashTable::Open(GetTemporaryFilePath()));
+    ASSERT_TRUE(table.get() != NULL);
+    EXPECT_EQ(target.size(), table->size());
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      StringPiece value;
+      EXPECT_TRUE(table->Lookup(it->first, &value));
+      EXPECT_EQ(it->second, value.as_string());
+    }
+    for (int j = 0; j < kSize[i]; ++j) {
+      StringPiece value;
+      EXPECT_FALSE(table->Lookup(Util::StringPrintf("key%d", j * 2 + 1),
+                                 &value));
+    }
+  }
+}
+
+TEST_F(StaticHashTableTest, BrokenFileTest) {
+  {
+    OutputFileStream ofs(GetTemporaryFilePath().c_str(),
+                         ios::binary | ios::out);
+    ofs << "this is not a hash table file";
+  }
+  EXPECT_TRUE(StaticHashTable::Open(GetTemporaryFilePath()) == NULL);
+  FileUtil::Unlink(GetTemporaryFilePath());
+  EXPECT_TRUE(StaticHashTable::Open(GetTemporaryFilePath()) == NULL);
+}
+
+TEST_F(StaticHashTableTest, StorageTest) {
+  std::unique_ptr<StorageInterface> memory(MemoryStorage::New());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(memory->Insert(Util::StringPrintf("key%d", i),
+                               Util::StringPrintf("value%d", i)));
+  }
+  EXPECT_TRUE(StaticHashStorage::Build(*memory, GetTemporaryFilePath()));
+
+  std::unique_ptr<StorageInterface> storage(
+      StaticHashStorage::Create(GetTemporaryFilePath().c_str()));
+  ASSERT_TRUE(storage.get() != NULL);
+  EXPECT_EQ(100, storage->Size());
+  string value;
+  EXPECT_TRUE(storage->Lookup("key10", &value));
+  EXPECT_EQ("value10", value);
+  EXPECT_FALSE(storage->Lookup("key100", &value));
+  EXPECT_FALSE(storage->Insert("key100", "value100"));
+  EXPECT_FALSE(storage->Erase("key10"));
+  EXPECT_FALSE(storage->Clear());
+  EXPECT_TRUE(storage->NewIterator() == NULL);
+
+  // The pinned value is valid after the storage is destroyed.
+  PinnedSlice pinned;
+  EXPECT_TRUE(storage->LookupPinned("key20", &pinned));
+  storage.reset();
+  EXPECT_EQ("value20", pinned.ToString());
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,161 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/storage_interface.h"
+
+#include <memory>
+#include <string>
+
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/pinned_slice.h"
+#include "storage/write_batch.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+class StorageUpdater : public WriteBatch::Handler {
+ public:
+  explicit StorageUpdater(StorageInterface *storage)
+      : storage_(storage), result_(true) {}
+
+  virtual void Insert(const StringPiece &key, const StringPiece &value) {
+    if (!storage_->Insert(key.as_string(), value.as_string())) {
+      result_ = false;
+    }
+  }
+
+  virtual void Erase(const StringPiece &key) {
+    // Erasing a missing key is not an error.
+    storage_->Erase(key.as_string());
+  }
+
+  bool result() const {
+    return result_;
+  }
+
+ private:
+  StorageInterface *storage_;
+  bool result_;
+};
+
+// Wraps an iterator to hide the keys without |prefix|.
+class PrefixIterator : public StorageInterface::Iterator {
+ public:
+  // Takes the ownership of |iter|.
+  PrefixIterator(StorageInterface::Iterator *iter, const StringPiece &prefix)
+      : iter_(iter), prefix_(prefix.as_string()) {}
+
+  virtual bool Valid() const {
+    return iter_->Valid() && iter_->key().starts_with(prefix_);
+  }
+
+  virtual void SeekToFirst() {
+    iter_->Seek(prefix_);
+  }
+
+  virtual void SeekToLast() {
+    // Positions at the first key after all the keys with |prefix_|, and
+    // steps back.
+    string limit = prefix_;
+    while (!limit.empty() && static_cast<uint8>(limit.back()) == 0xff) {
+      limit.pop_back();
+    }
+    if (limit.empty()) {
+      iter_->SeekToLast();
+      return;
+    }
+    ++limit.back();
+    iter_->Seek(limit);
+    if (iter_->Valid()) {
+      iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+  }
+
+  virtual void Seek(const StringPiece &target) {
+    iter_->Seek(target < prefix_ ? StringPiece(prefix_) : target);
+  }
+
+  virtual void Next() {
+    iter_->Next();
+  }
+
+  virtual void Prev() {
+    iter_->Prev();
+  }
+
+  virtual StringPiece key() const {
+    return iter_->key();
+  }
+
+  virtual StringPiece value() const {
+    return iter_->value();
+  }
+
+ private:
+  std::unique_ptr<StorageInterface::Iterator> iter_;
+  const string prefix_;
+};
+
+}  // namespace
+
+StorageInterface::Iterator *StorageInterface::NewIterator() const {
+  return NULL;
+}
+
+StorageInterface::Iterator *StorageInterface::NewPrefixIterator(
+    const StringPiece &prefix) const {
+  Iterator *iter = NewIterator();
+  if (iter == NULL) {
+    return NULL;
+  }
+  return new PrefixIterator(iter, prefix);
+}
+
+bool StorageInterface::LookupPinned(const StringPiece &key,
+                                    PinnedSlice *value) const {
+  string buf;
+  if (!Lookup(key.as_string(), &buf)) {
+    value->Reset();
+    return false;
+  }
+  value->PinSelf(&buf);
+  return true;
+}
+
+bool StorageInterface::Write(const WriteBatch &batch) {
+  StorageUpdater updater(this);
+  return batch.Iterate(&updater) && updater.result();
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -33,12 +33,45 @@
 #include <string>
 
 #include "base/port.h"
+#include "base/string_piece.h"
+#include "storage/pinned_slice.h"
+#include "storage/write_batch.h"
 
 namespace gbase {
 namespace storage {
 
 class StorageInterface {
  public:
+  // Iterates the key-value pairs in the order of the key.
+  // The interface mirrors SkipList::Iterator.
+  class Iterator {
+   public:
+    Iterator() {}
+    virtual ~Iterator() {}
+
+    // Returns true iff the iterator is positioned at a valid entry.
+    virtual bool Valid() const = 0;
+
+    // Positions at the first/last entry.
+    virtual void SeekToFirst() = 0;
+    virtual void SeekToLast() = 0;
+
+    // Positions at the first entry with a key >= |target|.
+    virtual void Seek(const StringPiece &target) = 0;
+
+    // REQUIRES: Valid()
+    virtual void Next() = 0;
+    virtual void Prev() = 0;
+
+    // REQUIRES: Valid()
+    // The returned data is valid until the iterator is moved.
+    virtual StringPiece key() const = 0;
+    virtual StringPiece value() const = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Iterator);
+  };
+
   // Binds |filename| to the storage but the interpretation of the
   // |filename| depends on the implementaion. implementations can
   // - ignore the specified |filename|.
@@ -59,6 +92,12 @@ class StorageInterface {
   // It is not guranteed that the data is synced to the disk.
   virtual bool Lookup(const string &key, string *value) const = 0;
 
+  // Same as Lookup(), but |value| may point to the memory of the storage
+  // without copy. The memory is kept alive until |value| is reset or
+  // destroyed, even if the key is updated meanwhile.
+  // The default implementation copies the value.
+  virtual bool LookupPinned(const StringPiece &key, PinnedSlice *value) const;
+
   // Inserts key and value.
   // It is not guranteed that the data is synced to the disk.
   virtual bool Insert(const string &key, const string &value) = 0;
@@ -67,6 +106,25 @@ class StorageInterface {
   // It is not guranteed that the data is synced to the disk
   virtual bool Erase(const string &key) = 0;
 
+  // Applies the updates of |batch| atomically.
+  // The default implementation calls Insert() and Erase() in order, so an
+  // implementation should override it to make the updates atomic.
+  // It is not guranteed that the data is synced to the disk.
+  virtual bool Write(const WriteBatch &batch);
+
+  // Returns a new iterator which is not positioned yet, or NULL if the
+  // storage does not support iteration.
+  // The storage must outlive the iterator. Unless the implementation
+  // says otherwise, the storage must not be modified while the iterator
+  // is alive.
+  // Caller must take ownership of the returned object.
+  virtual Iterator *NewIterator() const;
+
+  // Same as NewIterator(), but only the keys starting with |prefix| are
+  // visible. SeekToFirst() and SeekToLast() position at the first and
+  // the last key with |prefix|.
+  Iterator *NewPrefixIterator(const StringPiece &prefix) const;
+
   // clears internal keys and values
   // Sync() is automatically called.
   virtual bool Clear() = 0;
@@ -43,6 +43,10 @@
 #include "base/logging.h"
 #include "base/mmap.h"
 #include "base/port.h"
+#include "base/string_piece.h"
+#include "encoding/crc32c.h"
+#include "storage/map_iterator.h"
+#include "storage/write_batch.h"
 
 namespace gbase {
 namespace storage {
@@ -57,6 +61,24 @@ const size_t kMaxValueSize   = 4096;        // 4k for key/value
 // so 10Mbyte data is reasonable upper bound for file size
 const size_t kMaxFileSize     = 1024 * 1024 * 10;  // 10Mbyte
 
+const uint32 kLogStorageVersion = 1;
+const uint32 kLogStorageMagicId = 0x5c3ae107;  // random seed
+// |magic(uint32)|version(uint32)|
+const size_t kLogHeaderSize = 8;
+// |masked crc32c(uint32)|type(uint8)|key_size(uint32)|value_size(uint32)|
+const size_t kLogRecordHeaderSize = 13;
+// The log is compacted when the garbage exceeds both the live data and
+// this size, so the file is at most about twice as large as the data.
+const size_t kMinCompactionSize = 64 * 1024;
+const size_t kMaxLogFileSize = 2 * kMaxFileSize + kMinCompactionSize;
+
+enum LogRecordType {
+  LOG_INSERT = 1,
+  LOG_ERASE = 2,
+  // The value is the contents of a WriteBatch.
+  LOG_BATCH = 3,
+};
+
 template<typename T>
 bool ReadData(char **begin, const char *end, T *value) {
   if (*begin + sizeof(*value) > end) {
@@ -84,6 +106,53 @@ bool IsInvalid(const string &key, const string &value, size_t size) {
   return false;
 }
 
+// Checks that all the updates of a batch can be applied to |dic|
+// without exceeding the limits, so that the batch is applied atomically.
+class BatchValidator : public WriteBatch::Handler {
+ public:
+  explicit BatchValidator(const std::map<string, string> &dic)
+      : dic_(dic), size_(dic.size()), valid_(true) {}
+
+  virtual void Insert(const StringPiece &key, const StringPiece &value) {
+    const string key_str = key.as_string();
+    const bool exists = Exists(key_str);
+    if (IsInvalid(key_str, value.as_string(), exists ? 0 : size_)) {
+      valid_ = false;
+    }
+    if (!exists) {
+      ++size_;
+      exists_[key_str] = true;
+    }
+  }
+
+  virtual void Erase(const StringPiece &key) {
+    const string key_str = key.as_string();
+    if (Exists(key_str)) {
+      --size_;
+      exists_[key_str] = false;
+    }
+  }
+
+  bool valid() const {
+    return valid_;
+  }
+
+ private:
+  bool Exists(const string &key) const {
+    std::map<string, bool>::const_iterator it = exists_.find(key);
+    if (it != exists_.end()) {
+      return it->second;
+    }
+    return dic_.find(key) != dic_.end();
+  }
+
+  const std::map<string, string> &dic_;
+  // Keys inserted or erased by the batch.
+  std::map<string, bool> exists_;
+  size_t size_;
+  bool valid_;
+};
+
 class TinyStorageImpl : public StorageInterface {
  public:
   TinyStorageImpl();
@@ -94,12 +163,33 @@ class TinyStorageImpl : public StorageInterface {
   virtual bool Lookup(const string &key, string *value) const;
   virtual bool Insert(const string &key, const string &value);
   virtual bool Erase(const string &key);
+  virtual bool Write(const WriteBatch &batch);
   virtual bool Clear();
   virtual size_t Size() const {
     return dic_.size();
   }
 
+  virtual Iterator *NewIterator() const {
+    return new MapIterator(&dic_);
+  }
+
  private:
+  class Updater : public WriteBatch::Handler {
+   public:
+    explicit Updater(std::map<string, string> *dic) : dic_(dic) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      (*dic_)[key.as_string()] = value.as_string();
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      dic_->erase(key.as_string());
+    }
+
+   private:
+    std::map<string, string> *dic_;
+  };
+
   string filename_;
   bool should_sync_;
   std::map<string, string> dic_;
@@ -315,6 +405,18 @@ bool TinyStorageImpl::Erase(const string &key) {
   return true;
 }
 
+bool TinyStorageImpl::Write(const WriteBatch &batch) {
+  BatchValidator validator(dic_);
+  if (!batch.Iterate(&validator) || !validator.valid()) {
+    LOG(WARNING) << "invalid batch is passed";
+    return false;
+  }
+  Updater updater(&dic_);
+  batch.Iterate(&updater);
+  should_sync_ = true;
+  return true;
+}
+
 bool TinyStorageImpl::Lookup(const string &key, string *value) const {
   std::map<string, string>::const_iterator it = dic_.find(key);
   if (it == dic_.end()) {
@@ -331,6 +433,373 @@ bool TinyStorageImpl::Clear() {
   return Sync();
 }
 
+size_t GetLogRecordSize(const string &key, const string &value) {
+  return kLogRecordHeaderSize + key.size() + value.size();
+}
+
+// Format of a record:
+// |masked crc32c(uint32)|type(uint8)|key_size(uint32)|value_size(uint32)|
+// |key(variable length)|value(variable length)|
+// crc32c covers all the fields after itself.
+void AppendLogRecord(LogRecordType type, const string &key,
+                     const string &value, string *output) {
+  const size_t offset = output->size();
+  const uint32 crc = 0;
+  const uint8 type_uint8 = static_cast<uint8>(type);
+  const uint32 key_size = static_cast<uint32>(key.size());
+  const uint32 value_size = static_cast<uint32>(value.size());
+  output->append(reinterpret_cast<const char *>(&crc), sizeof(crc));
+  output->append(reinterpret_cast<const char *>(&type_uint8),
+                 sizeof(type_uint8));
+  output->append(reinterpret_cast<const char *>(&key_size),
+                 sizeof(key_size));
+  output->append(reinterpret_cast<const char *>(&value_size),
+                 sizeof(value_size));
+  output->append(key);
+  output->append(value);
+  const uint32 masked_crc = crc32c::Mask(crc32c::Value(
+      output->data() + offset + sizeof(crc),
+      output->size() - offset - sizeof(crc)));
+  memcpy(&(*output)[offset], &masked_crc, sizeof(masked_crc));
+}
+
+class TinyLogStorageImpl : public StorageInterface {
+ public:
+  TinyLogStorageImpl();
+  virtual ~TinyLogStorageImpl();
+
+  virtual bool Open(const string &filename);
+  virtual bool Sync();
+  virtual bool Lookup(const string &key, string *value) const;
+  virtual bool Insert(const string &key, const string &value);
+  virtual bool Erase(const string &key);
+  virtual bool Write(const WriteBatch &batch);
+  virtual bool Clear();
+  virtual size_t Size() const {
+    return dic_.size();
+  }
+
+  virtual Iterator *NewIterator() const {
+    return new MapIterator(&dic_);
+  }
+
+ private:
+  class Updater : public WriteBatch::Handler {
+   public:
+    explicit Updater(TinyLogStorageImpl *storage) : storage_(storage) {}
+
+    virtual void Insert(const StringPiece &key, const StringPiece &value) {
+      storage_->ApplyInsert(key.as_string(), value.as_string());
+    }
+
+    virtual void Erase(const StringPiece &key) {
+      storage_->ApplyErase(key.as_string());
+    }
+
+   private:
+    TinyLogStorageImpl *storage_;
+  };
+
+  // Rewrites the whole file from |dic_|.
+  bool Compact();
+
+  // Updates |dic_| and |live_size_| without logging.
+  bool ApplyInsert(const string &key, const string &value);
+  bool ApplyErase(const string &key);
+  // Returns false without any update if |batch| is invalid.
+  bool ApplyBatch(const WriteBatch &batch);
+
+  string filename_;
+  std::map<string, string> dic_;
+  // Records not written to the file yet.
+  string pending_;
+  // The size of the file, and the size of the file after compaction.
+  size_t file_size_;
+  size_t live_size_;
+  // True if the file is missing or has a broken tail.
+  bool should_compact_;
+
+  DISALLOW_COPY_AND_ASSIGN(TinyLogStorageImpl);
+};
+
+TinyLogStorageImpl::TinyLogStorageImpl()
+    : file_size_(0), live_size_(kLogHeaderSize), should_compact_(true) {}
+
+TinyLogStorageImpl::~TinyLogStorageImpl() {
+  if (!filename_.empty()) {
+    Sync();
+  }
+}
+
+bool TinyLogStorageImpl::Open(const string &filename) {
+  Mmap mmap;
+  dic_.clear();
+  pending_.clear();
+  filename_ = filename;
+  file_size_ = 0;
+  live_size_ = kLogHeaderSize;
+  should_compact_ = true;
+  if (!mmap.Open(filename.c_str(), "r")) {
+    LOG(WARNING) << "cannot open:" << filename;
+    // The file is created on the first Sync().
+    return true;
+  }
+
+  if (mmap.size() > kMaxLogFileSize) {
+    LOG(ERROR) << "tring to open too big file";
+    return false;
+  }
+
+  char *begin = mmap.begin();
+  const char *end = mmap.end();
+
+  uint32 magic = 0;
+  uint32 version = 0;
+  if (!ReadData<uint32>(&begin, end, &magic) || magic != kLogStorageMagicId) {
+    LOG(ERROR) << "file magic is broken";
+    return false;
+  }
+
+  if (!ReadData<uint32>(&begin, end, &version) ||
+      version != kLogStorageVersion) {
+    LOG(ERROR) << "Incompatible version";
+    return false;
+  }
+
+  // End of the last valid record.
+  char *valid_end = begin;
+  while (begin < end) {
+    // A broken record can only be at the tail, written by an
+    // interrupted Sync(). Drops it and the following data.
+    if (static_cast<size_t>(end - begin) < kLogRecordHeaderSize) {
+      LOG(WARNING) << "truncated record header: " << filename_;
+      break;
+    }
+    char *record = begin;
+    uint32 masked_crc = 0;
+    uint8 type = 0;
+    uint32 key_size = 0;
+    uint32 value_size = 0;
+    ReadData<uint32>(&begin, end, &masked_crc);
+    ReadData<uint8>(&begin, end, &type);
+    ReadData<uint32>(&begin, end, &key_size);
+    ReadData<uint32>(&begin, end, &value_size);
+    if (key_size > static_cast<size_t>(end - begin) ||
+        value_size > static_cast<size_t>(end - begin) - key_size) {
+      LOG(WARNING) << "truncated record: " << filename_;
+      break;
+    }
+    const char *data = record + sizeof(masked_crc);
+    const size_t data_size = begin + key_size + value_size - data;
+    if (crc32c::Unmask(masked_crc) != crc32c::Value(data, data_size)) {
+      LOG(WARNING) << "checksum mismatch: " << filename_;
+      break;
+    }
+
+    const string key(begin, key_size);
+    begin += key_size;
+    const string value(begin, value_size);
+    begin += value_size;
+    valid_end = begin;
+
+    if (type == LOG_BATCH) {
+      WriteBatch batch;
+      if (!batch.SetContents(value) || !ApplyBatch(batch)) {
+        LOG(ERROR) << "batch record is broken";
+        dic_.clear();
+        return false;
+      }
+      continue;
+    }
+
+    std::map<string, string>::iterator it = dic_.find(key);
+    if (it != dic_.end()) {
+      live_size_ -= GetLogRecordSize(it->first, it->second);
+    }
+    if (type == LOG_INSERT) {
+      if (IsInvalid(key, value, it == dic_.end() ? dic_.size() : 0)) {
+        dic_.clear();
+        return false;
+      }
+      dic_[key] = value;
+      live_size_ += GetLogRecordSize(key, value);
+    } else if (type == LOG_ERASE) {
+      if (it != dic_.end()) {
+        dic_.erase(it);
+      }
+    } else {
+      LOG(ERROR) << "unknown record type: " << static_cast<int>(type);
+      dic_.clear();
+      return false;
+    }
+  }
+
+  // The broken tail is removed by the compaction at the next Sync(), so
+  // that the following records are not appended behind it.
+  file_size_ = valid_end - mmap.begin();
+  should_compact_ = (file_size_ != mmap.size());
+  return true;
+}
+
+bool TinyLogStorageImpl::Sync() {
+  if (pending_.empty() && !should_compact_) {
+    VLOG(2) << "Already synced";
+    return true;
+  }
+
+  const size_t garbage_size = file_size_ + pending_.size() - live_size_;
+  if (should_compact_ ||
+      (garbage_size > live_size_ && garbage_size > kMinCompactionSize)) {
+    return Compact();
+  }
+
+  OutputFileStream ofs(filename_.c_str(),
+                       ios::binary | ios::out | ios::app);
+  if (!ofs) {
+    LOG(ERROR) << "cannot open " << filename_;
+    return false;
+  }
+  ofs.write(pending_.data(), pending_.size());
+  ofs.close();
+  if (ofs.fail()) {
+    // The tail may be written partially.
+    LOG(ERROR) << "cannot append to " << filename_;
+    should_compact_ = true;
+    return false;
+  }
+
+  file_size_ += pending_.size();
+  pending_.clear();
+  return true;
+}
+
+bool TinyLogStorageImpl::Compact() {
+  const string output_filename = filename_ + ".tmp";
+
+  OutputFileStream ofs(output_filename.c_str(),
+                       ios::binary | ios::out);
+  if (!ofs) {
+    LOG(ERROR) << "cannot open " << output_filename;
+    return false;
+  }
+
+  string output;
+  output.reserve(live_size_);
+  output.append(reinterpret_cast<const char *>(&kLogStorageMagicId),
+                sizeof(kLogStorageMagicId));
+  output.append(reinterpret_cast<const char *>(&kLogStorageVersion),
+                sizeof(kLogStorageVersion));
+  for (std::map<string, string>::const_iterator it = dic_.begin();
+       it != dic_.end(); ++it) {
+    AppendLogRecord(LOG_INSERT, it->first, it->second, &output);
+  }
+  DCHECK_EQ(live_size_, output.size());
+  ofs.write(output.data(), output.size());
+
+  // should call close(). Othrwise AtomicRename will be failed.
+  ofs.close();
+
+  if (!FileUtil::AtomicRename(output_filename, filename_)) {
+    LOG(ERROR) << "AtomicRename failed";
+    return false;
+  }
+
+#ifdef OS_WIN
+  if (!FileUtil::HideFile(filename_)) {
+    LOG(ERROR) << "Cannot make hidden: " << filename_
+               << " " << ::GetLastError();
+  }
+#endif
+
+  file_size_ = output.size();
+  pending_.clear();
+  should_compact_ = false;
+  return true;
+}
+
+bool TinyLogStorageImpl::ApplyInsert(const string &key,
+                                     const string &value) {
+  std::map<string, string>::iterator it = dic_.find(key);
+  if (IsInvalid(key, value, it == dic_.end() ? dic_.size() : 0)) {
+    LOG(WARNING) << "invalid key/value is passed";
+    return false;
+  }
+  if (it == dic_.end()) {
+    it = dic_.insert(std::make_pair(key, string())).first;
+  } else {
+    live_size_ -= GetLogRecordSize(it->first, it->second);
+  }
+  it->second = value;
+  live_size_ += GetLogRecordSize(key, value);
+  return true;
+}
+
+bool TinyLogStorageImpl::ApplyErase(const string &key) {
+  std::map<string, string>::iterator it = dic_.find(key);
+  if (it == dic_.end()) {
+    VLOG(2) << "cannot erase key: " << key;
+    return false;
+  }
+  live_size_ -= GetLogRecordSize(it->first, it->second);
+  dic_.erase(it);
+  return true;
+}
+
+bool TinyLogStorageImpl::ApplyBatch(const WriteBatch &batch) {
+  BatchValidator validator(dic_);
+  if (!batch.Iterate(&validator) || !validator.valid()) {
+    LOG(WARNING) << "invalid batch is passed";
+    return false;
+  }
+  Updater updater(this);
+  batch.Iterate(&updater);
+  return true;
+}
+
+bool TinyLogStorageImpl::Insert(const string &key, const string &value) {
+  if (!ApplyInsert(key, value)) {
+    return false;
+  }
+  AppendLogRecord(LOG_INSERT, key, value, &pending_);
+  return true;
+}
+
+bool TinyLogStorageImpl::Erase(const string &key) {
+  if (!ApplyErase(key)) {
+    return false;
+  }
+  AppendLogRecord(LOG_ERASE, key, "", &pending_);
+  return true;
+}
+
+// The batch is logged as one record, so that a broken tail never leaves
+// a part of the batch.
+bool TinyLogStorageImpl::Write(const WriteBatch &batch) {
+  if (!ApplyBatch(batch)) {
+    return false;
+  }
+  AppendLogRecord(LOG_BATCH, "", batch.contents(), &pending_);
+  return true;
+}
+
+bool TinyLogStorageImpl::Lookup(const string &key, string *value) const {
+  std::map<string, string>::const_iterator it = dic_.find(key);
+  if (it == dic_.end()) {
+    VLOG(3) << "cannot find key: " << key;
+    return false;
+  }
+  *value = it->second;
+  return true;
+}
+
+bool TinyLogStorageImpl::Clear() {
+  dic_.clear();
+  pending_.clear();
+  live_size_ = kLogHeaderSize;
+  should_compact_ = true;
+  return Sync();
+}
+
 }  // namespace
 
 StorageInterface *TinyStorage::Create(const char *filename) {
@@ -346,5 +815,18 @@ StorageInterface *TinyStorage::New() {
   return new TinyStorageImpl;
 }
 
+StorageInterface *TinyStorage::CreateAppendOnly(const char *filename) {
+  std::unique_ptr<TinyLogStorageImpl> storage(new TinyLogStorageImpl);
+  if (!storage->Open(filename)) {
+    LOG(ERROR) << "cannot open " << filename;
+    return NULL;
+  }
+  return storage.release();
+}
+
+StorageInterface *TinyStorage::NewAppendOnly() {
+  return new TinyLogStorageImpl;
+}
+
 }  // namespace storage
 }  // namespace gbase
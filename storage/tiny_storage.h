@@ -48,6 +48,13 @@ class TinyStorage {
   static StorageInterface *New();
   static StorageInterface *Create(const char *filename);
 
+  // Same as above, but the file is an append-only log of Insert/Erase
+  // records. Sync() appends only the changes since the last Sync(), and
+  // rewrites the whole file only when the log has too much garbage.
+  // The file format is not compatible with the one of New().
+  static StorageInterface *NewAppendOnly();
+  static StorageInterface *CreateAppendOnly(const char *filename);
+
  private:
   DISALLOW_IMPLICIT_CONSTRUCTORS(TinyStorage);
 };
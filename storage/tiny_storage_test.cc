@@ -29,6 +29,7 @@
 
 #include "storage/tiny_storage.h"
 
+#include <iterator>
 #include <map>
 #include <memory>
 #include <set>
@@ -36,10 +37,12 @@
 #include <utility>
 #include <vector>
 
+#include "base/file_stream.h"
 #include "base/file_util.h"
 #include "base/port.h"
 #include "base/flags.h"
 #include "storage/storage_interface.h"
+#include "storage/write_batch.h"
 #include "gtest/gtest.h"
 
 namespace gbase {
@@ -59,6 +62,17 @@ void CreateKeyValue(std::map<string, string> *output, int size) {
   }
 }
 
+string ReadFile(const string &filename) {
+  InputFileStream ifs(filename.c_str(), ios::binary | ios::in);
+  return string(std::istreambuf_iterator<char>(ifs),
+                std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const string &filename, const string &data) {
+  OutputFileStream ofs(filename.c_str(), ios::binary | ios::out);
+  ofs.write(data.data(), data.size());
+}
+
 }  // namespace
 
 class TinyStorageTest : public testing::Test {
@@ -174,5 +188,205 @@ TEST_F(TinyStorageTest, TinyStorageTest) {
   }
 }
 
+TEST_F(TinyStorageTest, AppendOnlyTest) {
+  const string filename = GetTemporaryFilePath();
+  std::map<string, string> target;
+  CreateKeyValue(&target, 100);
+
+  {
+    std::unique_ptr<StorageInterface> storage(TinyStorage::NewAppendOnly());
+    EXPECT_TRUE(storage->Open(filename));
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      EXPECT_TRUE(storage->Insert(it->first, it->second));
+    }
+    EXPECT_TRUE(storage->Sync());
+    const size_t file_size = ReadFile(filename).size();
+
+    // Only the change is appended.
+    EXPECT_TRUE(storage->Insert("key0", "new_value0"));
+    EXPECT_TRUE(storage->Erase("key1"));
+    EXPECT_TRUE(storage->Sync());
+    EXPECT_EQ(file_size + 13 + 4 + 10 + 13 + 4, ReadFile(filename).size());
+  }
+
+  target["key0"] = "new_value0";
+  target.erase("key1");
+  {
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    EXPECT_EQ(target.size(), storage->Size());
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      string value;
+      EXPECT_TRUE(storage->Lookup(it->first, &value));
+      EXPECT_EQ(it->second, value);
+    }
+    string value;
+    EXPECT_FALSE(storage->Lookup("key1", &value));
+  }
+
+  // The broken tail is dropped.
+  {
+    const string data = ReadFile(filename);
+    WriteFile(filename, data.substr(0, data.size() - 3));
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    string value;
+    EXPECT_TRUE(storage->Lookup("key1", &value));
+    EXPECT_TRUE(storage->Lookup("key0", &value));
+    EXPECT_EQ("new_value0", value);
+    EXPECT_TRUE(storage->Insert("key2", "new_value2"));
+  }
+  {
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    string value;
+    EXPECT_TRUE(storage->Lookup("key2", &value));
+    EXPECT_EQ("new_value2", value);
+  }
+
+  // A tail cut right after a record header is dropped as well.
+  {
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    EXPECT_TRUE(storage->Insert("key100", "value100"));
+    EXPECT_TRUE(storage->Sync());
+  }
+  {
+    const string data = ReadFile(filename);
+    // Cuts the key and the value of the last record.
+    WriteFile(filename, data.substr(0, data.size() - 6 - 8));
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    string value;
+    EXPECT_FALSE(storage->Lookup("key100", &value));
+    EXPECT_TRUE(storage->Insert("key101", "value101"));
+    EXPECT_TRUE(storage->Sync());
+  }
+  {
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    ASSERT_TRUE(storage.get() != NULL);
+    string value;
+    EXPECT_TRUE(storage->Lookup("key101", &value));
+    EXPECT_EQ("value101", value);
+    EXPECT_TRUE(storage->Lookup("key2", &value));
+  }
+
+  // Garbage is compacted.
+  {
+    std::unique_ptr<StorageInterface> storage(
+        TinyStorage::CreateAppendOnly(filename.c_str()));
+    const string value(1000, 'a');
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_TRUE(storage->Insert("key0", value));
+      EXPECT_TRUE(storage->Sync());
+    }
+    EXPECT_GT(300 * 1000, ReadFile(filename).size());
+    EXPECT_TRUE(storage->Clear());
+    EXPECT_EQ(0, storage->Size());
+    EXPECT_EQ(8, ReadFile(filename).size());
+  }
+}
+
+TEST_F(TinyStorageTest, WriteBatchTest) {
+  const string filename = GetTemporaryFilePath();
+  for (int append_only = 0; append_only < 2; ++append_only) {
+    UnlinkDBFileIfExists();
+    {
+      std::unique_ptr<StorageInterface> storage(
+          append_only ? TinyStorage::NewAppendOnly() : TinyStorage::New());
+      EXPECT_TRUE(storage->Open(filename));
+      EXPECT_TRUE(storage->Insert("key0", "value0"));
+      EXPECT_TRUE(storage->Sync());
+
+      WriteBatch batch;
+      batch.Insert("key1", "value1");
+      batch.Insert("key2", "value2");
+      batch.Erase("key0");
+      batch.Erase("key1");
+      batch.Erase("dummy");
+      EXPECT_TRUE(storage->Write(batch));
+      EXPECT_EQ(1, storage->Size());
+      string value;
+      EXPECT_FALSE(storage->Lookup("key0", &value));
+      EXPECT_FALSE(storage->Lookup("key1", &value));
+      EXPECT_TRUE(storage->Lookup("key2", &value));
+      EXPECT_EQ("value2", value);
+
+      // An invalid batch is not applied at all.
+      batch.Clear();
+      batch.Insert("key3", "value3");
+      batch.Insert("key4", string(10000, 'a'));
+      EXPECT_FALSE(storage->Write(batch));
+      EXPECT_FALSE(storage->Lookup("key3", &value));
+      EXPECT_TRUE(storage->Sync());
+    }
+
+    const string data = ReadFile(filename);
+    {
+      std::unique_ptr<StorageInterface> storage(
+          append_only ? TinyStorage::CreateAppendOnly(filename.c_str()) :
+          TinyStorage::Create(filename.c_str()));
+      ASSERT_TRUE(storage.get() != NULL);
+      EXPECT_EQ(1, storage->Size());
+      string value;
+      EXPECT_TRUE(storage->Lookup("key2", &value));
+      EXPECT_EQ("value2", value);
+    }
+
+    if (append_only) {
+      // A batch with a broken tail is dropped as a whole.
+      WriteFile(filename, data.substr(0, data.size() - 1));
+      std::unique_ptr<StorageInterface> storage(
+          TinyStorage::CreateAppendOnly(filename.c_str()));
+      ASSERT_TRUE(storage.get() != NULL);
+      EXPECT_EQ(1, storage->Size());
+      string value;
+      EXPECT_TRUE(storage->Lookup("key0", &value));
+      EXPECT_FALSE(storage->Lookup("key2", &value));
+    }
+  }
+}
+
+TEST_F(TinyStorageTest, IteratorTest) {
+  std::map<string, string> target;
+  CreateKeyValue(&target, 100);
+  for (int append_only = 0; append_only < 2; ++append_only) {
+    UnlinkDBFileIfExists();
+    std::unique_ptr<StorageInterface> storage(
+        append_only ? TinyStorage::NewAppendOnly() : TinyStorage::New());
+    EXPECT_TRUE(storage->Open(GetTemporaryFilePath()));
+    for (std::map<string, string>::const_iterator it = target.begin();
+         it != target.end(); ++it) {
+      EXPECT_TRUE(storage->Insert(it->first, it->second));
+    }
+
+    std::unique_ptr<StorageInterface::Iterator> iter(storage->NewIterator());
+    ASSERT_TRUE(iter.get() != NULL);
+    std::map<string, string>::const_iterator expected = target.begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++expected) {
+      ASSERT_TRUE(expected != target.end());
+      EXPECT_EQ(expected->first, iter->key().as_string());
+      EXPECT_EQ(expected->second, iter->value().as_string());
+    }
+    EXPECT_TRUE(expected == target.end());
+
+    // "key1", "key10", ..., "key19".
+    iter.reset(storage->NewPrefixIterator("key1"));
+    int num_keys = 0;
+    for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+      ++num_keys;
+    }
+    EXPECT_EQ(11, num_keys);
+  }
+}
+
 }  // namespace storage
 }  // namespace gbase
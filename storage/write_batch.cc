@@ -0,0 +1,150 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/write_batch.h"
+
+#include <string>
+
+#include "base/coding.h"
+#include "base/logging.h"
+#include "base/port.h"
+#include "base/string_piece.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+// |count(fixed32)|
+const size_t kHeaderSize = 4;
+
+enum RecordType {
+  kInsert = 1,
+  kErase = 2,
+};
+
+// Handler which only checks the format.
+class NullHandler : public WriteBatch::Handler {
+ public:
+  NullHandler() {}
+  virtual void Insert(const StringPiece &key, const StringPiece &value) {}
+  virtual void Erase(const StringPiece &key) {}
+};
+
+bool IterateContents(const StringPiece &contents,
+                     WriteBatch::Handler *handler) {
+  if (contents.size() < kHeaderSize) {
+    LOG(ERROR) << "too small write batch";
+    return false;
+  }
+  const uint32 count = DecodeFixed32(contents.data());
+  StringPiece input(contents);
+  input.remove_prefix(kHeaderSize);
+  uint32 found = 0;
+  while (!input.empty()) {
+    const char type = input[0];
+    input.remove_prefix(1);
+    StringPiece key, value;
+    switch (type) {
+      case kInsert:
+        if (!GetLengthPrefixedStringPiece(&input, &key) ||
+            !GetLengthPrefixedStringPiece(&input, &value)) {
+          LOG(ERROR) << "broken insert record";
+          return false;
+        }
+        handler->Insert(key, value);
+        break;
+      case kErase:
+        if (!GetLengthPrefixedStringPiece(&input, &key)) {
+          LOG(ERROR) << "broken erase record";
+          return false;
+        }
+        handler->Erase(key);
+        break;
+      default:
+        LOG(ERROR) << "unknown record type: " << static_cast<int>(type);
+        return false;
+    }
+    ++found;
+  }
+  if (found != count) {
+    LOG(ERROR) << "write batch has wrong count";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+WriteBatch::WriteBatch() {
+  Clear();
+}
+
+WriteBatch::~WriteBatch() {}
+
+void WriteBatch::Insert(const StringPiece &key, const StringPiece &value) {
+  EncodeFixed32(&rep_[0], DecodeFixed32(rep_.data()) + 1);
+  rep_.push_back(static_cast<char>(kInsert));
+  PutLengthPrefixedStringPiece(&rep_, key);
+  PutLengthPrefixedStringPiece(&rep_, value);
+}
+
+void WriteBatch::Erase(const StringPiece &key) {
+  EncodeFixed32(&rep_[0], DecodeFixed32(rep_.data()) + 1);
+  rep_.push_back(static_cast<char>(kErase));
+  PutLengthPrefixedStringPiece(&rep_, key);
+}
+
+void WriteBatch::Append(const WriteBatch &batch) {
+  EncodeFixed32(&rep_[0], DecodeFixed32(rep_.data()) + batch.Count());
+  rep_.append(batch.rep_, kHeaderSize, string::npos);
+}
+
+void WriteBatch::Clear() {
+  rep_.assign(kHeaderSize, '\0');
+}
+
+size_t WriteBatch::Count() const {
+  return DecodeFixed32(rep_.data());
+}
+
+bool WriteBatch::SetContents(const StringPiece &contents) {
+  NullHandler handler;
+  if (!IterateContents(contents, &handler)) {
+    return false;
+  }
+  rep_.assign(contents.data(), contents.size());
+  return true;
+}
+
+bool WriteBatch::Iterate(Handler *handler) const {
+  return IterateContents(rep_, handler);
+}
+
+}  // namespace storage
+}  // namespace gbase
@@ -0,0 +1,105 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef GBASE_STORAGE_WRITE_BATCH_H_
+#define GBASE_STORAGE_WRITE_BATCH_H_
+
+#include <string>
+
+#include "base/port.h"
+#include "base/string_piece.h"
+
+namespace gbase {
+namespace storage {
+
+// WriteBatch holds a sequence of updates which are applied atomically by
+// StorageInterface::Write(). The updates are applied in the order they
+// were added.
+//
+// Example:
+//  WriteBatch batch;
+//  batch.Erase("key1");
+//  batch.Insert("key2", value);
+//  CHECK(storage->Write(batch));
+class WriteBatch {
+ public:
+  class Handler {
+   public:
+    Handler() {}
+    virtual ~Handler() {}
+    virtual void Insert(const StringPiece &key, const StringPiece &value) = 0;
+    virtual void Erase(const StringPiece &key) = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Handler);
+  };
+
+  WriteBatch();
+  ~WriteBatch();
+
+  void Insert(const StringPiece &key, const StringPiece &value);
+  // Erasing a missing key is not an error.
+  void Erase(const StringPiece &key);
+
+  // Appends all the updates of |batch|.
+  void Append(const WriteBatch &batch);
+
+  void Clear();
+
+  // Returns the number of updates.
+  size_t Count() const;
+
+  bool empty() const {
+    return Count() == 0;
+  }
+
+  // Serialized updates, which can be restored by SetContents().
+  const string &contents() const {
+    return rep_;
+  }
+
+  // Returns false and keeps the current updates if |contents| is broken.
+  bool SetContents(const StringPiece &contents);
+
+  // Calls |handler| for each update in order.
+  // Returns false if the contents are broken.
+  bool Iterate(Handler *handler) const;
+
+ private:
+  // Format:
+  // |count(fixed32)|record|...|record|
+  // record: |kInsert(uint8)|key(length prefixed)|value(length prefixed)| or
+  //         |kErase(uint8)|key(length prefixed)|
+  string rep_;
+};
+
+}  // namespace storage
+}  // namespace gbase
+
+#endif  // GBASE_STORAGE_WRITE_BATCH_H_
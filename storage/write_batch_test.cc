@@ -0,0 +1,130 @@
+// Copyright 2010-2016, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "storage/write_batch.h"
+
+#include <string>
+
+#include "base/port.h"
+#include "base/string_piece.h"
+#include "gtest/gtest.h"
+
+namespace gbase {
+namespace storage {
+namespace {
+
+class PrintHandler : public WriteBatch::Handler {
+ public:
+  PrintHandler() {}
+
+  virtual void Insert(const StringPiece &key, const StringPiece &value) {
+    output_ += "Insert(" + key.as_string() + "," + value.as_string() + ")";
+  }
+
+  virtual void Erase(const StringPiece &key) {
+    output_ += "Erase(" + key.as_string() + ")";
+  }
+
+  const string &output() const {
+    return output_;
+  }
+
+ private:
+  string output_;
+};
+
+string Print(const WriteBatch &batch) {
+  PrintHandler handler;
+  EXPECT_TRUE(batch.Iterate(&handler));
+  return handler.output();
+}
+
+TEST(WriteBatchTest, BasicTest) {
+  WriteBatch batch;
+  EXPECT_TRUE(batch.empty());
+  EXPECT_EQ(0, batch.Count());
+  EXPECT_EQ("", Print(batch));
+
+  batch.Insert("foo", "bar");
+  batch.Erase("box");
+  batch.Insert("baz", "");
+  EXPECT_FALSE(batch.empty());
+  EXPECT_EQ(3, batch.Count());
+  EXPECT_EQ("Insert(foo,bar)Erase(box)Insert(baz,)", Print(batch));
+
+  batch.Clear();
+  EXPECT_TRUE(batch.empty());
+  EXPECT_EQ("", Print(batch));
+}
+
+TEST(WriteBatchTest, AppendTest) {
+  WriteBatch b1, b2;
+  b1.Append(b2);
+  EXPECT_EQ(0, b1.Count());
+
+  b2.Insert("a", "va");
+  b1.Append(b2);
+  EXPECT_EQ(1, b1.Count());
+  EXPECT_EQ("Insert(a,va)", Print(b1));
+
+  b2.Clear();
+  b2.Insert("b", "vb");
+  b2.Erase("a");
+  b1.Append(b2);
+  EXPECT_EQ(3, b1.Count());
+  EXPECT_EQ("Insert(a,va)Insert(b,vb)Erase(a)", Print(b1));
+}
+
+TEST(WriteBatchTest, ContentsTest) {
+  WriteBatch batch;
+  batch.Insert("foo", "bar");
+  batch.Erase("box");
+
+  WriteBatch restored;
+  EXPECT_TRUE(restored.SetContents(batch.contents()));
+  EXPECT_EQ(2, restored.Count());
+  EXPECT_EQ("Insert(foo,bar)Erase(box)", Print(restored));
+
+  // Broken contents are rejected.
+  const string &contents = batch.contents();
+  EXPECT_FALSE(restored.SetContents(""));
+  EXPECT_FALSE(restored.SetContents(
+      StringPiece(contents.data(), contents.size() - 1)));
+  string wrong_count = contents;
+  wrong_count[0] = 3;
+  EXPECT_FALSE(restored.SetContents(wrong_count));
+  string wrong_type = contents;
+  wrong_type[4] = 10;
+  EXPECT_FALSE(restored.SetContents(wrong_type));
+  EXPECT_EQ("Insert(foo,bar)Erase(box)", Print(restored));
+}
+
+}  // namespace
+}  // namespace storage
+}  // namespace gbase